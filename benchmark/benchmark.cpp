@@ -0,0 +1,350 @@
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "Renderer.h"
+
+// Renders a fixed catalogue of views headlessly at a few resolutions and iteration limits,
+// and writes the timings out as JSON. Nothing is random and nothing depends on a window,
+// so runs on a CPU OpenCL runtime like POCL line up across machines. Pick the device with
+// --device, the index is the order OpenCL enumerates them in
+
+struct Benchmark {
+	const char* name;
+	const char* center_x;
+	const char* center_y;
+	double width;
+};
+
+// Centers are strings so the deep one parses at full precision
+const Benchmark VIEWS[] = {
+	{ "full set",        "-0.75",               "0.0",               3.5 },
+	{ "seahorse valley", "-0.743644786",        "0.1318252536",      0.003 },
+	{ "deep mini-brot",  "-1.7548776662466927", "0.0",               2e-7 },
+	{ "all interior",    "-0.2",                "0.0",               0.2 },
+	{ "all exterior",    "1.5",                 "1.5",               0.5 },
+};
+
+const sf::Vector2i RESOLUTIONS[] = {
+	sf::Vector2i(640, 360),
+	sf::Vector2i(1280, 720),
+	sf::Vector2i(1920, 1080),
+};
+
+const int ITERATION_LIMITS[] = { 256, 1000, 2000 };
+
+struct Options {
+
+	// Index into the devices OpenCL enumerates, -1 uses the saved one or device 0
+	int device = -1;
+
+	// Timed renders of every view, after the warmup ones
+	int frames = 20;
+	int warmup = 2;
+
+	// Only the smallest resolution at the default limit, for a quick sanity check
+	bool quick = false;
+
+	// Also render every view as an exponential map strip, to compare its throughput with
+	// rendering the frame directly
+	bool exponential_map = false;
+
+	std::string output_path = "benchmark.json";
+};
+
+struct Result {
+	std::string view;
+	sf::Vector2i resolution;
+	int max_iterations;
+	std::string precision;
+
+	// Escape counts of every pixel added up. Pixels the cardioid, bulb and periodicity tests
+	// short-circuited are left out, they never ran to the limit their count says. What a
+	// periodic pixel ran before it was caught goes uncounted
+	long long iterations;
+	long long short_circuited_pixels;
+
+	double mean_ms;
+	double p50_ms;
+	double p99_ms;
+
+	// Strip pixels a second for the rows the view spans, and a resample out of them
+	double strip_mpix_per_second = 0.0;
+	double resample_ms = 0.0;
+};
+
+void print_usage(const char* program) {
+
+	std::cout << "Usage : " << program << " [--device index] [--frames n] [--warmup n] [--quick] [--exponential-map] [--output path]" << std::endl;
+}
+
+bool parse_arguments(int argc, char* argv[], Options &options) {
+
+	for (int i = 1; i < argc; i++) {
+
+		std::string arg = argv[i];
+
+		if (arg == "--device" && i + 1 < argc) {
+			options.device = atoi(argv[++i]);
+		}
+		else if (arg == "--frames" && i + 1 < argc) {
+			options.frames = atoi(argv[++i]);
+		}
+		else if (arg == "--warmup" && i + 1 < argc) {
+			options.warmup = atoi(argv[++i]);
+		}
+		else if (arg == "--quick") {
+			options.quick = true;
+		}
+		else if (arg == "--exponential-map") {
+			options.exponential_map = true;
+		}
+		else if (arg == "--output" && i + 1 < argc) {
+			options.output_path = argv[++i];
+		}
+		else {
+			std::cout << "Unknown or incomplete argument : " << arg << std::endl;
+			return false;
+		}
+	}
+
+	if (options.frames <= 0 || options.warmup < 0) {
+		std::cout << "Need at least one timed frame" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+View benchmark_view(const Benchmark &benchmark, sf::Vector2i resolution) {
+
+	View view;
+	view.width = benchmark.width;
+	view.height = benchmark.width * resolution.y / resolution.x;
+	view.fit_precision();
+
+	int limbs = FixedPoint::limbs_for_spacing(view.pixel_spacing(resolution));
+	// The built in centres always parse
+	FixedPoint::from_string(benchmark.center_x, limbs, view.center_x);
+	FixedPoint::from_string(benchmark.center_y, limbs, view.center_y);
+
+	return view;
+}
+
+// Nearest rank
+double percentile(std::vector<double> sorted, double p) {
+
+	size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+	return sorted[std::min(std::max(rank, static_cast<size_t>(1)), sorted.size()) - 1];
+}
+
+std::string json_string(const std::string &text) {
+
+	std::string quoted = "\"";
+	for (char c : text) {
+		if (c == '"' || c == '\\')
+			quoted += '\\';
+		if (static_cast<unsigned char>(c) >= 0x20)
+			quoted += c;
+	}
+	return quoted + "\"";
+}
+
+bool write_json(const Options &options, const std::string &device, const std::vector<Result> &results) {
+
+	std::ofstream output(options.output_path, std::ofstream::out | std::ofstream::trunc);
+
+	if (!output.is_open()) {
+		std::cout << "Couldn't write " << options.output_path << std::endl;
+		return false;
+	}
+
+	output << "{\n";
+	output << "  \"device\": " << json_string(device) << ",\n";
+	output << "  \"frames\": " << options.frames << ",\n";
+	output << "  \"warmup\": " << options.warmup << ",\n";
+	output << "  \"results\": [\n";
+
+	for (size_t i = 0; i < results.size(); i++) {
+
+		const Result &result = results[i];
+
+		double pixels = static_cast<double>(result.resolution.x) * result.resolution.y;
+		double seconds = result.mean_ms / 1000.0;
+
+		output << "    {";
+		output << " \"view\": " << json_string(result.view) << ",";
+		output << " \"width\": " << result.resolution.x << ",";
+		output << " \"height\": " << result.resolution.y << ",";
+		output << " \"max_iterations\": " << result.max_iterations << ",";
+		output << " \"precision\": " << json_string(result.precision) << ",";
+		output << " \"iterations\": " << result.iterations << ",";
+		output << " \"short_circuited_pixels\": " << result.short_circuited_pixels << ",";
+		output << " \"mpix_per_second\": " << pixels / seconds / 1e6 << ",";
+		output << " \"iterations_per_second\": " << result.iterations / seconds << ",";
+		output << " \"mean_ms\": " << result.mean_ms << ",";
+		output << " \"p50_ms\": " << result.p50_ms << ",";
+		output << " \"p99_ms\": " << result.p99_ms;
+		if (options.exponential_map) {
+			output << ", \"strip_mpix_per_second\": " << result.strip_mpix_per_second << ",";
+			output << " \"resample_ms\": " << result.resample_ms;
+		}
+		output << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+
+	output << "  ]\n";
+	output << "}\n";
+
+	return true;
+}
+
+// The first frame of a strip renders every row the view spans, the frames after it only resample
+bool benchmark_exponential_map(Renderer &renderer, const View &view, const Options &options, Result &result) {
+
+	typedef std::chrono::steady_clock clock;
+
+	double outer_radius = 0.5 * std::hypot(view.width, view.height);
+	double inner_radius = 0.5 * view.pixel_spacing(result.resolution);
+
+	double strip_ms = 0.0;
+	long long strip_pixels = 0;
+
+	for (int i = 0; i < options.frames; i++) {
+
+		if (!renderer.begin_exponential_map(view.center_x, view.center_y, outer_radius, inner_radius))
+			return false;
+
+		clock::time_point start = clock::now();
+		if (!renderer.render_exponential_map(view.width, view.height))
+			return false;
+
+		strip_ms += std::chrono::duration<double, std::milli>(clock::now() - start).count();
+		strip_pixels += renderer.get_strip_pixels();
+	}
+
+	std::vector<double> times;
+
+	for (int i = 0; i < options.frames; i++) {
+
+		clock::time_point start = clock::now();
+		if (!renderer.render_exponential_map(view.width, view.height))
+			return false;
+
+		times.push_back(std::chrono::duration<double, std::milli>(clock::now() - start).count());
+	}
+
+	std::sort(times.begin(), times.end());
+
+	// Resampling is in the strip time as well, it's small enough not to matter
+	result.strip_mpix_per_second = strip_pixels / strip_ms / 1000.0;
+	result.resample_ms = percentile(times, 0.5);
+
+	std::cout << "  as an exponential map : " << result.strip_mpix_per_second << " strip Mpix/s, "
+		<< result.resample_ms << " ms p50 to resample" << std::endl;
+
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+
+	Options options;
+	if (!parse_arguments(argc, argv, options)) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	typedef std::chrono::steady_clock clock;
+
+	std::vector<Result> results;
+	std::string device;
+
+	for (sf::Vector2i resolution : RESOLUTIONS) {
+		for (int limit : ITERATION_LIMITS) {
+
+			if (options.quick && (resolution != RESOLUTIONS[0] || limit != 2000))
+				continue;
+
+			// The kernels are built around the limit, so every one gets its own renderer
+			Renderer renderer;
+			renderer.set_device(options.device);
+			renderer.set_max_iterations(limit);
+
+			if (!renderer.init(resolution, true, false))
+				return -1;
+
+			if (renderer.is_cpu()) {
+				std::cout << "The benchmark needs an OpenCL device" << std::endl;
+				return -1;
+			}
+
+			device = renderer.get_device_name();
+
+			for (const Benchmark &benchmark : VIEWS) {
+
+				renderer.set_view(benchmark_view(benchmark, resolution));
+
+				for (int i = 0; i < options.warmup; i++) {
+					renderer.invalidate();
+					renderer.render();
+				}
+
+				std::vector<double> times;
+
+				for (int i = 0; i < options.frames; i++) {
+					renderer.invalidate();
+
+					clock::time_point start = clock::now();
+					renderer.render();
+					times.push_back(std::chrono::duration<double, std::milli>(clock::now() - start).count());
+				}
+
+				std::vector<cl_ushort> iterations;
+				if (!renderer.read_iterations(iterations))
+					return -1;
+
+				Result result;
+				result.view = benchmark.name;
+				result.resolution = resolution;
+				result.max_iterations = limit;
+				result.precision = Renderer::precision_name(renderer.get_precision());
+
+				result.iterations = 0;
+				for (cl_ushort packed : iterations)
+					result.iterations += packed >> Renderer::ITERATION_FRACTION_BITS;
+
+				result.short_circuited_pixels = static_cast<long long>(renderer.get_cardioid_pixels()) +
+					renderer.get_bulb_pixels() + renderer.get_periodic_pixels();
+				result.iterations -= result.short_circuited_pixels * renderer.get_max_iterations();
+
+				std::sort(times.begin(), times.end());
+
+				double total = 0.0;
+				for (double time : times)
+					total += time;
+
+				result.mean_ms = total / times.size();
+				result.p50_ms = percentile(times, 0.5);
+				result.p99_ms = percentile(times, 0.99);
+
+				std::cout << benchmark.name << " at " << resolution.x << "x" << resolution.y << ", " << limit << " iterations : "
+					<< result.p50_ms << " ms p50, " << result.p99_ms << " ms p99, "
+					<< static_cast<double>(resolution.x) * resolution.y / result.mean_ms / 1000.0 << " Mpix/s" << std::endl;
+
+				if (options.exponential_map && !benchmark_exponential_map(renderer, benchmark_view(benchmark, resolution), options, result))
+					return -1;
+
+				results.push_back(result);
+			}
+		}
+	}
+
+	if (!write_json(options, device, results))
+		return -1;
+
+	std::cout << "Wrote " << options.output_path << std::endl;
+	return 0;
+}
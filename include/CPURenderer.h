@@ -0,0 +1,70 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Vector4.hpp"
+#include "ThreadPool.h"
+
+
+// Native fallback for machines without a usable OpenCL ICD. Runs the same escape
+// time loop as kernels/escape.h, vectorized across SIMD lanes, with the frame
+// split into tiles that are spread over a work stealing thread pool
+class CPURenderer {
+
+public:
+
+	enum simd_level { SCALAR, SSE2, AVX2, AVX512 };
+
+	CPURenderer();
+	~CPURenderer();
+
+	// Detect the widest instruction set this cpu supports and spin up the workers
+	bool init();
+
+	// Allocate the host pixel buffer and the texture it gets uploaded into
+	bool create_image_buffer(sf::Vector2i size, sf::Vector2f position);
+
+	// Host pixels only, for headless renders where there is no GL context to upload to
+	void create_pixel_buffer(sf::Vector2i size);
+
+	// Smooth counts up to `max_iterations` against the bailout, the same limit and radius the
+	// kernels get built with
+	void run_kernel(sf::Vector4f range, sf::Vector2i work_size, int max_iterations, float escape_radius_squared);
+
+	// The frame coloured from the counts, uploaded to the texture if there is one
+	void set_pixels(std::vector<sf::Uint8> pixels);
+
+	void draw(sf::RenderWindow *window);
+
+	// RGBA8, row major, whatever set_pixels was last given
+	const std::vector<sf::Uint8>& get_pixels() const { return pixels; };
+
+	// Packed 11.5 smooth counts, the same layout as the iteration buffers
+	const std::vector<uint16_t>& get_iterations() const { return iterations; };
+
+	simd_level get_simd_level() const { return simd; };
+
+	static const char* simd_name(simd_level level);
+
+private:
+
+	static const int TILE_SIZE = 64;
+	static const int ITERATION_FRACTION_BITS = 5;
+
+	static simd_level detect_simd();
+
+	void render_tile(int tile_index, sf::Vector4f range, sf::Vector2i work_size, int max_iterations, float escape_radius_squared);
+
+	simd_level simd = SCALAR;
+	std::unique_ptr<ThreadPool> pool;
+
+	sf::Vector2i image_size;
+	std::vector<sf::Uint8> pixels;
+	std::vector<uint16_t> iterations;
+
+	std::unique_ptr<sf::Texture> texture;
+	sf::Sprite sprite;
+
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "View.h"
+
+
+// A zoom from a start view into a target point, evaluated per frame. The extent shrinks
+// geometrically, so every frame zooms in by the same factor. The center closes in on the
+// target in step with the shrinking extent, so it drifts across the screen at an even pace
+// and lands on the target exactly on the last frame
+class CameraPath {
+
+public:
+
+	// `zoom` is how many times narrower the last frame is than the first
+	CameraPath(const View &start, const FixedPoint &target_x, const FixedPoint &target_y, double zoom, int frame_count);
+
+	View at(int frame) const;
+
+	int get_frame_count() const { return frame_count; };
+
+private:
+
+	View start;
+	FixedPoint target_x;
+	FixedPoint target_y;
+	double zoom;
+	int frame_count;
+
+};
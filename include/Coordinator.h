@@ -0,0 +1,200 @@
+#pragma once
+
+#include <SFML/Network.hpp>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "View.h"
+#include "TileProtocol.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/types.h>
+#endif
+
+
+// Renders views too big for one machine by cutting them into tiles and handing those to
+// TileWorker processes over TCP, local ones it spawns itself or remote ones that connect
+// on their own. Everything runs on one thread around a SocketSelector.
+//
+// Tiles go out the way ThreadPool hands out jobs. Every worker starts on a contiguous run,
+// and once its own run is gone it steals from the back of the longest one left. When
+// nothing is queued, an idle worker gets a copy of the oldest tile still out on someone
+// else, and whichever copy comes back first is kept, so one slow worker can't hold up the
+// end of a render. Tiles that fail, time out or are out on a worker that drops get retried
+// elsewhere, up to MAX_ATTEMPTS times
+class Coordinator {
+
+public:
+
+	// Square, tiles hanging over the edge of the frame are rendered whole and cropped
+	static const int TILE_SIZE = 256;
+
+	Coordinator();
+	~Coordinator();
+
+	// Port 0 picks any free one
+	bool listen(unsigned short port);
+	unsigned short get_port() const { return listener.getLocalPort(); };
+
+	// Start `count` copies of `executable` on this machine, told to connect back with
+	// --worker. `arguments` get passed on too, e.g. --cpu or --device
+	bool spawn_workers(const std::string &executable, int count, const std::vector<std::string> &arguments);
+
+	// Accept workers until `count` of them have said hello, false on timeout
+	bool wait_for_workers(int count, double timeout_seconds);
+
+	int get_worker_count() const;
+
+	// Passed on to every worker's renderer for the next render, see Renderer::set_escape
+	void set_escape(int interval, double radius);
+
+	// Packed counts of `view` at `resolution`, row major. Only the first `worker_limit`
+	// workers to connect take part, 0 uses every one, including any joining midway
+	bool render(const View &view, sf::Vector2i resolution, int max_iterations, std::vector<uint16_t> &iterations, int worker_limit = 0);
+
+	// Tell the workers to go and wait for the ones spawned here to exit
+	void shutdown();
+
+	struct worker_report {
+		std::string name;
+		int tiles = 0;
+		int stolen = 0;
+		int failed = 0;
+
+		// What the worker reported spending on its tiles, network not included
+		double busy_seconds = 0.0;
+	};
+
+	// Everything below is about the last render, one report per worker taking part
+	std::vector<worker_report> get_reports() const;
+
+	double get_render_seconds() const { return render_seconds; };
+	int get_retries() const { return retries; };
+	int get_steals() const { return steals; };
+	int get_backups() const { return backups; };
+
+	// Raw size of the tiles received over what actually came over the wire
+	double get_compression() const;
+
+	// Tile seconds added up over the workers used and the wall time, how close the render
+	// came to going as many times faster as there were workers
+	double get_efficiency() const;
+
+private:
+
+	// Tiles sent to a worker ahead of its results, so it never sits idle waiting on the network
+	static const int MAX_IN_FLIGHT = 2;
+
+	static const int MAX_ATTEMPTS = 3;
+
+	// A tile out longer than this gets retried elsewhere, the late result still counts
+	static const double TILE_TIMEOUT;
+
+	typedef std::chrono::steady_clock clock;
+
+	struct tile {
+		sf::Vector2i origin;
+		int attempts = 0;
+
+		// Copies out on workers right now, and whether a backup copy was already sent
+		int copies = 0;
+		bool backed_up = false;
+		bool done = false;
+	};
+
+	struct sent_tile {
+		sf::Uint32 job;
+		int tile;
+		clock::time_point sent;
+		bool timed_out = false;
+	};
+
+	struct worker {
+		std::unique_ptr<sf::TcpSocket> socket;
+		bool connected = true;
+		bool hello = false;
+
+		// Configured for the current job and taking tiles
+		bool ready = false;
+		int tile_size = 0;
+		int max_iterations = 0;
+		int escape_interval = 0;
+		double escape_radius = 0.0;
+
+		// Part of the current job, see worker_limit
+		bool active = false;
+
+		std::deque<int> queue;
+		std::vector<sent_tile> sent;
+		worker_report report;
+	};
+
+	// Wait up to `seconds` for something to arrive and handle whatever did
+	void poll(double seconds);
+
+	void accept();
+	void receive(worker &w);
+	void handle_result(worker &w, sf::Packet &packet);
+
+	// Send CONFIG if the worker isn't set up for the current job yet
+	void configure(worker &w);
+
+	// Top up every ready worker's tiles in flight
+	void dispatch();
+
+	// Next tile for `w` from its own queue, someone else's or as a backup, -1 if there is none
+	int next_tile(worker &w);
+
+	bool send_tile(worker &w, int index);
+
+	// Put a tile back in the queue of the least loaded worker besides `from`
+	void retry(int index, const worker *from);
+
+	void check_timeouts();
+
+	// The worker is gone, everything it had goes to the others
+	void drop(worker &w);
+
+	sf::TcpListener listener;
+	sf::SocketSelector selector;
+
+	std::vector<std::unique_ptr<worker>> workers;
+
+	// The job being rendered, job_id tells late results from earlier ones apart
+	bool job_active = false;
+	bool job_failed = false;
+	sf::Uint32 job_id = 0;
+	int job_iterations = 0;
+	int escape_interval = 4;
+	double escape_radius = 2.0;
+	int job_worker_limit = 0;
+	View job_view;
+	sf::Vector2i job_resolution;
+	int job_limbs = 0;
+	std::vector<tile> tiles;
+	int remaining = 0;
+	std::vector<uint16_t>* frame = nullptr;
+
+	double render_seconds = 0.0;
+	double compute_seconds = 0.0;
+	int workers_used = 0;
+	int retries = 0;
+	int steals = 0;
+	int backups = 0;
+	size_t raw_bytes = 0;
+	size_t wire_bytes = 0;
+
+#ifdef _WIN32
+	std::vector<HANDLE> children;
+#else
+	std::vector<pid_t> children;
+#endif
+
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Arbitrary precision signed fixed point number. One 32 bit limb holds the integer part
+// and `fraction_limbs` limbs hold the fraction, which is plenty for points on the complex
+// plane near the set. Only what the reference orbit and the view need is implemented.
+class FixedPoint {
+
+public:
+
+	static const int DEFAULT_FRACTION_LIMBS = 2;
+
+	FixedPoint();
+	explicit FixedPoint(double value, int fraction_limbs = DEFAULT_FRACTION_LIMBS);
+
+	// Parse a decimal ("-0.74364388703715870475219150", "1.5e-7") without going through a
+	// double. False if there's anything else in `value` or the integer part doesn't fit
+	static bool from_string(const std::string &value, int fraction_limbs, FixedPoint &result);
+
+	double to_double() const;
+	std::string to_string(int decimal_digits) const;
+
+	// Widening is exact, narrowing truncates
+	void set_precision(int fraction_limbs);
+	int get_precision() const { return fraction_limbs; };
+
+	// Enough fraction limbs to resolve `spacing`, plus guard bits
+	static int limbs_for_spacing(double spacing);
+
+	FixedPoint operator-() const;
+	FixedPoint operator+(const FixedPoint &rhs) const;
+	FixedPoint operator-(const FixedPoint &rhs) const;
+	FixedPoint operator*(const FixedPoint &rhs) const;
+
+	FixedPoint& operator+=(const FixedPoint &rhs);
+	FixedPoint& operator-=(const FixedPoint &rhs);
+
+	bool is_zero() const;
+
+private:
+
+	// Little endian, limbs[fraction_limbs] is the integer part
+	std::vector<uint32_t> limbs;
+	int fraction_limbs;
+	bool negative = false;
+
+	static int compare_magnitude(const FixedPoint &a, const FixedPoint &b);
+	static FixedPoint add_signed(const FixedPoint &a, const FixedPoint &b, bool negate_b);
+
+	void divide_magnitude(uint32_t divisor);
+
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Streams rendered frames to a file or stdout for an encoder to pick up, e.g.
+//
+//   Mandlebrot --animate 600 --target x y --zoom 1e6 | ffmpeg -i - zoom.mp4
+//
+// Y4M carries its own size and rate (4:4:4, BT.601 limited range), raw is bare RGB24.
+// Conversion and writing happen on a thread of their own so the next frame renders in the
+// meantime. At most MAX_IN_FLIGHT frames wait on it, past that write() blocks, so a slow
+// encoder holds the renderer back instead of frames piling up in memory
+class FrameWriter {
+
+public:
+
+	enum format { Y4M, RAW_RGB };
+
+	FrameWriter();
+	~FrameWriter();
+
+	// "-" writes to stdout
+	bool open(std::string path, format stream_format, sf::Vector2i resolution, int fps);
+
+	// Queue an RGBA8 frame at the resolution given to open. False once a write has failed
+	bool write(std::vector<sf::Uint8> &&pixels);
+
+	// Write out whatever is queued and close the file
+	bool close();
+
+	static const char* format_name(format stream_format);
+
+private:
+
+	static const size_t MAX_IN_FLIGHT = 2;
+
+	void writer_loop();
+
+	// Append the frame in the output format to `buffer`
+	void encode(const std::vector<sf::Uint8> &pixels, std::vector<unsigned char> &buffer) const;
+
+	FILE* file = nullptr;
+	bool owns_file = false;
+
+	format stream_format = Y4M;
+	sf::Vector2i resolution;
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable queued;
+	std::condition_variable written;
+
+	// The frame being written stays at the front until it's done
+	std::deque<std::vector<sf::Uint8>> frames;
+	bool closing = false;
+	bool failed = false;
+
+};
@@ -7,10 +7,15 @@
 #include "Vector4.hpp"
 #include <string.h>
 #include <memory>
+#include <deque>
+#include <map>
 
 #ifdef linux
 #include <CL/cl.h>
 #include <CL/opencl.h>
+
+// For the GL 3.2 sync objects the pipelined mode fences draws with
+#define GL_GLEXT_PROTOTYPES
 #include <GL/glx.h>
 
 #elif defined _WIN32
@@ -28,6 +33,13 @@
 
 #endif
 
+// Without sync objects (GL.h on windows stops at 1.1) begin_frame falls back on glFinish
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_FENCES
+#endif
+
+class Profiler;
+
 
 class OpenCL {
 	
@@ -46,9 +58,42 @@ public:
 	// kernels on one or more devices specified in the context.
 	// - Contexts cannot be created using more than one platform!
 
-	bool init();
+	// Headless skips the GL interop entirely. The context is a plain clCreateContext, images
+	// are ordinary clCreateImage objects, and the device is never prompted for.
+	// A device_index into the enumerated devices skips the saved config and the prompt
+	bool init(bool headless = false, int device_index = -1);
+
+	// Before init. The queue gets created with profiling on and every command enqueued
+	// hands its event to the profiler
+	void set_profiler(Profiler* profiler) { this->profiler = profiler; };
+
+	// Of the selected device, for reports that get compared across machines
+	std::string get_device_name();
+	std::string get_platform_name();
 
+	// Every device on every platform, in the order device_index counts them. The index of
+	// the one init picked is -1 before init
+	int get_device_count() const { return static_cast<int>(device_list.size()); };
+	int get_device_index() const;
+
+	// Kernels that depend on exact rounding (the double-single one) must not be built with the fast math flags
+	static const char* const FAST_MATH_OPTIONS;
+
+	// Built programs are kept in here between runs, see binary_cache_path
+	static const char* const BINARY_CACHE_DIRECTORY;
+
+	// Each source file is built once per set of options, every kernel in it comes out of
+	// that one program. Builds are loaded from the binary cache when nothing changed
 	bool compile_kernel(std::string kernel_path, std::string kernel_name);
+	bool compile_kernel(std::string kernel_path, std::string kernel_name, std::string build_options);
+
+	// Compile-time constants to specialize a kernel on, turned into -D name=value
+	typedef std::map<std::string, std::string> defines;
+
+	// Make the variant of a compiled kernel built with `values` on top of its options the
+	// one run_kernel launches. Every set of values is built once and kept, switching back
+	// and forth is a lookup. The arguments already set carry over to the variant
+	bool select_variant(std::string kernel_name, const defines &values);
 
 	// Create an image buffer from an SF texture. Access Type is the read/write specifier required by OpenCL
 	bool create_image_buffer_from_texture(std::string buffer_name, sf::Texture* texture, cl_int access_type);
@@ -56,16 +101,65 @@ public:
 	// Have CL create and manage the texture for the image buffer. Access Type is the read/write specifier required by OpenCL
 	bool create_image_buffer(std::string buffer_name, sf::Vector2i size, sf::Vector2f position, cl_int access_type);
 
+	// Blocking read of an image buffer back to the host as RGBA8
+	bool read_image(std::string buffer_name, sf::Vector2i size, std::vector<sf::Uint8> &pixels);
+
 	// Create a buffer with CL_MEM_READ_ONLY and CL_MEM_COPY_HOST_PTR
 	int create_buffer(std::string buffer_name, cl_uint size, void* data);
 
 	// Create a buffer with user defined data access flags
 	int create_buffer(std::string buffer_name, cl_uint size, void* data, cl_mem_flags flags);
 
+	// Blocking copies between host memory and a buffer created with create_buffer, `offset`
+	// is in bytes from the start of the buffer
+	bool write_buffer(std::string buffer_name, size_t size, const void* data, size_t offset = 0);
+	bool read_buffer(std::string buffer_name, size_t size, void* data, size_t offset = 0);
+
+	// Non-blocking read, `data` only gets filled in once the queue reaches it and has to stay valid until then
+	bool read_buffer_async(std::string buffer_name, size_t size, void* data);
+
 	int set_kernel_arg(std::string kernel_name, int index, std::string buffer_name);
+
+	// Whether the selected device lists the extension, e.g. "cl_khr_fp64"
+	bool has_extension(std::string extension);
 	
 	void run_kernel(std::string kernel_name, sf::Vector2i work_size);
 
+	// Launch over a sub-range only, get_global_id starts counting at work_offset
+	void run_kernel(std::string kernel_name, sf::Vector2i work_size, sf::Vector2i work_offset);
+
+	// Work-group size run_kernel launches `kernel_name` with, (0, 0) leaves it to the driver
+	void set_local_size(std::string kernel_name, sf::Vector2i local_size);
+	sf::Vector2i get_local_size(std::string kernel_name) const;
+
+	// Shapes worth timing for the active variant of a kernel, (0, 0) first. Built from
+	// CL_KERNEL_WORK_GROUP_SIZE, the preferred multiple and the device's item size limits
+	std::vector<sf::Vector2i> local_size_candidates(std::string kernel_name);
+
+	// Tuned local sizes live in device_config.bin after the saved device, one entry per
+	// device and kernel. Load picks up the entry for this device if there is one
+	bool load_local_size(std::string kernel_name);
+	void save_local_size(std::string kernel_name);
+
+	// Pipelined mode. run_kernel only enqueues, the GL image a frame writes is acquired once
+	// between begin_frame and end_frame, and nothing waits on the device unless something
+	// gets read back. draw() shows the newest frame that has completed
+	void set_pipelined(bool pipelined) { this->pipelined = pipelined; };
+	bool is_pipelined() const { return pipelined; };
+
+	// Acquire `image_name` for the frame about to be enqueued. If GL drew from it earlier this
+	// waits on the fence placed after that draw, which has long passed unless the ring is too short
+	bool begin_frame(std::string image_name);
+
+	// Release the image and flush without waiting, the frame is tracked by the release event
+	bool end_frame();
+
+	// Whether every frame submitted so far has completed, never blocks
+	bool frame_idle();
+
+	// Wait for everything enqueued to run
+	void finish();
+
 	void draw(sf::RenderWindow *window);
 
 	class device {
@@ -92,6 +186,7 @@ public:
 
 		cl_device_id getDeviceId() const { return device_id; };
 		cl_platform_id getPlatformId() const { return platform_id; };
+		const packed_data& getPackedData() const { return data; };
 
 	private:
 
@@ -110,17 +205,73 @@ private:
 
 	int error = 0;
 
+	// No GL context to share with, images are plain CL images
+	bool headless = false;
+
+	bool pipelined = false;
+
+	Profiler* profiler = nullptr;
+
+	// Where an enqueue should put its event, null when nobody is profiling
+	cl_event* profiling_event(cl_event* event) { return profiler ? event : NULL; };
+
+	// Hand an event from profiling_event to the profiler
+	void track(cl_event event, std::string name, const char* category);
+
+	// The tuned local size shrunk to fit `global_work_size` in `local_work_size`, or null for the driver's pick
+	const size_t* fit_local_size(std::string kernel_name, const size_t global_work_size[2], size_t local_work_size[2]) const;
+
+	std::unordered_map<std::string, sf::Vector2i> local_sizes;
+
+	#pragma pack(push, 1)
+	struct tuning_entry {
+		device::packed_data device_data;
+		char kernel_name[64];
+		cl_int local_x;
+		cl_int local_y;
+	};
+	#pragma pack(pop)
+
+	// What device_config.bin held, the prompted device stays saved when tuning writes it back
+	bool config_read = false;
+	device::packed_data saved_device;
+	std::vector<tuning_entry> tunings;
+
+	// Frames submitted but not yet seen completing, oldest first. The event is the release of the frame's image
+	std::deque<std::pair<std::string, cl_event>> frames;
+	std::string frame_image;
+
+	// Newest completed frame, what draw() shows
+	std::string shown_image;
+
+#ifdef GL_FENCES
+	// Placed after each draw of an image, CL can't write to it again before GL is done reading
+	std::unordered_map<std::string, GLsync> draw_fences;
+#endif
+
+	// Pop the frames that have completed off the front of the queue
+	void retire_frames();
 
 	// The device which we have selected according to certain criteria
-	cl_platform_id platform_id;
-	cl_device_id device_id;
+	cl_platform_id platform_id = nullptr;
+	cl_device_id device_id = nullptr;
 
 	// The GL shared context and its subsiquently generated command queue
 	cl_context context;
 	cl_command_queue command_queue;
 
 	// Maps which contain a mapping from "name" to the host side CL memory object
+	std::unordered_map<std::string, cl_program> program_map;
+
+	// The variant of each kernel run_kernel launches. variant_map owns every kernel built,
+	// keyed by name, path and options
 	std::unordered_map<std::string, cl_kernel> kernel_map;
+	std::unordered_map<std::string, cl_kernel> variant_map;
+
+	// What each kernel name was compiled from (path, options) and the buffers set as its
+	// arguments, so a variant can be built and set up the same way
+	std::unordered_map<std::string, std::pair<std::string, std::string>> kernel_sources;
+	std::unordered_map<std::string, std::map<int, std::string>> kernel_args;
 	std::unordered_map<std::string, cl_mem> buffer_map;
 	std::unordered_map<std::string, std::pair<sf::Sprite, std::unique_ptr<sf::Texture>>> image_map;
 	std::vector<device> device_list;
@@ -131,9 +282,33 @@ private:
 	// After aquiring hardware, create a shared context using platform specific CL commands
 	bool create_shared_context();
 
+	// Or a context without any GL properties for headless rendering
+	bool create_context();
+
 	// Command queues must be created with a valid context
 	bool create_command_queue();
 
+	// The program for `kernel_path` built with `build_options`, from program_map, the binary
+	// cache or the source in that order. Null if it doesn't build
+	cl_program get_program(std::string kernel_path, std::string build_options);
+
+	// The kernel out of that program, from variant_map if it was made before
+	cl_kernel get_kernel(std::string kernel_name, std::string kernel_path, std::string build_options);
+
+	// Make `kernel` the one launched for `kernel_name`, with the arguments set so far
+	bool activate_kernel(std::string kernel_name, cl_kernel kernel);
+
+	// The kernel's text with its quoted #includes pasted in from the same directory, so a
+	// change to a shared header misses the binary cache too. Empty if any file is missing
+	static std::string read_source(std::string kernel_path);
+
+	// Cache file for a build, named after a hash of the device's packed_data, the driver
+	// version, the build options and the source. A change to any of them misses
+	std::string binary_cache_path(const std::string &source, const std::string &build_options);
+
+	cl_program load_program_binary(std::string cache_path, std::string build_options);
+	void save_program_binary(cl_program program, std::string cache_path);
+
 
 	// Store a cl_mem object in the buffer map <string:name, cl_mem:buffer>
 	bool store_buffer(cl_mem buffer, std::string buffer_name);
@@ -141,8 +316,13 @@ private:
 	// Using CL release the memory object and remove the KVP associated with the buffer name
 	bool release_buffer(std::string buffer_name);
 
+	// Read the saved device and the tunings, whether or not the saved device gets used
+	bool read_config();
+
+	// Select the saved device if it's still around
 	bool load_config();
 	void save_config();
+	void write_config();
 
 	static bool vr_assert(int error_code, std::string function_name);
 	
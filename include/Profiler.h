@@ -0,0 +1,89 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "OpenCL.h"
+
+
+// Collects what the device and the host spend their time on. OpenCL hands over the events
+// of everything it enqueues once the queue has profiling on, host code adds spans for what
+// happens outside the queue (drawing, the whole render call). Keeps rolling averages for an
+// on screen overlay, and every record for a Chrome trace_event file (chrome://tracing, Perfetto)
+class Profiler {
+
+public:
+
+	typedef std::chrono::steady_clock clock;
+
+	Profiler();
+	~Profiler();
+
+	// Takes over the event, it's released once collect() has read its timestamps.
+	// Category is what kind of command it was, "kernel", "acquire", "read" and so on
+	void add_event(cl_event event, std::string name, std::string category);
+
+	void add_span(std::string name, clock::time_point start, clock::time_point end);
+
+	// Read the timestamps of every event that has completed, never blocks
+	void collect();
+
+	bool load_font(std::string path);
+
+	// Rolling averages per command, in the top left corner
+	void draw(sf::RenderWindow *window);
+
+	bool write_trace(std::string path);
+
+private:
+
+	// Samples the overlay averages over
+	static const size_t ROLLING_SAMPLES = 120;
+
+	// Records kept for the trace, the oldest are dropped past this
+	static const size_t MAX_RECORDS = 200000;
+
+	struct pending_event {
+		cl_event event;
+		std::string name;
+		std::string category;
+		long long host_enqueued;
+	};
+
+	// All in host nanoseconds since the profiler was made. Host spans only have start and end
+	struct record {
+		std::string name;
+		std::string category;
+		bool device;
+		long long queued;
+		long long submit;
+		long long start;
+		long long end;
+	};
+
+	struct rolling {
+		std::deque<double> busy_ms;
+		std::deque<double> wait_ms;
+	};
+
+	long long host_now() const;
+	void add_record(const record &r);
+
+	clock::time_point origin;
+
+	// Device timestamps are on their own clock, this lines the first one up with the host
+	// time it was enqueued at and everything after is shifted by the same amount
+	bool calibrated = false;
+	long long device_offset = 0;
+
+	std::vector<pending_event> pending;
+	std::deque<record> records;
+	std::map<std::string, rolling> averages;
+
+	sf::Font font;
+	bool font_loaded = false;
+
+};
@@ -0,0 +1,478 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Vector4.hpp"
+#include "OpenCL.h"
+#include "CPURenderer.h"
+#include "View.h"
+#include "TileCache.h"
+#include "TileStore.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+
+// Owns whichever backend is rendering (OpenCL or the native CPU fallback) and the
+// view. The view is kept at high precision on the host, each frame it is narrowed into
+// whatever representation the selected kernel needs
+class Renderer {
+
+public:
+
+	enum precision { SINGLE, DOUBLE_SINGLE, PERTURBATION };
+
+	// Counts are packed as 11.5 fixed point, matches pack_iterations in the kernels
+	static const int ITERATION_FRACTION_BITS = 5;
+	static const int MAX_ITERATIONS = 2047;
+
+	Renderer();
+	~Renderer();
+
+	// Headless renders never open a GL context. When OpenCL fails to come up, or
+	// use_cpu is set, the CPU renderer is used instead.
+	//
+	// Pipelined renders rotate between PIPELINE_IMAGES output images and never wait on the
+	// device. render() enqueues a frame and returns, draw() shows the newest one that has
+	// completed, and while a frame is still running render() does nothing at all
+	bool init(sf::Vector2i resolution, bool headless, bool use_cpu, bool pipelined = false);
+
+	// Both have to be set before init, the kernels get built around the iteration limit
+	void set_max_iterations(int iterations);
+	int get_max_iterations() const { return max_iterations; };
+
+	// What the single precision kernel gets specialized on besides the resolution. Escape
+	// checks every `interval` iterations (1 to 4) and a bailout `radius` (2 to 16), a larger
+	// one smooths the colouring. Every kernel that iterates and the native renderer get the
+	// radius so they all bail out the same way. Each setting gets its own build, cached after
+	// the first use
+	void set_escape(int interval, double radius);
+	double get_escape_radius() const { return escape_radius; };
+
+	// Also before init. Once a single precision view has converged, pixels whose neighbours
+	// are a band or more away get `samples` jittered subsamples (2 to 16) and are coloured
+	// with their average. 0 or 1 leaves it off
+	void set_supersampling(int samples);
+
+	// One of the devices OpenCL enumerates, instead of the saved or prompted one
+	void set_device(int index) { device_index = index; };
+
+	// Before init as well, profiles every command the OpenCL backend enqueues
+	void set_profiler(Profiler* profiler) { cl.set_profiler(profiler); };
+
+	// Before init. Every other OpenCL device gets a headless context of its own and the
+	// escape passes get split between them in horizontal bands, sized by how many pixels a
+	// second each device managed over the last frames. The bands are copied into the
+	// selected device's iteration buffer, which colours and shows the frame as usual.
+	// Pans, subdivision, tiles and perturbation stay on the selected device. Waiting on
+	// every device each pass means a split renderer is never pipelined
+	void set_split(bool enabled) { split = enabled; };
+
+	struct device_share {
+		std::string name;
+		int rows;
+		double mpix_per_second;
+	};
+
+	// One entry per device the frame is split over, the selected one first. Empty unless split
+	std::vector<device_share> get_device_shares() const;
+
+	// Full resolution throughput of the last split pass over that of the fastest device on its own
+	double get_split_scaling() const { return split_scaling; };
+
+	// Time the work-group shapes the device suggests for the escape kernels over a few
+	// representative views, and keep the fastest. The winners are saved with the device in
+	// device_config.bin and picked up by init on later runs. After init, OpenCL only
+	bool tune_local_sizes();
+
+	// Name of the OpenCL device and platform, or of the native renderer's instruction set
+	std::string get_device_name();
+
+	void set_view(const View &view);
+	const View& get_view() const { return view; };
+
+	// x_min, x_max, y_min, y_max on the complex plane
+	void set_range(sf::Vector4d range);
+	sf::Vector4d get_range() const { return view.to_range(); };
+
+	// With progressive rendering on, a new view starts at 1/8 resolution and each call
+	// refines it further (1/4, 1/2, full) for as long as it fits in the frame budget.
+	// Calling render() again on an unchanged view picks up where the last call stopped
+	void render();
+
+	void set_progressive(bool enabled, double frame_budget_seconds);
+
+	// Render new single precision views with Mariani-Silver subdivision instead of a pass
+	// over every pixel. Only tile borders get computed, uniform tiles are filled in
+	void set_subdivision(bool enabled) { subdivision = enabled; };
+
+	// Build single precision frames out of cached tiles, only the missing ones get rendered
+	void set_tile_cache(bool enabled, size_t budget_bytes);
+	const TileCache& get_tile_cache() const { return tile_cache; };
+
+	// Counts of the cache tiles `keys`, whatever the view. Cached and stored ones are looked
+	// up, the rest get rendered MAX_TILE_BATCH to a launch and cached. Tiles at any level can
+	// share a launch, but they are single precision and OpenCL only, and the keys have to be
+	// for this renderer's iteration limit
+	bool render_tiles(const std::vector<TileKey> &keys, std::vector<std::shared_ptr<const TileCache::Tile>> &tiles);
+
+	// Back the tile cache with a store on disk that outlives the session, tiles missing
+	// from memory are looked up there before anything gets rendered
+	bool open_tile_store(std::string path);
+	const TileStore& get_tile_store() const { return tile_store; };
+
+	// The escape kernels only store smooth iteration counts, a separate pass colours them.
+	// Changing the palette or colouring just reruns that pass on the next render()
+	void set_palette(const std::vector<sf::Color> &palette);
+
+	// A count of n lands on palette entry n * density + offset. Smooth blends between
+	// neighbouring entries using the fractional part of the count
+	void set_colouring(float offset, float density, bool smooth);
+
+	// What the escape kernels always drew, and a cosine gradient that suits smoothing
+	static std::vector<sf::Color> classic_palette();
+	static std::vector<sf::Color> gradient_palette();
+
+	// Forget the last frame, the next render() starts over even if the view didn't change
+	void invalidate() { previous_frame_valid = false; };
+
+	// Whether the image holds the current view at full resolution
+	bool is_converged() const { return refinement_level >= REFINEMENT_LEVELS; };
+
+	// Whether calling render() again would still change the image without the view or the
+	// colouring changing, because it's still refining or a pipelined frame hasn't completed
+	bool is_busy();
+
+	// Exponential map zooms into (x, y), OpenCL only. Rather than rendering every frame of
+	// the zoom, it gets rendered once as a log-polar strip, columns going around the target
+	// and rows going in from `outer_radius` to `inner_radius` evenly in log-radius. Frames
+	// centred on the target are resampled out of the strip. Rows are only rendered once a
+	// frame reaches them, into a ring that holds what one frame spans, so zooming in renders
+	// each row exactly once
+	bool begin_exponential_map(const FixedPoint &x, const FixedPoint &y, double outer_radius, double inner_radius);
+
+	// Resample and colour the frame `width` by `height` across the plane, read_pixels gets
+	// it as usual. get_computed_pixels counts the strip pixels it had to render
+	bool render_exponential_map(double width, double height);
+
+	// Strip pixels rendered since begin_exponential_map, and the strip's dimensions
+	long long get_strip_pixels() const { return strip_pixels; };
+	sf::Vector2i get_strip_size() const { return sf::Vector2i(strip_columns, strip_rows); };
+
+	void draw(sf::RenderWindow *window);
+
+	// Wait for every frame still running on the device
+	void finish();
+
+	// RGBA8 copy of the last rendered frame
+	bool read_pixels(std::vector<sf::Uint8> &pixels);
+
+	// Packed counts of the last frame
+	bool read_iterations(std::vector<cl_ushort> &iterations);
+
+	// The colour pass on the host, for counts that were never on this renderer's device
+	// (e.g. assembled from tiles other processes rendered). Writes RGBA8
+	static void colour_on_host(const std::vector<cl_ushort> &iterations, const std::vector<sf::Color> &palette,
+		float offset, float density, bool smooth, std::vector<sf::Uint8> &pixels);
+
+	bool is_cpu() const { return use_cpu; };
+	bool is_pipelined() const { return pipelined; };
+	sf::Vector2i get_resolution() const { return resolution; };
+
+	// Picked automatically from the pixel spacing each frame
+	precision get_precision() const { return active_precision; };
+
+	// What render() would pick for `view` at `resolution`
+	static precision precision_for(const View &view, sf::Vector2i resolution);
+
+	static const char* precision_name(precision p);
+
+	// How many reference orbits the last perturbation frame needed, and how many pixels
+	// were still glitched after the last one
+	int get_reference_count() const { return reference_count; };
+	int get_unresolved_glitches() const { return unresolved_glitches; };
+
+	// Iterations the series approximation saved over every pixel of the last frame
+	long long get_skipped_iterations() const { return skipped_iterations; };
+
+	// Pixels the escape kernel actually ran on last frame, a pan only pays for the strip
+	long long get_computed_pixels() const { return computed_pixels; };
+
+	// Pixels the last supersampling pass refined, and the ones it marked but had no room for
+	int get_supersampled_pixels() const;
+	int get_supersample_overflow() const;
+	int get_supersampling() const { return supersample_samples; };
+
+	// Pixels the escape kernels short-circuited last frame as inside the set, by the
+	// main cardioid test, the period-2 bulb test and orbit periodicity checking
+	int get_cardioid_pixels() const { return interior_stats[0]; };
+	int get_bulb_pixels() const { return interior_stats[1]; };
+	int get_periodic_pixels() const { return interior_stats[2]; };
+
+private:
+
+	static const std::string KERNEL_DIRECTORY;
+
+	static const int ITERATION_THRESHOLD = 2000;
+
+	// Glitched pixels get re-rendered against a new reference picked from among them,
+	// up to this many references per frame
+	static const int MAX_REFERENCES = 8;
+
+	// Strides of 8, 4, 2 and 1
+	static const int REFINEMENT_LEVELS = 4;
+
+	// How far a device's throughput moves toward each new full resolution measurement
+	static const double SPLIT_SMOOTHING;
+
+	// Timed launches per view and shape while tuning, the fastest one counts
+	static const int TUNING_REPEATS = 3;
+
+	// Size of the tiles subdivision starts from
+	static const int SUBDIVISION_TILE = 64;
+
+	// Decisions subdivision_decide makes besides a fill value, match mariani_silver.cl
+	static const int SUBDIVISION_COMPUTE = -1;
+	static const int SUBDIVISION_SPLIT = -2;
+
+	// Most missing tiles rendered per launch
+	static const int MAX_TILE_BATCH = 128;
+
+	// Most subsamples per pixel, and one pixel in this many can be marked for them
+	static const int MAX_SUBSAMPLES = 16;
+	static const int SUPERSAMPLE_FRACTION = 4;
+
+	// Neighbours a whole iteration apart make a pixel an edge
+	static const int SUPERSAMPLE_EDGE = 1 << ITERATION_FRACTION_BITS;
+
+	// Strip rows rendered per launch, glitches are read back and resolved a band at a time
+	static const int STRIP_BAND = 64;
+
+	// Entries the palette buffer holds, 16KB of constant memory
+	static const int MAX_PALETTE = 4096;
+
+	// One being written, one on screen and one GL may still be drawing from
+	static const int PIPELINE_IMAGES = 3;
+	static const char* const VIEWPORT_IMAGES[PIPELINE_IMAGES];
+
+	bool setup_opencl();
+
+	// Build the supersampling kernels and the buffers they share
+	bool setup_supersampling();
+
+	// -D ITERATION_THRESHOLD for the limit, every kernel that iterates is built with it
+	std::string threshold_option() const;
+
+	// Bring up a headless context on every device besides the selected one, the ones that
+	// fail to come up are left out
+	void setup_split();
+
+	// Compile the escape kernels on a split device and give it buffers of its own
+	bool setup_split_device(OpenCL &device);
+
+	// Divide the rows between the devices by their throughput so far
+	void balance_split();
+
+	// Run a pass of `kernel_name` at `step` with every device doing its band at once, then
+	// copy the bands into the current iteration buffer
+	void render_split(std::string kernel_name, int step);
+
+	// Single precision blocks up once a pixel is within a few ulps of its coordinate
+	precision select_precision() const;
+
+	// Split the double view into the hi/lo float pairs the double-single kernel reads
+	void upload_range();
+
+	// The kernels whose local size gets tuned
+	static const char* const TUNED_KERNELS[2];
+
+	// Switch "mandlebrot" over to the variant for the current escape settings, and every
+	// other kernel that iterates to the one for the current radius
+	void specialize();
+
+	void render_perturbation();
+
+	// Iterate strip rows [first, end) into their slots in the ring
+	void render_strip(int first, int end);
+
+	// Whether `view` is the previous frame moved by a whole number of pixels, and by how many
+	bool pixel_shift(sf::Vector2i &shift) const;
+
+	// Shift the previous iteration field and only run `kernel_name` over the exposed strips
+	void render_shifted(std::string kernel_name, sf::Vector2i shift);
+
+	// Run refinement passes of `kernel_name` until the image converges or the next pass
+	// would likely blow the frame budget. Always runs at least one
+	void refine(std::string kernel_name);
+
+	// Border, decide and fill a level of tiles at a time until none are left to split
+	void render_subdivided();
+
+	// Look up every tile the view overlaps at the level matching its pixel spacing, render
+	// the misses, then sample the tiles into the iteration buffer and colour it
+	void render_tiled();
+
+	// Mark the edges in the current iteration buffer and iterate their subsamples
+	void supersample();
+
+	// Run the colour pass over the current iteration buffer, uploading the palette first
+	// if it changed. Supersampled pixels get their average colour on top
+	void colour();
+
+	// Iterate the reference point at full precision. Returns the number of orbit
+	// entries written, which is short of max_iterations + 1 if it escaped
+	int compute_reference_orbit(const FixedPoint &x, const FixedPoint &y);
+
+	// Fit the cubic series for dz around the current reference and find how far it
+	// stays accurate for the whole frame, judged by probing the frame edges. Fills
+	// `series` with the scaled A, B, C at that iteration and returns it
+	int compute_series(int orbit_length, double x_step, double y_step, double reference_x, double reference_y);
+
+	OpenCL cl;
+	CPURenderer cpu;
+
+	struct split_device {
+
+		// Null for the selected device, which renders through `cl`
+		std::unique_ptr<OpenCL> cl;
+		std::string name;
+
+		int row_start = 0;
+		int rows = 0;
+
+		// Pixels a second, devices start out even until they get measured
+		double throughput = 1.0;
+		bool measured = false;
+
+		// Wall time of the last pass, reading the band back included
+		double seconds = 0.0;
+
+		std::vector<cl_ushort> band;
+		cl_int interior_stats[3] = { 0, 0, 0 };
+	};
+
+	bool split = false;
+	std::vector<split_device> split_devices;
+
+	// One thread per device, each blocks on its own queue
+	std::unique_ptr<ThreadPool> split_pool;
+
+	double split_scaling = 0.0;
+
+	bool headless = false;
+	bool use_cpu = false;
+	bool pipelined = false;
+
+	int max_iterations = ITERATION_THRESHOLD;
+	int device_index = -1;
+
+	int escape_check_interval = 4;
+	double escape_radius = 2.0;
+	bool escape_dirty = true;
+
+	// The image the last colour pass wrote to, always 0 unless pipelined
+	int image_slot = 0;
+
+	sf::Vector2i resolution;
+	View view;
+
+	precision active_precision = SINGLE;
+
+	// Host side storage the "range" and "range_ds" buffers are created on
+	sf::Vector4f range_f;
+	sf::Vector4f range_ds[2];
+
+	// The perturbation deltas are doubles when the device has cl_khr_fp64
+	bool perturbation_fp64 = false;
+	std::vector<double> orbit;
+	std::vector<sf::Uint8> glitches;
+	double series[6];
+
+	int reference_count = 0;
+	int unresolved_glitches = 0;
+	long long skipped_iterations = 0;
+
+	// The escape kernels write packed smooth counts into one of two buffers, the shift kernel
+	// copies from the current one into the other and they swap
+	static const char* const ITERATION_BUFFERS[2];
+	int current_iterations = 0;
+
+	bool previous_frame_valid = false;
+	View previous_view;
+	precision previous_precision = SINGLE;
+	sf::Vector2i pan_offset;
+
+	bool progressive = false;
+	double frame_budget = 0.012;
+
+	// The next pass to run and the one the current view started at, a non progressive
+	// render goes straight to the last one
+	int refinement_level = REFINEMENT_LEVELS;
+	int first_level = REFINEMENT_LEVELS - 1;
+
+	// Host side storage for the "progressive_pass" buffer, (step, skip_coarse)
+	sf::Vector2i progressive_pass = sf::Vector2i(1, 0);
+
+	bool subdivision = false;
+
+	// Most tiles a subdivision level can hold, they never split below MIN_SPLIT / 2
+	size_t subdivision_capacity = 0;
+
+	bool use_tile_cache = false;
+	TileCache tile_cache;
+	TileStore tile_store;
+	std::vector<cl_ushort> tile_frame;
+
+	std::vector<sf::Color> palette = classic_palette();
+	bool palette_dirty = true;
+
+	// What set_colouring asked for, copied into the "colouring" buffer's host storage when
+	// the colour pass runs. A pipelined frame may still be reading the buffer in between
+	sf::Vector4f colouring_settings = sf::Vector4f(0.0f, 1.0f, 0.0f, 0.0f);
+	sf::Vector4f colouring = sf::Vector4f(0.0f, 1.0f, 0.0f, 0.0f);
+	bool colouring_dirty = true;
+
+	long long computed_pixels = 0;
+
+	int supersample_samples = 0;
+
+	// Whether the marks and subsamples on the device belong to the current iteration buffer
+	bool supersampled = false;
+
+	// Host side storage for "supersample_settings", (samples, capacity, edge threshold, 0)
+	sf::Vector4i supersample_settings;
+
+	// Read back after marking, asynchronously when pipelined. Launches cover the whole
+	// capacity then, since the count isn't known when they get enqueued
+	cl_uint supersample_marked = 0;
+	int supersample_launch = 0;
+
+	// Exponential map target and layout, row n of the strip sits at log radius
+	// strip_log_outer - (n + 0.5) * strip_log_step
+	FixedPoint strip_x;
+	FixedPoint strip_y;
+	int strip_limbs = FixedPoint::DEFAULT_FRACTION_LIMBS;
+	double strip_log_outer = 0.0;
+	double strip_log_step = 0.0;
+	int strip_columns = 0;
+	int strip_rows = 0;
+
+	// Rows the ring has slots for, and the ones [strip_first, strip_end) it holds
+	int strip_capacity = 0;
+	int strip_first = 0;
+	int strip_end = 0;
+
+	// The target's orbit, what every band starts out perturbing against
+	std::vector<double> strip_orbit;
+	int strip_orbit_length = 0;
+
+	std::vector<sf::Uint8> strip_glitches;
+	long long strip_pixels = 0;
+
+	cl_int interior_stats[3] = { 0, 0, 0 };
+
+	// What the split devices counted this frame, added on after the selected one's are read back
+	cl_int split_interior_stats[3] = { 0, 0, 0 };
+
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class ThreadPool {
+
+public:
+
+	// A thread count of 0 uses one worker per hardware thread
+	explicit ThreadPool(unsigned int thread_count = 0);
+	~ThreadPool();
+
+	// Run job(i) for every i in [0, job_count) and block until all of them have finished.
+	// Each worker starts on a contiguous run of the indices, and once its own run is
+	// exhausted it steals from the back of the other workers queues
+	void parallel_for(int job_count, const std::function<void(int)>& job);
+
+	unsigned int size() const { return static_cast<unsigned int>(threads.size()); };
+
+private:
+
+	struct job_queue {
+		std::mutex mutex;
+		std::deque<int> jobs;
+	};
+
+	void worker_loop(unsigned int index);
+
+	// Pop from the front of our own queue, or steal from the back of someone elses
+	bool pop_job(unsigned int index, int &job);
+
+	std::vector<std::thread> threads;
+	std::vector<std::unique_ptr<job_queue>> queues;
+
+	// Only one parallel_for may be in flight at once
+	std::mutex dispatch_mutex;
+
+	std::mutex batch_mutex;
+	std::condition_variable batch_start;
+	std::condition_variable batch_done;
+
+	const std::function<void(int)> *current_job = nullptr;
+	std::atomic<int> remaining_jobs;
+	unsigned int generation = 0;
+	bool stopping = false;
+
+};
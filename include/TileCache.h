@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+
+// The plane is cut into TILE_SIZE x TILE_SIZE pixel tiles at every zoom level, level n
+// has a pixel spacing of BASE_SPACING / 2^n. Tile (x, y) covers the pixels starting at
+// (x * TILE_SIZE, y * TILE_SIZE) * spacing. The formula, iteration limit and bailout are
+// part of the key too, the same tile under a different limit or radius holds different counts
+struct TileKey {
+
+	// Only z^2 + c so far
+	enum { MANDELBROT = 0 };
+
+	int32_t formula;
+	int32_t max_iterations;
+
+	// Bailout radius in thousandths, see escape_key
+	int32_t escape_radius;
+
+	int32_t level;
+	int32_t x;
+	int32_t y;
+
+	bool operator==(const TileKey &other) const {
+		return formula == other.formula && max_iterations == other.max_iterations &&
+			escape_radius == other.escape_radius && level == other.level && x == other.x && y == other.y;
+	}
+
+	static int32_t escape_key(double radius) {
+		return static_cast<int32_t>(radius * 1000.0 + 0.5);
+	}
+};
+
+struct TileKeyHash {
+	size_t operator()(const TileKey &key) const {
+		uint64_t hash = static_cast<uint32_t>(key.formula);
+		hash = hash * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(key.max_iterations);
+		hash = hash * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(key.escape_radius);
+		hash = hash * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(key.level);
+		hash = hash * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(key.x);
+		hash = hash * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(key.y);
+		return static_cast<size_t>(hash ^ (hash >> 32));
+	}
+};
+
+// Raw iteration counts of computed tiles, least recently used goes first once the memory
+// budget is exceeded. Tiles are handed out as shared pointers so a frame can keep using
+// the ones it looked up even if filling in its misses evicts them
+class TileCache {
+
+public:
+
+	static const int TILE_SIZE = 64;
+	static const double BASE_SPACING;
+
+	// Packed smooth counts, the same 16 bit format as the iteration buffers
+	typedef std::vector<uint16_t> Tile;
+
+	explicit TileCache(size_t budget_bytes = 256 * 1024 * 1024);
+
+	// The tile, or null on a miss. A hit makes it the most recently used
+	std::shared_ptr<const Tile> find(const TileKey &key);
+
+	void insert(const TileKey &key, std::shared_ptr<const Tile> tile);
+
+	void set_budget(size_t budget_bytes);
+	void clear();
+
+	size_t get_budget() const { return budget; };
+	size_t get_bytes() const { return bytes; };
+	size_t get_tile_count() const { return entries.size(); };
+	long long get_hits() const { return hits; };
+	long long get_misses() const { return misses; };
+	long long get_evictions() const { return evictions; };
+
+	// Finest level whose spacing is no coarser than `spacing`
+	static int level_for_spacing(double spacing);
+	static double level_spacing(int level);
+
+private:
+
+	typedef std::list<std::pair<TileKey, std::shared_ptr<const Tile>>> lru_list;
+
+	void evict();
+
+	// Most recently used at the front
+	lru_list lru;
+	std::unordered_map<TileKey, lru_list::iterator, TileKeyHash> entries;
+
+	size_t budget;
+	size_t bytes = 0;
+
+	long long hits = 0;
+	long long misses = 0;
+	long long evictions = 0;
+
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <SFML/Network.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// What the coordinator and its workers say to each other over TCP. Every message is one
+// sf::Packet that starts with its type as a Uint8:
+//
+//   HELLO   worker -> coordinator : backend asked for on the command line
+//   CONFIG  coordinator -> worker : tile size, iteration limit, escape check interval, escape radius
+//   READY   worker -> coordinator : the renderer is up for that config, device name
+//   TILE    coordinator -> worker : job, tile, center x, center y (decimal strings), width, height
+//   RESULT  worker -> coordinator : job, tile, ok, seconds spent rendering, compressed counts
+//   DONE    coordinator -> worker : nothing left, disconnect
+class TileProtocol {
+
+public:
+
+	enum message { HELLO, CONFIG, READY, TILE, RESULT, DONE };
+
+	// Workers connect here unless told otherwise
+	static const unsigned short DEFAULT_PORT = 47800;
+
+	// Packed counts as zigzag varint deltas from the previous pixel, a zero delta is followed
+	// by how many more pixels repeat it. Neighbouring counts are close and the interior is
+	// one long run, so tiles shrink to a fraction of their 2 bytes a pixel. The first byte
+	// says which encoding follows, tiles too noisy to shrink go as they are
+	static std::string compress(const std::vector<uint16_t> &counts);
+
+	// False if the data is corrupt or doesn't hold exactly `count` pixels
+	static bool decompress(const std::string &data, size_t count, std::vector<uint16_t> &counts);
+
+	// The type of a received packet, false if it's empty or unknown
+	static bool read_type(sf::Packet &packet, message &type);
+
+private:
+
+	enum encoding { RAW, DELTA_RUNS };
+
+};
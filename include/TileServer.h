@@ -0,0 +1,187 @@
+#pragma once
+
+#include <SFML/Network.hpp>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Renderer.h"
+
+
+// Serves the set as z/x/y PNG tiles over HTTP, for web map viewers (Leaflet, OpenLayers..)
+// pointed at http://host:port/{z}/{x}/{y}.png. "/" is a page with such a viewer on it and
+// "/stats" has the counters as JSON.
+//
+// Zoom 0 is a single tile over [-3, 1] x [-2, 2], every zoom level halves the tiles, and
+// y grows downward like the rows of a frame. That lines the tiles up with the tile cache's
+// grid, a tile at zoom z is 4x4 cache tiles at level z + 2. So shallow tiles are rendered
+// by the tile cache kernel, every tile missing after a round of requests in the same
+// launches, while deeper ones get a frame of their own from the renderer at whatever
+// precision they need.
+//
+// Encoded tiles are kept in memory until they fall out of a least recently used budget,
+// the renderer's tile cache (and store, if open) keeps the counts behind them
+class TileServer {
+
+public:
+
+	static const int TILE_SIZE = 256;
+
+	// Past this the tile coordinates stop fitting in an int
+	static const int MAX_ZOOM = 30;
+
+	// `renderer` has to be initialized at TILE_SIZE x TILE_SIZE, headless, and is only ever
+	// touched from run()
+	TileServer(Renderer &renderer);
+
+	// Port 0 picks any free one
+	bool listen(unsigned short port);
+	unsigned short get_port() const { return listener.getLocalPort(); };
+
+	void set_colouring(const std::vector<sf::Color> &palette, float density, bool smooth);
+
+	// Encoded tiles kept in memory
+	void set_budget(size_t budget_bytes);
+
+	// Serve until stop(), or for `seconds` if that's positive
+	void run(double seconds = 0.0);
+
+	// Safe from any thread, run() returns within POLL_SECONDS
+	void stop() { stopping = true; };
+
+	struct statistics {
+		long long requests = 0;
+
+		// Tile requests answered from memory, and the ones that had to wait on a render
+		long long hits = 0;
+		long long misses = 0;
+		long long errors = 0;
+
+		// Rounds of misses rendered together, the tiles they rendered and how many of those
+		// went through the batched kernel
+		long long batches = 0;
+		long long rendered = 0;
+		long long batched = 0;
+
+		size_t tiles = 0;
+		size_t bytes = 0;
+
+		// Milliseconds from a request being read to its response going out, over the last
+		// LATENCY_WINDOW tile requests
+		double latency_mean = 0.0;
+		double latency_p50 = 0.0;
+		double latency_p95 = 0.0;
+		double latency_p99 = 0.0;
+
+		double hit_rate() const { return hits + misses > 0 ? static_cast<double>(hits) / (hits + misses) : 0.0; };
+	};
+
+	// Only consistent while run() isn't running
+	statistics get_statistics() const;
+
+	// Where the tile sits on the plane, x_min, x_max, y_min, y_max
+	static sf::Vector4d tile_range(int z, int x, int y);
+
+private:
+
+	static const double POLL_SECONDS;
+
+	// Once a request comes in, more are gathered for this long before anything renders, so
+	// a viewer asking for a whole screen of tiles gets them in one batch
+	static const double GATHER_SECONDS;
+
+	// Requests bigger than this are refused
+	static const size_t MAX_REQUEST_BYTES = 8192;
+
+	static const int LATENCY_WINDOW = 4096;
+
+	typedef std::chrono::steady_clock clock;
+
+	struct tile_id {
+		int z, x, y;
+
+		bool operator==(const tile_id &other) const {
+			return z == other.z && x == other.x && y == other.y;
+		}
+	};
+
+	struct tile_id_hash {
+		size_t operator()(const tile_id &id) const {
+			uint64_t hash = static_cast<uint32_t>(id.z);
+			hash = hash * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(id.x);
+			hash = hash * 0x9E3779B97F4A7C15ull ^ static_cast<uint32_t>(id.y);
+			return static_cast<size_t>(hash ^ (hash >> 32));
+		}
+	};
+
+	typedef std::shared_ptr<const std::vector<sf::Uint8>> png;
+
+	struct connection {
+		std::unique_ptr<sf::TcpSocket> socket;
+		bool open = true;
+
+		// Whatever has been read and not handled yet
+		std::string buffer;
+
+		// Responses go out in the order the requests came in, so nothing further is read off
+		// the buffer while a tile is being waited on
+		bool waiting = false;
+		bool close_after = false;
+		tile_id tile;
+		clock::time_point received;
+	};
+
+	void accept();
+	void receive(connection &c);
+
+	// Handle complete requests off the front of the buffer until one has to wait on a render
+	void handle_requests(connection &c);
+
+	// Render every tile a connection is waiting on and answer them
+	void render_waiting();
+
+	// Counts of every tile in `missing`, the ones the batched kernel can do first and the rest
+	// one frame at a time. Left empty for tiles that failed
+	void render_tiles(const std::vector<tile_id> &missing, std::vector<std::vector<cl_ushort>> &counts);
+
+	// The tile as a frame of its own, for the ones the batched kernel can't do
+	static View tile_view(const tile_id &id);
+
+	png encode(const std::vector<cl_ushort> &counts);
+
+	png find(const tile_id &id);
+	void insert(const tile_id &id, png tile);
+
+	void respond(connection &c, const std::string &status, const std::string &type, const sf::Uint8 *body, size_t size);
+	void respond_tile(connection &c, const png &tile);
+	void record_latency(const connection &c);
+
+	std::string statistics_json() const;
+
+	Renderer &renderer;
+
+	sf::TcpListener listener;
+	sf::SocketSelector selector;
+	std::vector<std::unique_ptr<connection>> connections;
+
+	std::atomic<bool> stopping;
+
+	std::vector<sf::Color> palette = Renderer::classic_palette();
+	float density = 1.0f;
+	bool smooth = false;
+
+	// Encoded tiles, most recently used at the front
+	typedef std::list<std::pair<tile_id, png>> lru_list;
+	lru_list lru;
+	std::unordered_map<tile_id, lru_list::iterator, tile_id_hash> entries;
+	size_t budget = 64 * 1024 * 1024;
+	size_t bytes = 0;
+
+	statistics stats;
+	std::vector<double> latencies;
+	size_t next_latency = 0;
+
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "TileCache.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+
+// Tiles kept on disk between sessions, sitting behind the in memory TileCache. Two files:
+//
+//   <path>.tiles : a small header then one TILE_SIZE^2 slot of packed uint16 counts per tile,
+//                  memory mapped so reading a tile back is just page faults
+//   <path>.index : append only (key, slot) records, read into a hash map on open
+//
+// Index records only go out on flush(), once the slots they point at are synced to disk
+// and counted in the header, so a crash at worst loses the tiles since the last flush.
+// Nothing is ever evicted, writes stop once max_bytes is reached
+class TileStore {
+
+public:
+
+	TileStore();
+	~TileStore();
+
+	bool open(std::string path, size_t max_bytes = static_cast<size_t>(4) * 1024 * 1024 * 1024);
+	void close();
+
+	bool is_open() const { return data != nullptr; };
+
+	// Copy of the tile, or null when it isn't stored
+	std::shared_ptr<const TileCache::Tile> find(const TileKey &key);
+
+	void insert(const TileKey &key, const TileCache::Tile &tile);
+
+	// Sync the tiles inserted since the last flush to disk and index them
+	void flush();
+
+	long long get_hits() const { return hits; };
+	long long get_misses() const { return misses; };
+	size_t get_tile_count() const { return index.size(); };
+	size_t get_bytes() const { return index.size() * TILE_BYTES; };
+
+private:
+
+	static const size_t TILE_BYTES = TileCache::TILE_SIZE * TileCache::TILE_SIZE * sizeof(uint16_t);
+
+	// Bumped whenever the file formats change, 2 is when counts went to packed 16 bit, 3 when
+	// the bailout radius joined the key and 4 when the header started counting written slots
+	static const uint32_t STORE_VERSION = 4;
+
+	// Slots are added this many at a time, each growth remaps the file
+	static const size_t GROWTH_SLOTS = 256;
+
+	#pragma pack(push, 1)
+	struct header {
+		char magic[4];
+		uint32_t version;
+		uint32_t tile_size;
+
+		// Slots known to be on disk. The file is grown ahead of the writes, so its size
+		// says nothing about which slots hold a tile
+		uint32_t written_slots;
+	};
+
+	struct index_record {
+		TileKey key;
+		uint32_t slot;
+	};
+	#pragma pack(pop)
+
+	// (Re)map the data file at `slots` slots, growing it on disk if needed
+	bool map(size_t slots);
+	void unmap();
+
+	// Block until the first `bytes` of the mapping are on disk
+	bool sync(size_t bytes);
+
+	std::unordered_map<TileKey, uint32_t, TileKeyHash> index;
+
+	std::string data_path;
+	size_t max_bytes = 0;
+
+	char* data = nullptr;
+	size_t slot_capacity = 0;
+	uint32_t next_slot = 0;
+
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int file = -1;
+#endif
+
+	FILE* index_file = nullptr;
+
+	// Records of the tiles inserted since the last flush
+	std::vector<index_record> pending;
+
+	long long hits = 0;
+	long long misses = 0;
+
+};
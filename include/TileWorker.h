@@ -0,0 +1,48 @@
+#pragma once
+
+#include <SFML/Network.hpp>
+#include <memory>
+#include <string>
+#include "Renderer.h"
+#include "TileProtocol.h"
+
+
+// One process rendering tiles for a Coordinator. It connects, says which device it has,
+// then renders whatever tiles it gets sent with a headless Renderer, OpenCL or the native
+// fallback, and sends back their compressed counts. A tile that fails to render, or is too
+// deep for the native renderer's single precision, is reported as failed rather than
+// dropped, so the coordinator can hand it to someone else
+class TileWorker {
+
+public:
+
+	TileWorker(bool use_cpu, int device_index);
+	~TileWorker();
+
+	// Render until the coordinator says it's done. The coordinator may still be coming up,
+	// so connecting is retried for CONNECT_SECONDS. False if it never answered or the
+	// connection dropped
+	bool run(const std::string &host, unsigned short port);
+
+private:
+
+	static const int CONNECT_SECONDS = 10;
+
+	// (Re)build the renderer for square tiles of `tile_size` at the iteration limit, and
+	// hand it the escape settings
+	bool configure(int tile_size, int max_iterations, int escape_interval, double escape_radius);
+
+	bool render_tile(sf::Packet &request, sf::Packet &reply);
+
+	bool use_cpu;
+	int device_index;
+
+	// Rebuilt whenever the tile size or limit changes, the kernels are built around both. The
+	// escape settings only respecialize it
+	std::unique_ptr<Renderer> renderer;
+	int tile_size = 0;
+	int max_iterations = 0;
+
+	sf::TcpSocket socket;
+
+};
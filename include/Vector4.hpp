@@ -431,6 +431,7 @@ namespace sf {
 	typedef Vector4<int>          Vector4i;
 	typedef Vector4<unsigned int> Vector4u;
 	typedef Vector4<float>        Vector4f;
+	typedef Vector4<double>       Vector4d;
 
 } // namespace sf
 
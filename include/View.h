@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include "FixedPoint.h"
+#include "Vector4.hpp"
+#include <SFML/System.hpp>
+
+
+// Where on the complex plane we are looking. The center is kept at arbitrary precision
+// so it can go deeper than a double can address, while the extent only ever needs a
+// double's exponent range
+struct View {
+
+	FixedPoint center_x;
+	FixedPoint center_y;
+
+	// Full width and height of the view on the complex plane
+	double width = 2.0;
+	double height = 2.0;
+
+	// x_min, x_max, y_min, y_max, the old float4 range layout
+	static View from_range(sf::Vector4d range) {
+
+		View view;
+		view.width = range.y - range.x;
+		view.height = range.w - range.z;
+		view.center_x = FixedPoint((range.x + range.y) / 2.0);
+		view.center_y = FixedPoint((range.z + range.w) / 2.0);
+		view.fit_precision();
+		return view;
+	}
+
+	sf::Vector4d to_range() const {
+
+		double x = center_x.to_double();
+		double y = center_y.to_double();
+
+		return sf::Vector4d(x - width / 2.0, x + width / 2.0, y - height / 2.0, y + height / 2.0);
+	}
+
+	double pixel_spacing(sf::Vector2i resolution) const {
+		return std::min(std::abs(width) / resolution.x, std::abs(height) / resolution.y);
+	}
+
+	void pan(double dx, double dy) {
+		fit_precision();
+		center_x += FixedPoint(dx, center_x.get_precision());
+		center_y += FixedPoint(dy, center_y.get_precision());
+	}
+
+	// Move by a whole number of pixels, which lets the renderer reuse the last frame
+	void pan_pixels(int dx, int dy, sf::Vector2i resolution) {
+		pan(dx * width / resolution.x, dy * height / resolution.y);
+	}
+
+	// Scale the extent about the center, > 1 shows more of the plane
+	void zoom(double factor) {
+		width *= factor;
+		height *= factor;
+		fit_precision();
+	}
+
+	// Keep enough bits in the center to address a fraction of the extent
+	void fit_precision() {
+		int limbs = FixedPoint::limbs_for_spacing(std::min(std::abs(width), std::abs(height)) / 4096.0);
+		center_x.set_precision(limbs);
+		center_y.set_precision(limbs);
+	}
+
+};
@@ -97,6 +97,12 @@ inline float RadiansToDegrees(float in) {
 	return static_cast<float>(in * 180.0f / PI);
 }
 
+// Represent a double as the unevaluated sum of two floats, hi + lo. Good for ~48 bits
+inline void SplitDouble(double in, float &hi, float &lo) {
+	hi = static_cast<float>(in);
+	lo = static_cast<float>(in - static_cast<double>(hi));
+}
+
 inline std::string read_file(std::string file_name){
 	std::ifstream input_file(file_name);
 
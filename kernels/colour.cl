@@ -0,0 +1,46 @@
+// Second stage of every render, turns the smooth iteration counts the escape kernels
+// leave behind into the viewport image. It only reads a ushort and a palette entry or
+// two per pixel, so recolouring and palette cycling never touch the fractal itself.
+
+// For the packed count layout, the same one the escape kernels write
+#include "escape.h"
+
+// palette   : the lookup table, up to 4096 entries in constant memory
+// colouring : (offset, density, smooth, palette size). A count of n lands on palette
+//             entry n * density + offset, wrapped around. With smooth set the fraction
+//             of the count blends between neighbouring entries, otherwise it's dropped
+__kernel void colour_iterations (
+	global int2* image_res,
+  __write_only image2d_t image,
+  global ushort* iterations,
+  __constant uchar4* palette,
+  global float4* colouring
+  ){
+
+  size_t x_pixel = get_global_id(0);
+  size_t y_pixel = get_global_id(1);
+
+  int2 pixel = (int2)(x_pixel, y_pixel);
+
+  float4 c = *colouring;
+  int palette_size = (int)c.w;
+
+  ushort packed = iterations[y_pixel * (*image_res).x + x_pixel];
+
+  float count = c.z > 0 ?
+    (float)packed / (1 << ITERATION_FRACTION_BITS) :
+    (float)(packed >> ITERATION_FRACTION_BITS);
+
+  float position = count * c.y + c.x;
+  position -= floor(position / palette_size) * palette_size;
+
+  int first = min((int)position, palette_size - 1);
+  int second = (first + 1) % palette_size;
+
+  float4 colour = mix(convert_float4(palette[first]), convert_float4(palette[second]), position - first) / 255.0f;
+
+  write_imagef(image, pixel, (float4)(colour.xyz, 1.0f));
+
+  return;
+
+}
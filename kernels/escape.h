@@ -0,0 +1,141 @@
+// Shared by every kernel that iterates or reads the counts, OpenCL::read_source pastes it
+// in wherever a kernel #includes it so they can't drift apart
+
+// Iteration counts are stored as 11.5 fixed point smooth counts. The fraction is where
+// |z| landed between the bailout and its square, so the integer part is still the plain
+// escape count and neighbouring bands blend into each other
+#define ITERATION_FRACTION_BITS 5
+
+// The host builds with -D ITERATION_THRESHOLD to change it, at most 2047 so the
+// integer part still fits in 11 bits
+#ifndef ITERATION_THRESHOLD
+#define ITERATION_THRESHOLD 2000
+#endif
+
+// The host builds every kernel with the same -D ESCAPE_RADIUS_SQUARED, so all of them
+// bail out and smooth the same way. A larger radius smooths the fraction out
+#ifndef ESCAPE_RADIUS_SQUARED
+#define ESCAPE_RADIUS_SQUARED 4.0f
+#endif
+
+// Works on float, double and the high word of a double-single alike
+#define ESCAPED(magnitude) ((magnitude) >= ESCAPE_RADIUS_SQUARED)
+
+ushort pack_iterations(int iteration_count, int interation_threshold, float magnitude) {
+
+  if (iteration_count >= interation_threshold)
+    return (ushort)(interation_threshold << ITERATION_FRACTION_BITS);
+
+  float fraction = clamp(1.0f - log2(log2(max(magnitude, ESCAPE_RADIUS_SQUARED)) / log2(ESCAPE_RADIUS_SQUARED)), 0.0f, 31.0f / 32.0f);
+  return (ushort)((iteration_count << ITERATION_FRACTION_BITS) + (int)(fraction * (1 << ITERATION_FRACTION_BITS)));
+}
+
+float scale(float valueIn, float origMin, float origMax, float scaledMin, float scaledMax) {
+	return ((scaledMax - scaledMin) * (valueIn - origMin) / (origMax - origMin)) + scaledMin;
+}
+
+// Only "mandlebrot" gets specialized on this. Above 1 the loop runs unrolled blocks of that
+// many iterations between escape checks, past 4 (or a radius past 16) an escaping orbit can
+// overflow a float before the block ends
+#ifndef ESCAPE_CHECK_INTERVAL
+#define ESCAPE_CHECK_INTERVAL 1
+#endif
+
+// Which early-out caught a point inside the set, also its slot in interior_stats
+#define CAUGHT_NONE -1
+#define CAUGHT_CARDIOID 0
+#define CAUGHT_BULB 1
+#define CAUGHT_PERIOD 2
+
+// The single precision escape loop, returns the packed count. Points inside the set would
+// otherwise run to the threshold, so they're caught early where possible by the main
+// cardioid test, the period-2 bulb test or periodicity checking, `caught` says which
+ushort escape(float x0, float y0, float period_tolerance, int *caught) {
+
+  int interation_threshold = ITERATION_THRESHOLD;
+
+  *caught = CAUGHT_NONE;
+
+  float xq = x0 - 0.25f;
+  float q = xq * xq + y0 * y0;
+
+  if (q * (q + xq) <= 0.25f * y0 * y0)
+    *caught = CAUGHT_CARDIOID;
+  else if ((x0 + 1) * (x0 + 1) + y0 * y0 <= 0.0625f)
+    *caught = CAUGHT_BULB;
+
+  if (*caught != CAUGHT_NONE)
+    return pack_iterations(interation_threshold, interation_threshold, 0);
+
+  float x = 0.0;
+  float y = 0.0;
+
+  // Brent's method, compare against a saved point that moves up every power of two
+  // iterations. An orbit that lands back on it has settled into a cycle and never
+  // escapes. Anything closer than period_tolerance is the same point to us
+  float saved_x = 0.0;
+  float saved_y = 0.0;
+  int period = 0;
+  int period_limit = 1;
+
+  int iteration_count = 0;
+
+#if ESCAPE_CHECK_INTERVAL > 1
+  // Once a block escapes it's rolled back and finished a step at a time below, so the
+  // count and the fraction come out the same as without the blocks. Periodicity is only
+  // checked between blocks, a cycle still lines up with some multiple of the block length
+  while (iteration_count + ESCAPE_CHECK_INTERVAL <= interation_threshold) {
+
+    float block_x = x;
+    float block_y = y;
+
+    #pragma unroll
+    for (int i = 0; i < ESCAPE_CHECK_INTERVAL; i++) {
+      float x_temp = x*x - y*y + x0;
+      y = 2 * x * y + y0;
+      x = x_temp;
+    }
+
+    if (ESCAPED(x*x + y*y)) {
+      x = block_x;
+      y = block_y;
+      break;
+    }
+
+    iteration_count += ESCAPE_CHECK_INTERVAL;
+
+    if (fabs(x - saved_x) < period_tolerance && fabs(y - saved_y) < period_tolerance) {
+      *caught = CAUGHT_PERIOD;
+      return pack_iterations(interation_threshold, interation_threshold, 0);
+    }
+
+    if (++period == period_limit) {
+      saved_x = x;
+      saved_y = y;
+      period = 0;
+      period_limit *= 2;
+    }
+  }
+#endif
+
+  while (!ESCAPED(x*x + y*y) && iteration_count < interation_threshold) {
+    float x_temp = x*x - y*y + x0;
+    y = 2 * x * y + y0;
+    x = x_temp;
+    iteration_count++;
+
+    if (fabs(x - saved_x) < period_tolerance && fabs(y - saved_y) < period_tolerance) {
+      *caught = CAUGHT_PERIOD;
+      return pack_iterations(interation_threshold, interation_threshold, 0);
+    }
+
+    if (++period == period_limit) {
+      saved_x = x;
+      saved_y = y;
+      period = 0;
+      period_limit *= 2;
+    }
+  }
+
+  return pack_iterations(iteration_count, interation_threshold, x*x + y*y);
+}
@@ -0,0 +1,167 @@
+// Exponential map zooms. Every frame of a zoom into a fixed point shows mostly what the
+// last one did at a slightly different scale, so instead of rendering frames the zoom is
+// rendered once as a log-polar strip around the target:
+//
+//     c = target + r (cos theta, sin theta),   theta = 2 pi (column + 0.5) / columns
+//                                              log r = log outer - (row + 0.5) * log step
+//
+// With log step = 2 pi / columns the strip's pixels are square, and going down a row
+// shrinks r by the same factor everywhere. Rows live in a ring on the device, row n in
+// slot n % capacity, and frames get resampled out of whichever rows they span.
+//
+// Rows are iterated by perturbation against the target's orbit exactly as in
+// mandlebrot_perturbation.cl, since the strip goes as deep as the last frame does.
+
+#ifdef PERTURBATION_DOUBLE
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double real;
+typedef double2 real2;
+typedef double4 real4;
+#else
+typedef float real;
+typedef float2 real2;
+typedef float4 real4;
+#endif
+
+#include "escape.h"
+
+#define TWO_PI 6.28318530717958647692
+
+// layout     : (columns, capacity of the ring in rows, first row of the band, unused)
+// strip      : the ring of rows, packed smooth counts
+// orbit      : Z_0 .. Z_{length - 1} of the reference
+// view       : (log outer radius, log step, reference_x, reference_y), the reference as an
+//              offset from the target
+// state      : (orbit length, pass, unused, unused). Later passes only redo the pixels a
+//              previous reference flagged
+// glitches   : one flag per pixel of the band
+//
+// Launched over (columns, rows in the band) offset by the band's first row
+__kernel void exponential_map_strip (
+	global int4* layout,
+  global ushort* strip,
+  global real2* orbit,
+  global real4* view,
+  global int4* state,
+  global uchar* glitches
+  ){
+
+  int column = get_global_id(0);
+  int row = get_global_id(1);
+
+  int4 l = *layout;
+  int index = (row - l.z) * l.x + column;
+
+  int orbit_length = (*state).x;
+  int pass = (*state).y;
+
+  if (pass > 0 && glitches[index] == 0)
+    return;
+
+  real4 v = *view;
+
+  real theta = (real)TWO_PI * ((real)column + 0.5) / (real)l.x;
+  real radius = exp(v.x - ((real)row + 0.5) * v.y);
+
+  real2 dc = (real2)(radius * cos(theta) - v.z, radius * sin(theta) - v.w);
+  real2 dz = (real2)(0, 0);
+
+  int iteration_count = 0;
+  int interation_threshold = ITERATION_THRESHOLD;
+  uchar glitched = 0;
+  real magnitude = 0;
+
+  while (iteration_count < interation_threshold) {
+
+    real2 Z = orbit[iteration_count];
+    real2 z = Z + dz;
+
+    magnitude = z.x * z.x + z.y * z.y;
+    if (ESCAPED(magnitude))
+      break;
+
+    if (magnitude < (real)1e-6 * (Z.x * Z.x + Z.y * Z.y)) {
+      glitched = 1;
+      break;
+    }
+
+    if (iteration_count + 1 >= orbit_length) {
+      glitched = 1;
+      break;
+    }
+
+    dz = (real2)(
+      2 * (Z.x * dz.x - Z.y * dz.y) + (dz.x * dz.x - dz.y * dz.y) + dc.x,
+      2 * (Z.x * dz.y + Z.y * dz.x) + 2 * dz.x * dz.y + dc.y);
+
+    iteration_count++;
+  }
+
+  glitches[index] = glitched;
+  strip[(row % l.y) * l.x + column] = pack_iterations(iteration_count, interation_threshold, (float)magnitude);
+}
+
+// Fill a frame centred on the target from the strip. Counts are blended bilinearly between
+// the four nearest strip pixels, unless one of them is inside the set, where blending would
+// smear the interior's count into its neighbours and the nearest one is taken instead
+//
+// layout     : (columns, capacity, first row the frame spans, last row it spans)
+// frame      : (row a pixel away from the center lands on, y_step / x_step, log step, unused)
+__kernel void exponential_map_resample (
+	global int2* image_res,
+  global ushort* iterations,
+  global ushort* strip,
+  global int4* layout,
+  global float4* frame
+  ){
+
+  int x_pixel = get_global_id(0);
+  int y_pixel = get_global_id(1);
+
+  int2 res = *image_res;
+  int4 l = *layout;
+  float4 f = *frame;
+
+  // Offset from the target in pixels, the same corner sampling the escape kernels use
+  float u = (float)x_pixel - (float)res.x * 0.5f;
+  float v = ((float)y_pixel - (float)res.y * 0.5f) * f.y;
+
+  // The center pixel has no angle or radius, it just takes the innermost row
+  float r2 = u * u + v * v;
+  float row = r2 > 0.0f ? f.x - 0.5f * log(r2) / f.z : (float)l.w;
+  row = clamp(row, (float)l.z, (float)l.w);
+
+  float column = atan2(v, u) / (float)TWO_PI * (float)l.x - 0.5f;
+  column -= floor(column / l.x) * l.x;
+
+  int row_0 = (int)row;
+  int row_1 = min(row_0 + 1, l.w);
+  int column_0 = min((int)column, l.x - 1);
+  int column_1 = (column_0 + 1) % l.x;
+
+  float row_t = row - row_0;
+  float column_t = column - column_0;
+
+  int slot_0 = (row_0 % l.y) * l.x;
+  int slot_1 = (row_1 % l.y) * l.x;
+
+  int a = strip[slot_0 + column_0];
+  int b = strip[slot_0 + column_1];
+  int c = strip[slot_1 + column_0];
+  int d = strip[slot_1 + column_1];
+
+  int interior = ITERATION_THRESHOLD << ITERATION_FRACTION_BITS;
+
+  ushort packed;
+
+  if (max(max(a, b), max(c, d)) >= interior) {
+    int nearest_row = row_t < 0.5f ? slot_0 : slot_1;
+    packed = strip[nearest_row + (column_t < 0.5f ? column_0 : column_1)];
+  } else {
+    float top = mix((float)a, (float)b, column_t);
+    float bottom = mix((float)c, (float)d, column_t);
+    packed = (ushort)(mix(top, bottom, row_t) + 0.5f);
+  }
+
+  iterations[y_pixel * res.x + x_pixel] = packed;
+}
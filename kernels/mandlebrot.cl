@@ -1,45 +1,66 @@
+#include "escape.h"
 
-float scale(float valueIn, float origMin, float origMax, float scaledMin, float scaledMax) {
-	return ((scaledMax - scaledMin) * (valueIn - origMin) / (origMax - origMin)) + scaledMin;
-}
+// The host specializes this kernel on the resolution and ESCAPE_CHECK_INTERVAL, the defaults
+// are the plain kernel. Baking the resolution in saves reading image_res through a pointer
+// on every use
+#ifdef IMAGE_WIDTH
+#define image_width IMAGE_WIDTH
+#define image_height IMAGE_HEIGHT
+#else
+#define image_width (*image_res).x
+#define image_height (*image_res).y
+#endif
 
+// Only the iteration counts are written, colour.cl turns them into an image afterwards.
+// Keeping them around also lets the host shift the last frame when panning and only
+// launch over the strips that came into view
+//
+// progressive is (step, skip_coarse). Only every step'th pixel in each direction is
+// computed and stored as a step x step block, with skip_coarse set the pixels the pass
+// at twice the step already did are left alone. (1, 0) is a plain full render
+//
+// Points inside the set would otherwise run to the threshold, so they're caught early
+// where possible. interior_stats counts the pixels caught by the main cardioid test,
+// the period-2 bulb test and periodicity checking, in that order
 __kernel void mandlebrot (
 	global int2* image_res,
-  __write_only image2d_t image,
-  global float4* range
+  global float4* range,
+  global ushort* iterations,
+  global int2* progressive,
+  global int* interior_stats
   ){
 
-  size_t x_pixel = get_global_id(0);
-  size_t y_pixel = get_global_id(1);
-
-  int2 pixel = (int2)(x_pixel, y_pixel);
+  int2 pass = *progressive;
 
-  float x0 = scale(x_pixel, 0, (*image_res).x, (*range).x, (*range).y);
-  float y0 = scale(y_pixel, 0, (*image_res).y, (*range).z, (*range).w);
+  size_t x_pixel = get_global_id(0) * pass.x;
+  size_t y_pixel = get_global_id(1) * pass.x;
 
-  float x = 0.0;
-  float y = 0.0;
+  // The work size is rounded up to cover the edge blocks
+  if (x_pixel >= image_width || y_pixel >= image_height)
+    return;
 
-  int iteration_count = 0;
-  int interation_threshold = 2000;
+  // Already done by the coarser pass before this one
+  if (pass.y && x_pixel % (2 * pass.x) == 0 && y_pixel % (2 * pass.x) == 0)
+    return;
 
-  while (x*x + y*y < 4 && iteration_count < interation_threshold) {
-    float x_temp = x*x - y*y + x0;
-    y = 2 * x * y + y0;
-    x = x_temp;
-    iteration_count++;
-  }
+  float4 r = *range;
 
-  int val = scale(iteration_count, 0, 1000, 0, 16777216);
-  //printf("%i", ((val >> 8) & 0xff));
+  float x0 = scale(x_pixel, 0, image_width, r.x, r.y);
+  float y0 = scale(y_pixel, 0, image_height, r.z, r.w);
 
-  float r = scale((val & 0xff), 0, 255, 0, 1);
-  float g = scale((val >> 8) & 0xff, 0, 255, 0, 1);
-  float b = scale((val >> 16) & 0xff, 0, 255, 0, 1);
+  // Anything closer than a fraction of a pixel is the same point to us
+  int caught;
+  ushort packed = escape(x0, y0, (r.y - r.x) / image_width * 0.01f, &caught);
 
+  if (caught != CAUGHT_NONE)
+    atomic_inc(&interior_stats[caught]);
 
-//  write_imagei(image, pixel, (int4)((val & 0xff), ((val >> 8) & 0xff), ((val >> 16) & 0xff), 200));
-    write_imagef(image, pixel, (float4)(r, g, b, 200));
+  // Coarse passes stand in for the whole block until a finer pass gets to it
+  for (int by = 0; by < pass.x && y_pixel + by < image_height; by++) {
+    for (int bx = 0; bx < pass.x && x_pixel + bx < image_width; bx++) {
+      iterations[(y_pixel + by) * image_width + x_pixel + bx] = packed;
+    }
+  }
 
   return;
 
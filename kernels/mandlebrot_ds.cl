@@ -0,0 +1,174 @@
+// Double-single (float-float) variant of the mandlebrot kernel. Every coordinate is an
+// unevaluated sum hi + lo of two floats, which gives roughly a 48 bit mantissa using
+// nothing but fp32 arithmetic. That keeps deep views sharp on devices without
+// cl_khr_fp64, and on consumer GPUs where fp64 runs at a fraction of fp32 speed.
+//
+// The error free transforms below fall apart if the compiler reassociates or fuses
+// them, so this file is built without the fast math flags and contraction is off.
+
+#pragma OPENCL FP_CONTRACT OFF
+
+#include "escape.h"
+
+// .x is the high word, .y the low word
+
+float2 two_sum(float a, float b) {
+  float s = a + b;
+  float bb = s - a;
+  float e = (a - (s - bb)) + (b - bb);
+  return (float2)(s, e);
+}
+
+// Only valid when |a| >= |b|
+float2 quick_two_sum(float a, float b) {
+  float s = a + b;
+  float e = b - (s - a);
+  return (float2)(s, e);
+}
+
+float2 two_prod(float a, float b) {
+
+  float p = a * b;
+
+#ifdef FP_FAST_FMAF
+  float e = fma(a, b, -p);
+#else
+  // Dekker split, 4097 = 2^12 + 1 cuts a 24 bit mantissa in half
+  float t = 4097.0f * a;
+  float a_hi = t - (t - a);
+  float a_lo = a - a_hi;
+
+  t = 4097.0f * b;
+  float b_hi = t - (t - b);
+  float b_lo = b - b_hi;
+
+  float e = ((a_hi * b_hi - p) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+#endif
+
+  return (float2)(p, e);
+}
+
+float2 ds_add(float2 a, float2 b) {
+  float2 s = two_sum(a.x, b.x);
+  float2 t = two_sum(a.y, b.y);
+  s.y += t.x;
+  s = quick_two_sum(s.x, s.y);
+  s.y += t.y;
+  return quick_two_sum(s.x, s.y);
+}
+
+float2 ds_sub(float2 a, float2 b) {
+  return ds_add(a, -b);
+}
+
+float2 ds_mul(float2 a, float2 b) {
+  float2 p = two_prod(a.x, b.x);
+  p.y += a.x * b.y + a.y * b.x;
+  return quick_two_sum(p.x, p.y);
+}
+
+float2 ds_mul_f(float2 a, float b) {
+  float2 p = two_prod(a.x, b);
+  p.y += a.y * b;
+  return quick_two_sum(p.x, p.y);
+}
+
+// view[0] = (x_min.hi, x_min.lo, y_min.hi, y_min.lo)
+// view[1] = (x_step.hi, x_step.lo, y_step.hi, y_step.lo), the size of one pixel
+// iterations, progressive and interior_stats work the same as in the single precision kernel
+__kernel void mandlebrot_ds (
+	global int2* image_res,
+  global float4* view,
+  global ushort* iterations,
+  global int2* progressive,
+  global int* interior_stats
+  ){
+
+  int2 pass = *progressive;
+
+  size_t x_pixel = get_global_id(0) * pass.x;
+  size_t y_pixel = get_global_id(1) * pass.x;
+
+  // The work size is rounded up to cover the edge blocks
+  if (x_pixel >= (*image_res).x || y_pixel >= (*image_res).y)
+    return;
+
+  // Already done by the coarser pass before this one
+  if (pass.y && x_pixel % (2 * pass.x) == 0 && y_pixel % (2 * pass.x) == 0)
+    return;
+
+  float4 origin = view[0];
+  float4 step = view[1];
+
+  float2 x0 = ds_add(origin.xy, ds_mul_f(step.xy, (float)x_pixel));
+  float2 y0 = ds_add(origin.zw, ds_mul_f(step.zw, (float)y_pixel));
+
+  float2 x = (float2)(0.0f, 0.0f);
+  float2 y = (float2)(0.0f, 0.0f);
+
+  int iteration_count = 0;
+  int interation_threshold = ITERATION_THRESHOLD;
+
+  // The interior tests have to hold up at the zoom this kernel runs at, so they're
+  // done in double-single too
+  float2 xq = ds_add(x0, (float2)(-0.25f, 0.0f));
+  float2 yy0 = ds_mul(y0, y0);
+  float2 q = ds_add(ds_mul(xq, xq), yy0);
+
+  float2 x1 = ds_add(x0, (float2)(1.0f, 0.0f));
+
+  if (ds_sub(ds_mul(q, ds_add(q, xq)), ds_mul_f(yy0, 0.25f)).x <= 0) {
+    iteration_count = interation_threshold;
+    atomic_inc(&interior_stats[0]);
+  }
+  else if (ds_add(ds_mul(x1, x1), yy0).x <= 0.0625f) {
+    iteration_count = interation_threshold;
+    atomic_inc(&interior_stats[1]);
+  }
+
+  float2 saved_x = (float2)(0.0f, 0.0f);
+  float2 saved_y = (float2)(0.0f, 0.0f);
+  int period = 0;
+  int period_limit = 1;
+  float period_tolerance = step.x * 0.01f;
+
+  while (iteration_count < interation_threshold) {
+
+    float2 xx = ds_mul(x, x);
+    float2 yy = ds_mul(y, y);
+
+    // The low words can't move the magnitude across the bailout, the high words are enough
+    if (ESCAPED(xx.x + yy.x))
+      break;
+
+    float2 xy = ds_mul(x, y);
+    y = ds_add(ds_add(xy, xy), y0);
+    x = ds_add(ds_sub(xx, yy), x0);
+    iteration_count++;
+
+    if (fabs(ds_sub(x, saved_x).x) < period_tolerance && fabs(ds_sub(y, saved_y).x) < period_tolerance) {
+      iteration_count = interation_threshold;
+      atomic_inc(&interior_stats[2]);
+      break;
+    }
+
+    if (++period == period_limit) {
+      saved_x = x;
+      saved_y = y;
+      period = 0;
+      period_limit *= 2;
+    }
+  }
+
+  ushort packed = pack_iterations(iteration_count, interation_threshold, x.x * x.x + y.x * y.x);
+
+  // Coarse passes stand in for the whole block until a finer pass gets to it
+  for (int by = 0; by < pass.x && y_pixel + by < (*image_res).y; by++) {
+    for (int bx = 0; bx < pass.x && x_pixel + bx < (*image_res).x; bx++) {
+      iterations[(y_pixel + by) * (*image_res).x + x_pixel + bx] = packed;
+    }
+  }
+
+  return;
+
+}
@@ -0,0 +1,125 @@
+// Perturbation deep zoom kernel. A single reference orbit Z_n is computed on the host at
+// arbitrary precision, and every pixel only iterates its small offset from it:
+//
+//     dz_{n+1} = 2 Z_n dz_n + dz_n^2 + dc
+//
+// dz and dc stay tiny and well scaled, so plain floats or doubles carry them at any zoom.
+// Built with -D PERTURBATION_DOUBLE when the device has cl_khr_fp64, otherwise the deltas
+// are fp32 and bottom out around 1e-38.
+//
+// For the first iterations dz is a smooth function of dc, and the host fits the cubic
+//
+//     dz_n ~ A_n dc + B_n dc^2 + C_n dc^3
+//
+// for the whole frame. Every pixel starts at n = skip from that instead of from zero.
+
+#ifdef PERTURBATION_DOUBLE
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double real;
+typedef double2 real2;
+typedef double4 real4;
+#else
+typedef float real;
+typedef float2 real2;
+typedef float4 real4;
+#endif
+
+#include "escape.h"
+
+real2 complex_mul(real2 a, real2 b) {
+  return (real2)(a.x * b.x - a.y * b.y, a.x * b.y + a.y * b.x);
+}
+
+// iterations : smooth counts per pixel, coloured by colour.cl once every pass is done
+// orbit      : Z_0 .. Z_{length - 1} of the reference
+// view       : (x_step, y_step, reference_x, reference_y), the size of a pixel and the
+//              reference point as an offset from the center of the view
+// state      : (orbit length, pass, skip, unused). Pass 0 renders everything, later passes
+//              only the pixels a previous reference flagged
+// glitches   : one flag per pixel, set when this reference can't resolve it
+// series     : A, B, C at iteration skip. Pre-multiplied by x_step, x_step^2 and x_step^3
+//              so they are fed dc in pixel units and stay inside fp32 range
+__kernel void mandlebrot_perturbation (
+	global int2* image_res,
+  global ushort* iterations,
+  global real2* orbit,
+  global real4* view,
+  global int4* state,
+  global uchar* glitches,
+  global real2* series
+  ){
+
+  size_t x_pixel = get_global_id(0);
+  size_t y_pixel = get_global_id(1);
+
+  int2 res = *image_res;
+  int index = y_pixel * res.x + x_pixel;
+
+  int orbit_length = (*state).x;
+  int pass = (*state).y;
+
+  if (pass > 0 && glitches[index] == 0)
+    return;
+
+  real4 v = *view;
+
+  real2 dc = (real2)(
+    ((real)x_pixel - (real)res.x * 0.5) * v.x - v.z,
+    ((real)y_pixel - (real)res.y * 0.5) * v.y - v.w);
+
+  real2 dz = (real2)(0, 0);
+
+  int iteration_count = 0;
+  int interation_threshold = ITERATION_THRESHOLD;
+  uchar glitched = 0;
+  real magnitude = 0;
+
+  int skip = (*state).z;
+
+  if (skip > 0) {
+
+    real2 dc_pixels = dc / v.x;
+    real2 dc_squared = complex_mul(dc_pixels, dc_pixels);
+
+    dz = complex_mul(series[0], dc_pixels)
+       + complex_mul(series[1], dc_squared)
+       + complex_mul(series[2], complex_mul(dc_squared, dc_pixels));
+
+    iteration_count = skip;
+  }
+
+  while (iteration_count < interation_threshold) {
+
+    real2 Z = orbit[iteration_count];
+    real2 z = Z + dz;
+
+    magnitude = z.x * z.x + z.y * z.y;
+    if (ESCAPED(magnitude))
+      break;
+
+    // Pauldelbrot's criterion, once the full value is tiny next to the reference the
+    // delta has cancelled away its precision and the result can't be trusted
+    if (magnitude < (real)1e-6 * (Z.x * Z.x + Z.y * Z.y)) {
+      glitched = 1;
+      break;
+    }
+
+    // The reference escaped before this pixel did, there is nothing left to follow
+    if (iteration_count + 1 >= orbit_length) {
+      glitched = 1;
+      break;
+    }
+
+    dz = (real2)(
+      2 * (Z.x * dz.x - Z.y * dz.y) + (dz.x * dz.x - dz.y * dz.y) + dc.x,
+      2 * (Z.x * dz.y + Z.y * dz.x) + 2 * dz.x * dz.y + dc.y);
+
+    iteration_count++;
+  }
+
+  glitches[index] = glitched;
+  iterations[index] = pack_iterations(iteration_count, interation_threshold, (float)magnitude);
+
+  return;
+
+}
@@ -0,0 +1,155 @@
+// Mariani-Silver subdivision. The set is connected and so are the escape bands around
+// it, so a rectangle whose whole border has one iteration count almost always has that
+// count all the way through. The host drives it a level at a time:
+//
+//   subdivision_border : compute the border pixels of every tile in the list
+//   subdivision_decide : per tile, uniform border -> fill value, else split or compute
+//   subdivision_fill   : flood the inside of the tiles that were decided
+//
+// and the tiles that were split go back through as the next level's list. Tiles count
+// as uniform when the integer part of their border counts matches, the smooth fractions
+// always differ a little.
+//
+// Tiles are int4 (x, y, width, height) in pixels.
+
+// Tiles this small aren't worth another level, their inside just gets computed
+#define MIN_SPLIT 8
+
+// Decisions besides a fill value
+#define DECISION_COMPUTE -1
+#define DECISION_SPLIT -2
+
+// Pixels nothing has computed yet
+#define ITERATIONS_UNSET 0xFFFF
+
+#include "escape.h"
+
+// Tiles one or two pixels across are all border, the walk below covers them with a few
+// repeats. A single pixel still needs one
+int perimeter(int4 tile) {
+  return max(2 * tile.z + 2 * tile.w - 4, 1);
+}
+
+// Top row, bottom row, then the left and right columns without their corners
+int2 border_pixel(int4 tile, int index) {
+
+  if (index < tile.z)
+    return (int2)(tile.x + index, tile.y);
+
+  index -= tile.z;
+  if (index < tile.z)
+    return (int2)(tile.x + index, tile.y + tile.w - 1);
+
+  index -= tile.z;
+  if (index < tile.w - 2)
+    return (int2)(tile.x, tile.y + 1 + index);
+
+  index -= tile.w - 2;
+  return (int2)(tile.x + tile.z - 1, tile.y + 1 + index);
+}
+
+// Pixels are unset until something computes them, so borders shared with the parent
+// tile aren't computed twice
+__kernel void subdivision_clear (
+	global int2* image_res,
+  global ushort* iterations
+  ){
+
+  size_t x_pixel = get_global_id(0);
+  size_t y_pixel = get_global_id(1);
+
+  iterations[y_pixel * (*image_res).x + x_pixel] = ITERATIONS_UNSET;
+}
+
+// Launched over (longest perimeter, tile count)
+__kernel void subdivision_border (
+	global int2* image_res,
+  global float4* range,
+  global ushort* iterations,
+  global int4* tiles
+  ){
+
+  int4 tile = tiles[get_global_id(1)];
+  int index = get_global_id(0);
+
+  if (index >= perimeter(tile))
+    return;
+
+  int2 res = *image_res;
+  int2 pixel = border_pixel(tile, index);
+
+  if (iterations[pixel.y * res.x + pixel.x] != ITERATIONS_UNSET)
+    return;
+
+  float x0 = scale(pixel.x, 0, res.x, (*range).x, (*range).y);
+  float y0 = scale(pixel.y, 0, res.y, (*range).z, (*range).w);
+  float period_tolerance = ((*range).y - (*range).x) / res.x * 0.01f;
+
+  int caught;
+  iterations[pixel.y * res.x + pixel.x] = escape(x0, y0, period_tolerance, &caught);
+}
+
+// Launched over the tile count. A uniform tile is filled with its first border pixel
+__kernel void subdivision_decide (
+	global int2* image_res,
+  global ushort* iterations,
+  global int4* tiles,
+  global int* decisions
+  ){
+
+  int4 tile = tiles[get_global_id(0)];
+  int2 res = *image_res;
+
+  int2 first = border_pixel(tile, 0);
+  int value = iterations[first.y * res.x + first.x];
+
+  bool uniform = true;
+  int length = perimeter(tile);
+
+  for (int i = 1; i < length && uniform; i++) {
+    int2 pixel = border_pixel(tile, i);
+    uniform = iterations[pixel.y * res.x + pixel.x] >> ITERATION_FRACTION_BITS == value >> ITERATION_FRACTION_BITS;
+  }
+
+  if (uniform)
+    decisions[get_global_id(0)] = value;
+  else if (min(tile.z, tile.w) <= MIN_SPLIT)
+    decisions[get_global_id(0)] = DECISION_COMPUTE;
+  else
+    decisions[get_global_id(0)] = DECISION_SPLIT;
+}
+
+// Launched over (largest inside, tile count). values holds the fill value per tile, or
+// DECISION_COMPUTE to run the escape loop on every pixel inside
+__kernel void subdivision_fill (
+	global int2* image_res,
+  global float4* range,
+  global ushort* iterations,
+  global int4* tiles,
+  global int* values
+  ){
+
+  int4 tile = tiles[get_global_id(1)];
+  int index = get_global_id(0);
+
+  int inside_width = tile.z - 2;
+  int inside_height = tile.w - 2;
+
+  if (inside_width <= 0 || inside_height <= 0 || index >= inside_width * inside_height)
+    return;
+
+  int2 res = *image_res;
+  int2 pixel = (int2)(tile.x + 1 + index % inside_width, tile.y + 1 + index / inside_width);
+
+  int value = values[get_global_id(1)];
+
+  if (value == DECISION_COMPUTE) {
+    float x0 = scale(pixel.x, 0, res.x, (*range).x, (*range).y);
+    float y0 = scale(pixel.y, 0, res.y, (*range).z, (*range).w);
+    float period_tolerance = ((*range).y - (*range).x) / res.x * 0.01f;
+    int caught;
+    value = escape(x0, y0, period_tolerance, &caught);
+  }
+
+  iterations[pixel.y * res.x + pixel.x] = value;
+}
@@ -0,0 +1,25 @@
+// Move the last frame's iteration counts by a whole number of pixels when the view pans.
+// New pixel p shows what old pixel p + offset showed. Pixels whose source fell off the
+// edge are left alone, the host launches the escape kernel over just those strips.
+__kernel void shift_iterations (
+	global int2* image_res,
+  global ushort* source,
+  global ushort* destination,
+  global int2* offset
+  ){
+
+  size_t x_pixel = get_global_id(0);
+  size_t y_pixel = get_global_id(1);
+
+  int2 pixel = (int2)(x_pixel, y_pixel);
+  int2 res = *image_res;
+  int2 from = pixel + *offset;
+
+  if (from.x < 0 || from.y < 0 || from.x >= res.x || from.y >= res.y)
+    return;
+
+  destination[y_pixel * res.x + x_pixel] = source[from.y * res.x + from.x];
+
+  return;
+
+}
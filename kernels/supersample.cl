@@ -0,0 +1,151 @@
+// Adaptive antialiasing for single precision frames. Every pixel is one sample at its
+// corner, which aliases badly along the boundary. Instead of supersampling the whole frame
+// this marks the pixels whose neighbourhood varies, iterates only those again at a number
+// of jittered subsamples, and lets the colour pass average the subsamples' colours
+
+#include "escape.h"
+
+// Same lookup as colour_iterations
+float4 palette_colour(ushort packed, float4 c, __constant uchar4* palette) {
+
+  int palette_size = (int)c.w;
+
+  float count = c.z > 0 ?
+    (float)packed / (1 << ITERATION_FRACTION_BITS) :
+    (float)(packed >> ITERATION_FRACTION_BITS);
+
+  float position = count * c.y + c.x;
+  position -= floor(position / palette_size) * palette_size;
+
+  int first = min((int)position, palette_size - 1);
+  int second = (first + 1) % palette_size;
+
+  return mix(convert_float4(palette[first]), convert_float4(palette[second]), position - first) / 255.0f;
+}
+
+// Per pixel offset in [0, 1) so neighbouring pixels don't all sample the same pattern
+float2 pixel_jitter(uint pixel) {
+
+  uint h = pixel * 0x9E3779B9u;
+  h ^= h >> 16;
+  h *= 0x85EBCA6Bu;
+  h ^= h >> 13;
+
+  return (float2)((float)(h & 0xffff), (float)(h >> 16)) / 65536.0f;
+}
+
+// settings   : (samples per pixel, capacity of marks, edge threshold, unused). The threshold
+//              is in packed units, 32 is one whole iteration
+// marks      : indices of the pixels to refine, mark_count of them. Past the capacity the
+//              count keeps going up but nothing more gets stored
+__kernel void supersample_mark (
+	global int2* image_res,
+  global ushort* iterations,
+  global int4* settings,
+  global uint* marks,
+  global uint* mark_count
+  ){
+
+  int x_pixel = get_global_id(0);
+  int y_pixel = get_global_id(1);
+
+  int width = (*image_res).x;
+  int height = (*image_res).y;
+
+  int4 s = *settings;
+  int centre = iterations[y_pixel * width + x_pixel];
+
+  // Any of the 8 neighbours a band or more away, or on the other side of the boundary
+  bool edge = false;
+
+  for (int dy = -1; dy <= 1 && !edge; dy++) {
+    for (int dx = -1; dx <= 1; dx++) {
+
+      int x = clamp(x_pixel + dx, 0, width - 1);
+      int y = clamp(y_pixel + dy, 0, height - 1);
+
+      if (abs((int)iterations[y * width + x] - centre) > s.z) {
+        edge = true;
+        break;
+      }
+    }
+  }
+
+  if (!edge)
+    return;
+
+  uint index = atomic_inc(mark_count);
+  if (index < (uint)s.y)
+    marks[index] = y_pixel * width + x_pixel;
+}
+
+// One work item per subsample, (mark, sample). Subsamples follow the R2 sequence around the
+// pixel's own sample, shifted by pixel_jitter and wrapped so they cover the pixel evenly
+__kernel void supersample_iterate (
+	global int2* image_res,
+  global float4* range,
+  global int4* settings,
+  global uint* marks,
+  global uint* mark_count,
+  global ushort* subsamples
+  ){
+
+  uint mark = get_global_id(0);
+  int sample = get_global_id(1);
+
+  int4 s = *settings;
+
+  // Pipelined frames launch over the whole capacity without knowing the count
+  if (mark >= min(*mark_count, (uint)s.y))
+    return;
+
+  uint pixel = marks[mark];
+  int width = (*image_res).x;
+  int height = (*image_res).y;
+
+  float2 offset = (float2)(0.5f, 0.5f) + (float)sample * (float2)(0.7548776662f, 0.5698402910f) + pixel_jitter(pixel);
+  offset = offset - floor(offset) - 0.5f;
+
+  float4 r = *range;
+
+  float x0 = scale((float)(pixel % width) + offset.x, 0, width, r.x, r.y);
+  float y0 = scale((float)(pixel / width) + offset.y, 0, height, r.z, r.w);
+
+  // Same tolerance as the pixel's own sample, so its interior subsamples are caught the same way
+  int caught;
+  subsamples[mark * s.x + sample] = escape(x0, y0, (r.y - r.x) / width * 0.01f, &caught);
+}
+
+// Runs after colour_iterations and overwrites the marked pixels with the average colour of
+// their subsamples. Recolouring only reruns this, the subsamples are kept
+__kernel void supersample_colour (
+	global int2* image_res,
+  __write_only image2d_t image,
+  global int4* settings,
+  global uint* marks,
+  global uint* mark_count,
+  global ushort* subsamples,
+  __constant uchar4* palette,
+  global float4* colouring
+  ){
+
+  uint mark = get_global_id(0);
+
+  int4 s = *settings;
+
+  if (mark >= min(*mark_count, (uint)s.y))
+    return;
+
+  uint pixel = marks[mark];
+  int width = (*image_res).x;
+
+  float4 c = *colouring;
+  float4 colour = (float4)(0.0f);
+
+  for (int sample = 0; sample < s.x; sample++)
+    colour += palette_colour(subsamples[mark * s.x + sample], c, palette);
+
+  colour /= s.x;
+
+  write_imagef(image, (int2)((int)(pixel % width), (int)(pixel / width)), (float4)(colour.xyz, 1.0f));
+}
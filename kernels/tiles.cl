@@ -0,0 +1,27 @@
+// Kernels for the tile cache. Tiles are computed on their own grid, independent of where
+// the screen happens to be, and the host assembles a frame out of them for colour.cl
+
+#define TILE_SIZE 64
+
+#include "escape.h"
+
+// Launched over (TILE_SIZE, TILE_SIZE * tile count). origins holds the complex
+// coordinate of each tile's first pixel in .xy and the pixel spacing in .z, the counts
+// go out tile after tile
+__kernel void render_tiles (
+	global float4* origins,
+  global ushort* tile_iterations
+  ){
+
+  int x = get_global_id(0);
+  int tile = get_global_id(1) / TILE_SIZE;
+  int y = get_global_id(1) % TILE_SIZE;
+
+  float4 origin = origins[tile];
+
+  float x0 = origin.x + x * origin.z;
+  float y0 = origin.y + y * origin.z;
+
+  int caught;
+  tile_iterations[(tile * TILE_SIZE + y) * TILE_SIZE + x] = escape(x0, y0, origin.z * 0.01f, &caught);
+}
@@ -0,0 +1,380 @@
+#include "CPURenderer.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_RENDERER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC will emit any intrinsic regardless of the /arch flag, gcc and clang need to
+// be told per function which instruction sets they may use. avx512f drags FMA in with
+// it, and gcc will happily fuse the mul/add pairs, which shifts escape counts away from
+// the other paths
+#if defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+#elif defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#else
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
+
+
+namespace {
+
+	// Kept identical to scale() in kernels/escape.h so both backends land on the same pixels
+	inline float scale(float valueIn, float origMin, float origMax, float scaledMin, float scaledMax) {
+		return ((scaledMax - scaledMin) * (valueIn - origMin) / (origMax - origMin)) + scaledMin;
+	}
+
+	// Same as pack_iterations in kernels/escape.h
+	inline uint16_t pack_iterations(int iteration_count, int threshold, float magnitude, float bailout, int fraction_bits) {
+
+		if (iteration_count >= threshold)
+			return static_cast<uint16_t>(threshold << fraction_bits);
+
+		float fraction = 1.0f - std::log2(std::log2(std::max(magnitude, bailout)) / std::log2(bailout));
+		fraction = std::max(0.0f, std::min(fraction, 31.0f / 32.0f));
+		return static_cast<uint16_t>((iteration_count << fraction_bits) + static_cast<int>(fraction * (1 << fraction_bits)));
+	}
+
+	// Each of these takes `count` starting x values sharing one y0, and writes the
+	// number of iterations each point took to pass the bailout and |z|^2 once it did
+
+	void iterate_scalar(const float *x0, float y0, int count, int threshold, float bailout, int *out, float *magnitudes) {
+
+		for (int i = 0; i < count; i++) {
+
+			float x = 0.0f;
+			float y = 0.0f;
+
+			int iteration_count = 0;
+
+			while (x*x + y*y < bailout && iteration_count < threshold) {
+				float x_temp = x*x - y*y + x0[i];
+				y = 2 * x * y + y0;
+				x = x_temp;
+				iteration_count++;
+			}
+
+			out[i] = iteration_count;
+			magnitudes[i] = x*x + y*y;
+		}
+	}
+
+#ifdef CPU_RENDERER_X86
+
+	void iterate_sse2(const float *x0, float y0, int count, int threshold, float bailout, int *out, float *magnitudes) {
+
+		const __m128 limit = _mm_set1_ps(bailout);
+		const __m128 two = _mm_set1_ps(2.0f);
+		const __m128 cy = _mm_set1_ps(y0);
+
+		int i = 0;
+		for (; i + 4 <= count; i += 4) {
+
+			__m128 cx = _mm_loadu_ps(x0 + i);
+			__m128 x = _mm_setzero_ps();
+			__m128 y = _mm_setzero_ps();
+			__m128 active = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			__m128i counts = _mm_setzero_si128();
+			__m128 magnitude = _mm_setzero_ps();
+
+			for (int n = 0; n < threshold; n++) {
+
+				__m128 xx = _mm_mul_ps(x, x);
+				__m128 yy = _mm_mul_ps(y, y);
+				__m128 m = _mm_add_ps(xx, yy);
+
+				// Lanes still going keep the latest magnitude, so an escaped one holds the one it left with
+				magnitude = _mm_or_ps(_mm_and_ps(active, m), _mm_andnot_ps(active, magnitude));
+
+				active = _mm_and_ps(active, _mm_cmplt_ps(m, limit));
+				if (_mm_movemask_ps(active) == 0)
+					break;
+
+				// Active lanes are all ones, which is -1 as an integer
+				counts = _mm_sub_epi32(counts, _mm_castps_si128(active));
+
+				__m128 x_temp = _mm_add_ps(_mm_sub_ps(xx, yy), cx);
+				y = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(two, x), y), cy);
+				x = x_temp;
+			}
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), counts);
+			_mm_storeu_ps(magnitudes + i, magnitude);
+		}
+
+		iterate_scalar(x0 + i, y0, count - i, threshold, bailout, out + i, magnitudes + i);
+	}
+
+	TARGET_AVX2
+	void iterate_avx2(const float *x0, float y0, int count, int threshold, float bailout, int *out, float *magnitudes) {
+
+		const __m256 limit = _mm256_set1_ps(bailout);
+		const __m256 two = _mm256_set1_ps(2.0f);
+		const __m256 cy = _mm256_set1_ps(y0);
+
+		int i = 0;
+		for (; i + 8 <= count; i += 8) {
+
+			__m256 cx = _mm256_loadu_ps(x0 + i);
+			__m256 x = _mm256_setzero_ps();
+			__m256 y = _mm256_setzero_ps();
+			__m256 active = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			__m256i counts = _mm256_setzero_si256();
+			__m256 magnitude = _mm256_setzero_ps();
+
+			for (int n = 0; n < threshold; n++) {
+
+				__m256 xx = _mm256_mul_ps(x, x);
+				__m256 yy = _mm256_mul_ps(y, y);
+				__m256 m = _mm256_add_ps(xx, yy);
+
+				magnitude = _mm256_blendv_ps(magnitude, m, active);
+
+				active = _mm256_and_ps(active, _mm256_cmp_ps(m, limit, _CMP_LT_OQ));
+				if (_mm256_movemask_ps(active) == 0)
+					break;
+
+				counts = _mm256_sub_epi32(counts, _mm256_castps_si256(active));
+
+				__m256 x_temp = _mm256_add_ps(_mm256_sub_ps(xx, yy), cx);
+				y = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(two, x), y), cy);
+				x = x_temp;
+			}
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), counts);
+			_mm256_storeu_ps(magnitudes + i, magnitude);
+		}
+
+		iterate_sse2(x0 + i, y0, count - i, threshold, bailout, out + i, magnitudes + i);
+	}
+
+	TARGET_AVX512
+	void iterate_avx512(const float *x0, float y0, int count, int threshold, float bailout, int *out, float *magnitudes) {
+
+		const __m512 limit = _mm512_set1_ps(bailout);
+		const __m512 two = _mm512_set1_ps(2.0f);
+		const __m512 cy = _mm512_set1_ps(y0);
+		const __m512i one = _mm512_set1_epi32(1);
+
+		int i = 0;
+		for (; i + 16 <= count; i += 16) {
+
+			__m512 cx = _mm512_loadu_ps(x0 + i);
+			__m512 x = _mm512_setzero_ps();
+			__m512 y = _mm512_setzero_ps();
+			__mmask16 active = 0xFFFF;
+			__m512i counts = _mm512_setzero_si512();
+			__m512 magnitude = _mm512_setzero_ps();
+
+			for (int n = 0; n < threshold; n++) {
+
+				__m512 xx = _mm512_mul_ps(x, x);
+				__m512 yy = _mm512_mul_ps(y, y);
+				__m512 m = _mm512_add_ps(xx, yy);
+
+				magnitude = _mm512_mask_mov_ps(magnitude, active, m);
+
+				active = _mm512_mask_cmp_ps_mask(active, m, limit, _CMP_LT_OQ);
+				if (active == 0)
+					break;
+
+				counts = _mm512_mask_add_epi32(counts, active, counts, one);
+
+				__m512 x_temp = _mm512_add_ps(_mm512_sub_ps(xx, yy), cx);
+				y = _mm512_add_ps(_mm512_mul_ps(_mm512_mul_ps(two, x), y), cy);
+				x = x_temp;
+			}
+
+			_mm512_storeu_si512(out + i, counts);
+			_mm512_storeu_ps(magnitudes + i, magnitude);
+		}
+
+		// The tail is at most 15 wide, and anything with avx512f also has avx2
+		iterate_avx2(x0 + i, y0, count - i, threshold, bailout, out + i, magnitudes + i);
+	}
+
+#endif
+
+}
+
+
+CPURenderer::CPURenderer() {
+}
+
+CPURenderer::~CPURenderer() {
+}
+
+bool CPURenderer::init() {
+
+	simd = detect_simd();
+	pool.reset(new ThreadPool());
+
+	std::cout << "CPU renderer using " << simd_name(simd) << " across "
+		<< pool->size() << " threads" << std::endl;
+
+	return true;
+}
+
+bool CPURenderer::create_image_buffer(sf::Vector2i size, sf::Vector2f position) {
+
+	create_pixel_buffer(size);
+
+	texture.reset(new sf::Texture);
+	if (!texture->create(size.x, size.y)) {
+		std::cout << "Failed creating the CPU renderer texture" << std::endl;
+		return false;
+	}
+
+	sprite.setTexture(*texture, true);
+	sprite.setPosition(position);
+
+	return true;
+}
+
+void CPURenderer::create_pixel_buffer(sf::Vector2i size) {
+
+	image_size = size;
+	pixels.assign(static_cast<size_t>(size.x) * size.y * 4, 0);
+	iterations.assign(static_cast<size_t>(size.x) * size.y, 0);
+	texture.reset();
+}
+
+void CPURenderer::run_kernel(sf::Vector4f range, sf::Vector2i work_size, int max_iterations, float escape_radius_squared) {
+
+	int tiles_x = (work_size.x + TILE_SIZE - 1) / TILE_SIZE;
+	int tiles_y = (work_size.y + TILE_SIZE - 1) / TILE_SIZE;
+
+	pool->parallel_for(tiles_x * tiles_y, [&](int tile_index) {
+		render_tile(tile_index, range, work_size, max_iterations, escape_radius_squared);
+	});
+}
+
+void CPURenderer::set_pixels(std::vector<sf::Uint8> pixels) {
+
+	this->pixels = std::move(pixels);
+
+	if (texture)
+		texture->update(this->pixels.data());
+}
+
+void CPURenderer::draw(sf::RenderWindow *window) {
+
+	if (texture)
+		window->draw(sprite);
+}
+
+void CPURenderer::render_tile(int tile_index, sf::Vector4f range, sf::Vector2i work_size, int max_iterations, float escape_radius_squared) {
+
+	int tiles_x = (work_size.x + TILE_SIZE - 1) / TILE_SIZE;
+
+	int start_x = (tile_index % tiles_x) * TILE_SIZE;
+	int start_y = (tile_index / tiles_x) * TILE_SIZE;
+	int end_x = std::min(start_x + TILE_SIZE, work_size.x);
+	int end_y = std::min(start_y + TILE_SIZE, work_size.y);
+	int width = end_x - start_x;
+
+	float x0[TILE_SIZE];
+	int counts[TILE_SIZE];
+	float magnitudes[TILE_SIZE];
+
+	for (int x = 0; x < width; x++)
+		x0[x] = scale(static_cast<float>(start_x + x), 0, static_cast<float>(work_size.x), range.x, range.y);
+
+	for (int y_pixel = start_y; y_pixel < end_y; y_pixel++) {
+
+		float y0 = scale(static_cast<float>(y_pixel), 0, static_cast<float>(work_size.y), range.z, range.w);
+
+		switch (simd) {
+#ifdef CPU_RENDERER_X86
+		case AVX512:
+			iterate_avx512(x0, y0, width, max_iterations, escape_radius_squared, counts, magnitudes);
+			break;
+		case AVX2:
+			iterate_avx2(x0, y0, width, max_iterations, escape_radius_squared, counts, magnitudes);
+			break;
+		case SSE2:
+			iterate_sse2(x0, y0, width, max_iterations, escape_radius_squared, counts, magnitudes);
+			break;
+#endif
+		default:
+			iterate_scalar(x0, y0, width, max_iterations, escape_radius_squared, counts, magnitudes);
+			break;
+		}
+
+		uint16_t *packed = &iterations[static_cast<size_t>(y_pixel) * image_size.x + start_x];
+
+		// Points that never escape land on the limit, like the kernels' interior pixels
+		for (int x = 0; x < width; x++)
+			packed[x] = pack_iterations(counts[x], max_iterations, magnitudes[x], escape_radius_squared, ITERATION_FRACTION_BITS);
+	}
+}
+
+CPURenderer::simd_level CPURenderer::detect_simd() {
+
+#if defined(CPU_RENDERER_X86) && (defined(__GNUC__) || defined(__clang__))
+
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f"))
+		return AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return SSE2;
+
+#elif defined(CPU_RENDERER_X86) && defined(_MSC_VER)
+
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+
+	// The OS has to be saving the wider registers on a context switch before we can touch them
+	unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+	bool ymm_state = (xcr0 & 0x6) == 0x6;
+	bool zmm_state = (xcr0 & 0xE6) == 0xE6;
+
+	if (max_leaf >= 7) {
+
+		__cpuidex(info, 7, 0);
+
+		if ((info[1] & (1 << 16)) && zmm_state)
+			return AVX512;
+		if ((info[1] & (1 << 5)) && ymm_state)
+			return AVX2;
+	}
+
+	if (sse2)
+		return SSE2;
+
+#endif
+
+	return SCALAR;
+}
+
+const char* CPURenderer::simd_name(simd_level level) {
+
+	switch (level) {
+	case AVX512:
+		return "AVX-512";
+	case AVX2:
+		return "AVX2";
+	case SSE2:
+		return "SSE2";
+	default:
+		return "scalar";
+	}
+}
@@ -0,0 +1,29 @@
+#include "CameraPath.h"
+
+
+CameraPath::CameraPath(const View &start, const FixedPoint &target_x, const FixedPoint &target_y, double zoom, int frame_count) :
+	start(start), target_x(target_x), target_y(target_y), zoom(zoom), frame_count(frame_count) {
+}
+
+View CameraPath::at(int frame) const {
+
+	double t = frame_count > 1 ? static_cast<double>(frame) / (frame_count - 1) : 0.0;
+	double scale = std::pow(zoom, -t);
+
+	View view = start;
+	view.width = start.width * scale;
+	view.height = start.height * scale;
+	view.fit_precision();
+
+	// Share of the way to the target, the same share of the total shrink done so far
+	double progress = zoom != 1.0 ? (1.0 - scale) / (1.0 - 1.0 / zoom) : t;
+
+	int limbs = view.center_x.get_precision();
+	FixedPoint share(progress, limbs);
+
+	view.center_x = start.center_x + (target_x - start.center_x) * share;
+	view.center_y = start.center_y + (target_y - start.center_y) * share;
+	view.fit_precision();
+
+	return view;
+}
@@ -0,0 +1,603 @@
+#include "Coordinator.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+#endif
+
+
+const double Coordinator::TILE_TIMEOUT = 30.0;
+
+Coordinator::Coordinator() {
+}
+
+Coordinator::~Coordinator() {
+	shutdown();
+}
+
+bool Coordinator::listen(unsigned short port) {
+
+	if (listener.listen(port) != sf::Socket::Done) {
+		std::cout << "Coordinator couldn't listen on port " << port << std::endl;
+		return false;
+	}
+
+	selector.add(listener);
+	return true;
+}
+
+bool Coordinator::spawn_workers(const std::string &executable, int count, const std::vector<std::string> &arguments) {
+
+	std::string address = "127.0.0.1:" + std::to_string(get_port());
+
+	for (int i = 0; i < count; i++) {
+
+#ifdef _WIN32
+		std::string command = "\"" + executable + "\" --worker " + address;
+		for (const std::string &argument : arguments)
+			command += " \"" + argument + "\"";
+
+		STARTUPINFOA startup;
+		PROCESS_INFORMATION process;
+		ZeroMemory(&startup, sizeof(startup));
+		startup.cb = sizeof(startup);
+
+		if (!CreateProcessA(nullptr, &command[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &process)) {
+			std::cout << "Couldn't start worker " << i << " : " << GetLastError() << std::endl;
+			return false;
+		}
+
+		CloseHandle(process.hThread);
+		children.push_back(process.hProcess);
+#else
+		std::vector<std::string> strings = { executable, "--worker", address };
+		strings.insert(strings.end(), arguments.begin(), arguments.end());
+
+		std::vector<char*> argv;
+		for (std::string &s : strings)
+			argv.push_back(&s[0]);
+		argv.push_back(nullptr);
+
+		pid_t pid;
+		int error = posix_spawnp(&pid, executable.c_str(), nullptr, nullptr, argv.data(), environ);
+
+		if (error != 0) {
+			std::cout << "Couldn't start worker " << i << " : error " << error << std::endl;
+			return false;
+		}
+
+		children.push_back(pid);
+#endif
+	}
+
+	return true;
+}
+
+bool Coordinator::wait_for_workers(int count, double timeout_seconds) {
+
+	clock::time_point give_up = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(timeout_seconds));
+
+	while (get_worker_count() < count) {
+
+		if (clock::now() > give_up) {
+			std::cout << "Only " << get_worker_count() << " of " << count << " workers showed up" << std::endl;
+			return false;
+		}
+
+		poll(0.1);
+	}
+
+	return true;
+}
+
+int Coordinator::get_worker_count() const {
+
+	int count = 0;
+	for (const auto &w : workers) {
+		if (w->connected && w->hello)
+			count++;
+	}
+	return count;
+}
+
+void Coordinator::set_escape(int interval, double radius) {
+	escape_interval = interval;
+	escape_radius = radius;
+}
+
+bool Coordinator::render(const View &view, sf::Vector2i resolution, int max_iterations, std::vector<uint16_t> &iterations, int worker_limit) {
+
+	clock::time_point start = clock::now();
+
+	job_id++;
+	job_active = true;
+	job_failed = false;
+	job_iterations = max_iterations;
+	job_worker_limit = worker_limit;
+	job_view = view;
+	job_resolution = resolution;
+	job_limbs = FixedPoint::limbs_for_spacing(view.pixel_spacing(resolution));
+	job_view.center_x.set_precision(job_limbs);
+	job_view.center_y.set_precision(job_limbs);
+
+	iterations.assign(static_cast<size_t>(resolution.x) * resolution.y, 0);
+	frame = &iterations;
+
+	int tiles_x = (resolution.x + TILE_SIZE - 1) / TILE_SIZE;
+	int tiles_y = (resolution.y + TILE_SIZE - 1) / TILE_SIZE;
+
+	tiles.assign(tiles_x * tiles_y, tile());
+	for (int i = 0; i < static_cast<int>(tiles.size()); i++)
+		tiles[i].origin = sf::Vector2i((i % tiles_x) * TILE_SIZE, (i / tiles_x) * TILE_SIZE);
+
+	remaining = static_cast<int>(tiles.size());
+	compute_seconds = 0.0;
+	retries = 0;
+	steals = 0;
+	backups = 0;
+	raw_bytes = 0;
+	wire_bytes = 0;
+
+	std::vector<worker*> active;
+
+	for (auto &w : workers) {
+
+		w->active = w->connected && w->hello && (worker_limit <= 0 || static_cast<int>(active.size()) < worker_limit);
+		w->queue.clear();
+
+		std::string name = w->report.name;
+		w->report = worker_report();
+		w->report.name = name;
+
+		if (w->active) {
+			active.push_back(w.get());
+			configure(*w);
+		}
+	}
+
+	if (active.empty()) {
+		std::cout << "No workers to render with" << std::endl;
+		job_active = false;
+		return false;
+	}
+
+	workers_used = static_cast<int>(active.size());
+
+	// Contiguous runs, so each worker's tiles sit next to each other like ThreadPool's jobs
+	int per_worker = (remaining + workers_used - 1) / workers_used;
+	for (int i = 0; i < remaining; i++)
+		active[i / per_worker]->queue.push_back(i);
+
+	while (remaining > 0 && !job_failed) {
+
+		bool any = false;
+		for (auto &w : workers)
+			any = any || (w->active && w->connected);
+
+		if (!any) {
+			std::cout << "Every worker dropped out with " << remaining << " tiles left" << std::endl;
+			job_failed = true;
+			break;
+		}
+
+		dispatch();
+		check_timeouts();
+		poll(0.05);
+	}
+
+	job_active = false;
+	frame = nullptr;
+	render_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+	return !job_failed;
+}
+
+void Coordinator::shutdown() {
+
+	sf::Packet done;
+	done << static_cast<sf::Uint8>(TileProtocol::DONE);
+
+	for (auto &w : workers) {
+		if (w->connected) {
+			w->socket->send(done);
+			drop(*w);
+		}
+	}
+
+	listener.close();
+
+#ifdef _WIN32
+	for (HANDLE child : children) {
+		WaitForSingleObject(child, INFINITE);
+		CloseHandle(child);
+	}
+#else
+	for (pid_t child : children)
+		waitpid(child, nullptr, 0);
+#endif
+
+	children.clear();
+}
+
+std::vector<Coordinator::worker_report> Coordinator::get_reports() const {
+
+	std::vector<worker_report> reports;
+	for (const auto &w : workers) {
+		if (w->active)
+			reports.push_back(w->report);
+	}
+	return reports;
+}
+
+double Coordinator::get_compression() const {
+	return wire_bytes > 0 ? static_cast<double>(raw_bytes) / wire_bytes : 0.0;
+}
+
+double Coordinator::get_efficiency() const {
+
+	if (render_seconds <= 0.0 || workers_used == 0)
+		return 0.0;
+
+	return compute_seconds / (render_seconds * workers_used);
+}
+
+void Coordinator::poll(double seconds) {
+
+	if (!selector.wait(sf::seconds(static_cast<float>(seconds))))
+		return;
+
+	if (selector.isReady(listener))
+		accept();
+
+	// Receiving can drop a worker but never adds one, accept is done by now
+	for (size_t i = 0; i < workers.size(); i++) {
+		worker &w = *workers[i];
+		if (w.connected && selector.isReady(*w.socket))
+			receive(w);
+	}
+}
+
+void Coordinator::accept() {
+
+	std::unique_ptr<worker> w(new worker);
+	w->socket.reset(new sf::TcpSocket);
+
+	if (listener.accept(*w->socket) != sf::Socket::Done)
+		return;
+
+	selector.add(*w->socket);
+	workers.push_back(std::move(w));
+}
+
+void Coordinator::receive(worker &w) {
+
+	sf::Packet packet;
+	sf::Socket::Status status = w.socket->receive(packet);
+
+	if (status == sf::Socket::NotReady || status == sf::Socket::Partial)
+		return;
+
+	if (status != sf::Socket::Done) {
+		std::cout << "Lost worker " << w.report.name << std::endl;
+		drop(w);
+		return;
+	}
+
+	TileProtocol::message type;
+	if (!TileProtocol::read_type(packet, type))
+		return;
+
+	if (type == TileProtocol::HELLO) {
+
+		packet >> w.report.name;
+		w.hello = true;
+
+		// Joining a job already under way, it only gets tiles by stealing them
+		if (job_active && job_worker_limit <= 0) {
+			w.active = true;
+			workers_used++;
+			configure(w);
+		}
+	}
+	else if (type == TileProtocol::READY) {
+
+		std::string device;
+		if (packet >> device)
+			w.report.name = device;
+
+		w.ready = true;
+	}
+	else if (type == TileProtocol::RESULT) {
+		handle_result(w, packet);
+	}
+}
+
+void Coordinator::handle_result(worker &w, sf::Packet &packet) {
+
+	sf::Uint32 job, index;
+	bool ok;
+	double seconds;
+	std::string data;
+
+	if (!(packet >> job >> index >> ok >> seconds >> data))
+		return;
+
+	auto sent = std::find_if(w.sent.begin(), w.sent.end(), [&](const sent_tile &s) {
+		return s.job == job && s.tile == static_cast<int>(index);
+	});
+
+	// Erasing invalidates `sent`, remember whether there was one first
+	bool was_sent = sent != w.sent.end();
+	if (was_sent)
+		w.sent.erase(sent);
+
+	// Late copies of tiles from an earlier render, or of one a backup already delivered
+	if (!job_active || job != job_id || index >= tiles.size())
+		return;
+
+	tile &t = tiles[index];
+	if (was_sent)
+		t.copies--;
+
+	if (t.done)
+		return;
+
+	std::vector<uint16_t> counts;
+	if (!ok || !TileProtocol::decompress(data, TILE_SIZE * TILE_SIZE, counts)) {
+		w.report.failed++;
+		if (t.copies == 0)
+			retry(index, &w);
+		return;
+	}
+
+	int width = std::min(static_cast<int>(TILE_SIZE), job_resolution.x - t.origin.x);
+	int height = std::min(static_cast<int>(TILE_SIZE), job_resolution.y - t.origin.y);
+
+	for (int y = 0; y < height; y++) {
+		std::copy(
+			counts.begin() + y * TILE_SIZE,
+			counts.begin() + y * TILE_SIZE + width,
+			frame->begin() + static_cast<size_t>(t.origin.y + y) * job_resolution.x + t.origin.x);
+	}
+
+	t.done = true;
+	remaining--;
+
+	w.report.tiles++;
+	w.report.busy_seconds += seconds;
+	compute_seconds += seconds;
+
+	raw_bytes += counts.size() * sizeof(uint16_t);
+	wire_bytes += data.size();
+}
+
+void Coordinator::configure(worker &w) {
+
+	if (w.tile_size == TILE_SIZE && w.max_iterations == job_iterations &&
+		w.escape_interval == escape_interval && w.escape_radius == escape_radius)
+		return;
+
+	sf::Packet config;
+	config << static_cast<sf::Uint8>(TileProtocol::CONFIG) << static_cast<sf::Int32>(TILE_SIZE) << static_cast<sf::Int32>(job_iterations)
+		<< static_cast<sf::Int32>(escape_interval) << escape_radius;
+
+	if (w.socket->send(config) != sf::Socket::Done) {
+		drop(w);
+		return;
+	}
+
+	w.ready = false;
+	w.tile_size = TILE_SIZE;
+	w.max_iterations = job_iterations;
+	w.escape_interval = escape_interval;
+	w.escape_radius = escape_radius;
+}
+
+void Coordinator::dispatch() {
+
+	for (auto &w : workers) {
+
+		if (!w->active || !w->connected || !w->ready)
+			continue;
+
+		while (w->sent.size() < MAX_IN_FLIGHT) {
+
+			int index = next_tile(*w);
+			if (index < 0 || !send_tile(*w, index))
+				break;
+		}
+	}
+}
+
+int Coordinator::next_tile(worker &w) {
+
+	while (!w.queue.empty()) {
+		int index = w.queue.front();
+		w.queue.pop_front();
+		if (!tiles[index].done)
+			return index;
+	}
+
+	// Steal from the back of the longest run, that's the work its owner would get to last.
+	// Tiles a retry or backup already delivered are dropped on the way, they're no steal
+	while (true) {
+
+		worker* victim = nullptr;
+		for (auto &other : workers) {
+			if (other.get() != &w && !other->queue.empty() && (!victim || other->queue.size() > victim->queue.size()))
+				victim = other.get();
+		}
+
+		if (!victim)
+			break;
+
+		while (!victim->queue.empty()) {
+			int index = victim->queue.back();
+			victim->queue.pop_back();
+
+			if (!tiles[index].done) {
+				w.report.stolen++;
+				steals++;
+				return index;
+			}
+		}
+	}
+
+	// Nothing queued anywhere, back up the tile that has been out the longest
+	int oldest = -1;
+	clock::time_point oldest_time = clock::time_point::max();
+
+	for (auto &other : workers) {
+
+		if (other.get() == &w)
+			continue;
+
+		for (const sent_tile &s : other->sent) {
+			if (s.job == job_id && !tiles[s.tile].done && !tiles[s.tile].backed_up && s.sent < oldest_time) {
+				oldest = s.tile;
+				oldest_time = s.sent;
+			}
+		}
+	}
+
+	if (oldest >= 0) {
+		tiles[oldest].backed_up = true;
+		backups++;
+	}
+
+	return oldest;
+}
+
+bool Coordinator::send_tile(worker &w, int index) {
+
+	tile &t = tiles[index];
+
+	double x_step = job_view.width / job_resolution.x;
+	double y_step = job_view.height / job_resolution.y;
+
+	// The escape kernels sample pixel corners, so a tile centred here starts on the frame's pixel grid
+	double offset_x = (t.origin.x + TILE_SIZE * 0.5 - job_resolution.x * 0.5) * x_step;
+	double offset_y = (t.origin.y + TILE_SIZE * 0.5 - job_resolution.y * 0.5) * y_step;
+
+	FixedPoint center_x = job_view.center_x + FixedPoint(offset_x, job_limbs);
+	FixedPoint center_y = job_view.center_y + FixedPoint(offset_y, job_limbs);
+
+	// A limb is a little over 9.6 decimal digits
+	int digits = static_cast<int>(std::ceil(job_limbs * 32 * 0.30103)) + 2;
+
+	sf::Packet packet;
+	packet << static_cast<sf::Uint8>(TileProtocol::TILE) << job_id << static_cast<sf::Uint32>(index)
+		<< center_x.to_string(digits) << center_y.to_string(digits)
+		<< TILE_SIZE * x_step << TILE_SIZE * y_step;
+
+	if (w.socket->send(packet) != sf::Socket::Done) {
+		// The tile was never out, so it doesn't count as an attempt
+		w.queue.push_front(index);
+		drop(w);
+		return false;
+	}
+
+	sent_tile s;
+	s.job = job_id;
+	s.tile = index;
+	s.sent = clock::now();
+
+	w.sent.push_back(s);
+	t.copies++;
+
+	return true;
+}
+
+void Coordinator::retry(int index, const worker *from) {
+
+	tile &t = tiles[index];
+
+	if (++t.attempts >= MAX_ATTEMPTS) {
+		std::cout << "Tile " << index << " failed " << t.attempts << " times, giving up" << std::endl;
+		job_failed = true;
+		return;
+	}
+
+	retries++;
+	t.backed_up = false;
+
+	// The least loaded worker besides the one that failed it, unless that's all there is
+	worker* target = nullptr;
+	for (auto &w : workers) {
+
+		if (!w->active || !w->connected)
+			continue;
+
+		if (!target) {
+			target = w.get();
+			continue;
+		}
+
+		bool other = w.get() != from;
+		bool target_other = target != from;
+
+		if (other != target_other ? other : w->queue.size() + w->sent.size() < target->queue.size() + target->sent.size())
+			target = w.get();
+	}
+
+	// Nobody left, render() notices and gives up
+	if (target)
+		target->queue.push_front(index);
+}
+
+void Coordinator::check_timeouts() {
+
+	clock::time_point now = clock::now();
+
+	for (auto &w : workers) {
+		for (sent_tile &s : w->sent) {
+			if (s.job == job_id && !s.timed_out && !tiles[s.tile].done &&
+				std::chrono::duration<double>(now - s.sent).count() > TILE_TIMEOUT) {
+				s.timed_out = true;
+				w->report.failed++;
+				retry(s.tile, w.get());
+			}
+		}
+	}
+}
+
+void Coordinator::drop(worker &w) {
+
+	if (!w.connected)
+		return;
+
+	w.connected = false;
+	w.ready = false;
+	selector.remove(*w.socket);
+	w.socket->disconnect();
+
+	if (!job_active)
+		return;
+
+	std::vector<sent_tile> sent;
+	sent.swap(w.sent);
+
+	std::deque<int> queue;
+	queue.swap(w.queue);
+
+	// Whatever was out on it failed, whatever it hadn't got to yet just moves
+	for (const sent_tile &s : sent) {
+		if (s.job == job_id && !tiles[s.tile].done && --tiles[s.tile].copies == 0)
+			retry(s.tile, &w);
+	}
+
+	for (int index : queue) {
+		worker* target = nullptr;
+		for (auto &other : workers) {
+			if (other->active && other->connected && (!target || other->queue.size() < target->queue.size()))
+				target = other.get();
+		}
+		if (target)
+			target->queue.push_back(index);
+	}
+}
@@ -0,0 +1,321 @@
+#include "FixedPoint.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+
+
+FixedPoint::FixedPoint() : FixedPoint(0.0) {
+}
+
+FixedPoint::FixedPoint(double value, int fraction_limbs) : fraction_limbs(fraction_limbs) {
+
+	limbs.assign(fraction_limbs + 1, 0);
+
+	negative = value < 0;
+	double magnitude = std::abs(value);
+
+	double integer_part = std::floor(magnitude);
+	limbs[fraction_limbs] = static_cast<uint32_t>(integer_part);
+	magnitude -= integer_part;
+
+	// Peel 32 bits of the fraction off at a time, a double runs out after the second limb
+	for (int i = fraction_limbs - 1; i >= 0 && magnitude > 0; i--) {
+		magnitude *= 4294967296.0;
+		double limb = std::floor(magnitude);
+		limbs[i] = static_cast<uint32_t>(limb);
+		magnitude -= limb;
+	}
+
+	if (is_zero())
+		negative = false;
+}
+
+bool FixedPoint::from_string(const std::string &value, int fraction_limbs, FixedPoint &result) {
+
+	// Past this the point is nowhere near anything the limbs can hold
+	const int MAX_EXPONENT = 100000;
+
+	size_t i = 0;
+	bool negative = false;
+
+	if (i < value.size() && (value[i] == '-' || value[i] == '+')) {
+		negative = value[i] == '-';
+		i++;
+	}
+
+	// Every mantissa digit, and how many of them come before the point
+	std::string digits;
+	int point = -1;
+
+	for (; i < value.size(); i++) {
+		if (isdigit(static_cast<unsigned char>(value[i])))
+			digits += value[i];
+		else if (value[i] == '.' && point < 0)
+			point = static_cast<int>(digits.size());
+		else
+			break;
+	}
+
+	if (digits.empty())
+		return false;
+
+	if (point < 0)
+		point = static_cast<int>(digits.size());
+
+	if (i < value.size() && (value[i] == 'e' || value[i] == 'E')) {
+
+		i++;
+
+		bool exponent_negative = false;
+		if (i < value.size() && (value[i] == '-' || value[i] == '+')) {
+			exponent_negative = value[i] == '-';
+			i++;
+		}
+
+		size_t exponent_start = i;
+		int exponent = 0;
+
+		for (; i < value.size() && isdigit(static_cast<unsigned char>(value[i])); i++)
+			exponent = std::min(exponent * 10 + (value[i] - '0'), MAX_EXPONENT);
+
+		if (i == exponent_start)
+			return false;
+
+		point += exponent_negative ? -exponent : exponent;
+	}
+
+	if (i != value.size())
+		return false;
+
+	// Move the point, padding with zeros wherever it lands outside the digits
+	std::string integer;
+	std::string fraction;
+
+	if (point <= 0) {
+		fraction = std::string(-point, '0') + digits;
+	}
+	else if (point >= static_cast<int>(digits.size())) {
+		integer = digits + std::string(point - digits.size(), '0');
+	}
+	else {
+		integer = digits.substr(0, point);
+		fraction = digits.substr(point);
+	}
+
+	uint64_t integer_part = 0;
+	for (char digit : integer) {
+		integer_part = integer_part * 10 + (digit - '0');
+		if (integer_part > UINT32_MAX)
+			return false;
+	}
+
+	result = FixedPoint(0.0, fraction_limbs);
+
+	// Horner's scheme from the last digit back, x = (x + d) / 10
+	for (auto digit = fraction.rbegin(); digit != fraction.rend(); ++digit) {
+		result.limbs[fraction_limbs] += static_cast<uint32_t>(*digit - '0');
+		result.divide_magnitude(10);
+	}
+
+	result.limbs[fraction_limbs] = static_cast<uint32_t>(integer_part);
+	result.negative = negative && !result.is_zero();
+
+	return true;
+}
+
+double FixedPoint::to_double() const {
+
+	double value = 0.0;
+	double weight = 1.0;
+
+	for (int i = fraction_limbs; i >= 0; i--) {
+		value += limbs[i] * weight;
+		weight /= 4294967296.0;
+	}
+
+	return negative ? -value : value;
+}
+
+std::string FixedPoint::to_string(int decimal_digits) const {
+
+	std::string out = negative ? "-" : "";
+	out += std::to_string(limbs[fraction_limbs]);
+	out += ".";
+
+	// Multiply the fraction by ten, whatever carries out of the top is the next digit
+	std::vector<uint32_t> fraction(limbs.begin(), limbs.begin() + fraction_limbs);
+
+	for (int d = 0; d < decimal_digits; d++) {
+
+		uint64_t carry = 0;
+		for (auto &&limb : fraction) {
+			uint64_t v = static_cast<uint64_t>(limb) * 10 + carry;
+			limb = static_cast<uint32_t>(v);
+			carry = v >> 32;
+		}
+
+		out += static_cast<char>('0' + carry);
+	}
+
+	return out;
+}
+
+void FixedPoint::set_precision(int fraction_limbs) {
+
+	if (fraction_limbs == this->fraction_limbs)
+		return;
+
+	std::vector<uint32_t> resized(fraction_limbs + 1, 0);
+
+	// Line the integer limbs up, and copy as much of the fraction as fits
+	for (int i = 0; i <= std::min(fraction_limbs, this->fraction_limbs); i++)
+		resized[fraction_limbs - i] = limbs[this->fraction_limbs - i];
+
+	limbs = resized;
+	this->fraction_limbs = fraction_limbs;
+
+	if (is_zero())
+		negative = false;
+}
+
+int FixedPoint::limbs_for_spacing(double spacing) {
+
+	if (spacing <= 0)
+		return DEFAULT_FRACTION_LIMBS;
+
+	// 64 guard bits so rounding in the orbit never reaches the pixel level
+	int bits = static_cast<int>(std::ceil(-std::log2(spacing))) + 64;
+	return std::max(DEFAULT_FRACTION_LIMBS, (bits + 31) / 32);
+}
+
+FixedPoint FixedPoint::operator-() const {
+
+	FixedPoint result = *this;
+	result.negative = !negative && !is_zero();
+	return result;
+}
+
+FixedPoint FixedPoint::operator+(const FixedPoint &rhs) const {
+	return add_signed(*this, rhs, false);
+}
+
+FixedPoint FixedPoint::operator-(const FixedPoint &rhs) const {
+	return add_signed(*this, rhs, true);
+}
+
+FixedPoint& FixedPoint::operator+=(const FixedPoint &rhs) {
+	*this = add_signed(*this, rhs, false);
+	return *this;
+}
+
+FixedPoint& FixedPoint::operator-=(const FixedPoint &rhs) {
+	*this = add_signed(*this, rhs, true);
+	return *this;
+}
+
+FixedPoint FixedPoint::operator*(const FixedPoint &rhs) const {
+
+	int precision = std::max(fraction_limbs, rhs.fraction_limbs);
+
+	FixedPoint a = *this;
+	FixedPoint b = rhs;
+	a.set_precision(precision);
+	b.set_precision(precision);
+
+	size_t n = a.limbs.size();
+	std::vector<uint64_t> product(n * 2, 0);
+
+	// Schoolbook, the operands are only a handful of limbs
+	for (size_t i = 0; i < n; i++) {
+
+		uint64_t carry = 0;
+		for (size_t j = 0; j < n; j++) {
+			uint64_t v = static_cast<uint64_t>(a.limbs[i]) * b.limbs[j] + product[i + j] + carry;
+			product[i + j] = v & 0xFFFFFFFF;
+			carry = v >> 32;
+		}
+		product[i + n] += carry;
+	}
+
+	// The product has 2 * precision fraction limbs, drop the low half
+	FixedPoint result(0.0, precision);
+	for (size_t i = 0; i < n; i++)
+		result.limbs[i] = static_cast<uint32_t>(product[i + precision]);
+
+	result.negative = (a.negative != b.negative) && !result.is_zero();
+	return result;
+}
+
+bool FixedPoint::is_zero() const {
+
+	for (auto &&limb : limbs) {
+		if (limb != 0)
+			return false;
+	}
+	return true;
+}
+
+int FixedPoint::compare_magnitude(const FixedPoint &a, const FixedPoint &b) {
+
+	for (int i = static_cast<int>(a.limbs.size()) - 1; i >= 0; i--) {
+		if (a.limbs[i] != b.limbs[i])
+			return a.limbs[i] < b.limbs[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+FixedPoint FixedPoint::add_signed(const FixedPoint &lhs, const FixedPoint &rhs, bool negate_b) {
+
+	int precision = std::max(lhs.fraction_limbs, rhs.fraction_limbs);
+
+	FixedPoint a = lhs;
+	FixedPoint b = rhs;
+	a.set_precision(precision);
+	b.set_precision(precision);
+
+	if (negate_b)
+		b.negative = !b.negative;
+
+	FixedPoint result(0.0, precision);
+
+	if (a.negative == b.negative) {
+
+		uint64_t carry = 0;
+		for (size_t i = 0; i < a.limbs.size(); i++) {
+			uint64_t v = static_cast<uint64_t>(a.limbs[i]) + b.limbs[i] + carry;
+			result.limbs[i] = static_cast<uint32_t>(v);
+			carry = v >> 32;
+		}
+		result.negative = a.negative;
+
+	} else {
+
+		// Subtract the smaller magnitude from the larger one and keep the larger ones sign
+		if (compare_magnitude(a, b) < 0)
+			std::swap(a, b);
+
+		int64_t borrow = 0;
+		for (size_t i = 0; i < a.limbs.size(); i++) {
+			int64_t v = static_cast<int64_t>(a.limbs[i]) - b.limbs[i] - borrow;
+			borrow = v < 0 ? 1 : 0;
+			result.limbs[i] = static_cast<uint32_t>(v + (borrow << 32));
+		}
+		result.negative = a.negative;
+	}
+
+	if (result.is_zero())
+		result.negative = false;
+
+	return result;
+}
+
+void FixedPoint::divide_magnitude(uint32_t divisor) {
+
+	uint64_t remainder = 0;
+
+	for (int i = static_cast<int>(limbs.size()) - 1; i >= 0; i--) {
+		uint64_t v = (remainder << 32) | limbs[i];
+		limbs[i] = static_cast<uint32_t>(v / divisor);
+		remainder = v % divisor;
+	}
+}
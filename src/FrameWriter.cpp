@@ -0,0 +1,166 @@
+#include "FrameWriter.h"
+#include <algorithm>
+#include <iostream>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <csignal>
+#endif
+
+
+FrameWriter::FrameWriter() {
+}
+
+FrameWriter::~FrameWriter() {
+	close();
+}
+
+const char* FrameWriter::format_name(format stream_format) {
+	return stream_format == Y4M ? "y4m" : "rgb";
+}
+
+bool FrameWriter::open(std::string path, format stream_format, sf::Vector2i resolution, int fps) {
+
+	this->stream_format = stream_format;
+	this->resolution = resolution;
+
+	if (path == "-") {
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+#else
+		// An encoder closing its end would kill us with SIGPIPE, let the write fail instead
+		signal(SIGPIPE, SIG_IGN);
+#endif
+		file = stdout;
+		owns_file = false;
+	} else {
+		file = fopen(path.c_str(), "wb");
+		owns_file = true;
+	}
+
+	if (!file) {
+		std::cout << "Couldn't open " << path << " for the frames" << std::endl;
+		return false;
+	}
+
+	if (stream_format == Y4M)
+		fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", resolution.x, resolution.y, fps);
+
+	closing = false;
+	failed = false;
+	writer = std::thread(&FrameWriter::writer_loop, this);
+
+	return true;
+}
+
+bool FrameWriter::write(std::vector<sf::Uint8> &&pixels) {
+
+	std::unique_lock<std::mutex> lock(mutex);
+	written.wait(lock, [this] { return failed || frames.size() < MAX_IN_FLIGHT; });
+
+	if (failed)
+		return false;
+
+	frames.push_back(std::move(pixels));
+	queued.notify_one();
+
+	return true;
+}
+
+bool FrameWriter::close() {
+
+	if (!writer.joinable())
+		return !failed;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closing = true;
+	}
+	queued.notify_one();
+	writer.join();
+
+	if (file) {
+		fflush(file);
+		if (owns_file)
+			fclose(file);
+		file = nullptr;
+	}
+
+	return !failed;
+}
+
+void FrameWriter::writer_loop() {
+
+	std::vector<unsigned char> buffer;
+
+	while (true) {
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			queued.wait(lock, [this] { return closing || !frames.empty(); });
+
+			if (frames.empty())
+				return;
+		}
+
+		// Only this thread pops, so the front stays put while it's unlocked
+		buffer.clear();
+		encode(frames.front(), buffer);
+
+		// Blocks for as long as the encoder on the other end of a pipe isn't reading
+		bool ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		frames.pop_front();
+
+		if (!ok) {
+			std::cerr << "Writing a frame failed, the reader may have gone away" << std::endl;
+			failed = true;
+			frames.clear();
+		}
+
+		written.notify_one();
+
+		if (failed)
+			return;
+	}
+}
+
+void FrameWriter::encode(const std::vector<sf::Uint8> &pixels, std::vector<unsigned char> &buffer) const {
+
+	size_t pixel_count = static_cast<size_t>(resolution.x) * resolution.y;
+
+	if (stream_format == RAW_RGB) {
+		buffer.resize(pixel_count * 3);
+		for (size_t i = 0; i < pixel_count; i++) {
+			buffer[i * 3 + 0] = pixels[i * 4 + 0];
+			buffer[i * 3 + 1] = pixels[i * 4 + 1];
+			buffer[i * 3 + 2] = pixels[i * 4 + 2];
+		}
+		return;
+	}
+
+	static const char FRAME_HEADER[] = "FRAME\n";
+	size_t header = sizeof(FRAME_HEADER) - 1;
+
+	buffer.resize(header + pixel_count * 3);
+	std::copy(FRAME_HEADER, FRAME_HEADER + header, buffer.begin());
+
+	unsigned char* y_plane = buffer.data() + header;
+	unsigned char* u_plane = y_plane + pixel_count;
+	unsigned char* v_plane = u_plane + pixel_count;
+
+	// BT.601 limited range, in 8.8 fixed point
+	for (size_t i = 0; i < pixel_count; i++) {
+
+		int r = pixels[i * 4 + 0];
+		int g = pixels[i * 4 + 1];
+		int b = pixels[i * 4 + 2];
+
+		y_plane[i] = static_cast<unsigned char>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+		u_plane[i] = static_cast<unsigned char>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+		v_plane[i] = static_cast<unsigned char>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+	}
+}
@@ -1,46 +1,242 @@
 #include <OpenCL.h>
+#include "Profiler.h"
 #include "util.hpp"
 
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
 
 OpenCL::OpenCL() {
 }
 
 OpenCL::~OpenCL() {
+
+	for (auto &&kernel : variant_map)
+		clReleaseKernel(kernel.second);
+
+	for (auto &&program : program_map)
+		clReleaseProgram(program.second);
 }
 
 void OpenCL::run_kernel(std::string kernel_name, sf::Vector2i work_size) {
+	run_kernel(kernel_name, work_size, sf::Vector2i(0, 0));
+}
+
+void OpenCL::run_kernel(std::string kernel_name, sf::Vector2i work_size, sf::Vector2i work_offset) {
 
 	size_t global_work_size[2] = { static_cast<size_t>(work_size.x), static_cast<size_t>(work_size.y) };
+	size_t global_work_offset[2] = { static_cast<size_t>(work_offset.x), static_cast<size_t>(work_offset.y) };
 
 	cl_kernel kernel = kernel_map.at(kernel_name);
+	cl_event event = nullptr;
 
-	error = clEnqueueAcquireGLObjects(command_queue, 1, &buffer_map.at("viewport_image"), 0, 0, 0);
-	if (vr_assert(error, "clEnqueueAcquireGLObjects"))
+	size_t local_storage[2];
+	const size_t* local_work_size = fit_local_size(kernel_name, global_work_size, local_storage);
+
+	// The frame's image is already acquired, and nobody is waiting on this launch
+	if (pipelined) {
+		error = clEnqueueNDRangeKernel(
+			command_queue, kernel,
+			2, global_work_offset, global_work_size,
+			local_work_size, 0, NULL, profiling_event(&event));
+
+		if (!vr_assert(error, "clEnqueueNDRangeKernel"))
+			track(event, kernel_name, "kernel");
 		return;
+	}
+
+	if (!headless) {
+		error = clEnqueueAcquireGLObjects(command_queue, 1, &buffer_map.at("viewport_image"), 0, 0, profiling_event(&event));
+		if (vr_assert(error, "clEnqueueAcquireGLObjects"))
+			return;
+		track(event, "viewport_image", "acquire");
+	}
 
 	//error = clEnqueueTask(command_queue, kernel, 0, NULL, NULL);
 	error = clEnqueueNDRangeKernel(
 		command_queue, kernel,
-		2, NULL, global_work_size,
-		NULL, 0, NULL, NULL);
+		2, global_work_offset, global_work_size,
+		local_work_size, 0, NULL, profiling_event(&event));
 
 	if (vr_assert(error, "clEnqueueNDRangeKernel"))
 		return;
 
+	track(event, kernel_name, "kernel");
+
 	clFinish(command_queue);
 
+	if (headless)
+		return;
+
 	// What if errors out and gl objects are never released?
-	error = clEnqueueReleaseGLObjects(command_queue, 1, &buffer_map.at("viewport_image"), 0, NULL, NULL);
+	error = clEnqueueReleaseGLObjects(command_queue, 1, &buffer_map.at("viewport_image"), 0, NULL, profiling_event(&event));
 	if (vr_assert(error, "clEnqueueReleaseGLObjects"))
 		return;
 
+	track(event, "viewport_image", "release");
+}
+
+const size_t* OpenCL::fit_local_size(std::string kernel_name, const size_t global_work_size[2], size_t local_work_size[2]) const {
+
+	auto local = local_sizes.find(kernel_name);
+	if (local == local_sizes.end())
+		return NULL;
+
+	local_work_size[0] = static_cast<size_t>(local->second.x);
+	local_work_size[1] = static_cast<size_t>(local->second.y);
+
+	// 1.2 has no partial groups, halve the size until it divides the launch. Coarse passes
+	// and strips end up with narrower groups than the tuned ones
+	for (int d = 0; d < 2; d++) {
+		while (local_work_size[d] > 1 && global_work_size[d] % local_work_size[d] != 0)
+			local_work_size[d] /= 2;
+	}
+
+	return local_work_size;
+}
+
+void OpenCL::track(cl_event event, std::string name, const char* category) {
+
+	if (profiler && event)
+		profiler->add_event(event, name, category);
+}
+
+bool OpenCL::read_image(std::string buffer_name, sf::Vector2i size, std::vector<sf::Uint8> &pixels) {
+
+	size_t origin[3] = { 0, 0, 0 };
+	size_t region[3] = { static_cast<size_t>(size.x), static_cast<size_t>(size.y), 1 };
+
+	pixels.resize(static_cast<size_t>(size.x) * size.y * 4);
+
+	cl_mem image = buffer_map.at(buffer_name);
+
+	if (!headless) {
+		error = clEnqueueAcquireGLObjects(command_queue, 1, &image, 0, 0, 0);
+		if (vr_assert(error, "clEnqueueAcquireGLObjects"))
+			return false;
+	}
+
+	error = clEnqueueReadImage(
+		command_queue, image, CL_TRUE,
+		origin, region, 0, 0,
+		pixels.data(), 0, NULL, NULL);
+
+	if (vr_assert(error, "clEnqueueReadImage"))
+		return false;
+
+	if (!headless) {
+		error = clEnqueueReleaseGLObjects(command_queue, 1, &image, 0, NULL, NULL);
+		if (vr_assert(error, "clEnqueueReleaseGLObjects"))
+			return false;
+	}
+
+	return true;
+}
+
+bool OpenCL::begin_frame(std::string image_name) {
+
+	cl_mem image = buffer_map.at(image_name);
+
+#ifdef GL_FENCES
+	auto fence = draw_fences.find(image_name);
+	if (fence != draw_fences.end()) {
+		glClientWaitSync(fence->second, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		glDeleteSync(fence->second);
+		draw_fences.erase(fence);
+	}
+#else
+	glFinish();
+#endif
+
+	cl_event event = nullptr;
+
+	error = clEnqueueAcquireGLObjects(command_queue, 1, &image, 0, NULL, profiling_event(&event));
+	if (vr_assert(error, "clEnqueueAcquireGLObjects"))
+		return false;
+
+	track(event, image_name, "acquire");
+
+	frame_image = image_name;
+	return true;
+}
+
+bool OpenCL::end_frame() {
+
+	cl_event released;
+
+	error = clEnqueueReleaseGLObjects(command_queue, 1, &buffer_map.at(frame_image), 0, NULL, &released);
+	if (vr_assert(error, "clEnqueueReleaseGLObjects"))
+		return false;
+
+	// Without a flush the queue might sit on the frame until something waits on it
+	clFlush(command_queue);
+
+	if (profiler) {
+		clRetainEvent(released);
+		track(released, frame_image, "release");
+	}
+
+	frames.push_back(std::make_pair(frame_image, released));
+	return true;
+}
+
+bool OpenCL::frame_idle() {
+
+	retire_frames();
+	return frames.empty();
+}
+
+void OpenCL::finish() {
+
+	clFinish(command_queue);
+	retire_frames();
+}
+
+void OpenCL::retire_frames() {
+
+	while (!frames.empty()) {
+
+		cl_int status = CL_QUEUED;
+		error = clGetEventInfo(frames.front().second, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+
+		// A failed frame is never going to complete, drop it along with the rest
+		if (!vr_assert(error, "clGetEventInfo") && status > CL_COMPLETE)
+			return;
+
+		if (status == CL_COMPLETE)
+			shown_image = frames.front().first;
+
+		clReleaseEvent(frames.front().second);
+		frames.pop_front();
+	}
 }
 
 void OpenCL::draw(sf::RenderWindow *window) {
 	
-	for (auto &&i: image_map) {
-		window->draw(i.second.first);
+	if (!pipelined) {
+		for (auto &&i: image_map) {
+			window->draw(i.second.first);
+		}
+		return;
 	}
+
+	retire_frames();
+
+	if (shown_image.empty())
+		return;
+
+	window->draw(image_map.at(shown_image).first);
+
+#ifdef GL_FENCES
+	auto fence = draw_fences.find(shown_image);
+	if (fence != draw_fences.end())
+		glDeleteSync(fence->second);
+
+	draw_fences[shown_image] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+#endif
 }
 
 bool OpenCL::aquire_hardware()
@@ -89,6 +285,11 @@ bool OpenCL::aquire_hardware()
 		}
 	}
 
+	if (device_list.empty()) {
+		std::cout << "None of the OpenCL platforms on this machine have any devices" << std::endl;
+		return false;
+	}
+
 	return true;
 }
 
@@ -151,13 +352,36 @@ bool OpenCL::create_shared_context() {
 
 }
 
+bool OpenCL::create_context() {
+
+	cl_context_properties context_properties[] = {
+		CL_CONTEXT_PLATFORM, (cl_context_properties)platform_id,
+		0
+	};
+
+	context = clCreateContext(
+		context_properties,
+		1,
+		&device_id,
+		nullptr, nullptr,
+		&error
+	);
+
+	if (vr_assert(error, "clCreateContext"))
+		return false;
+
+	return true;
+}
+
 bool OpenCL::create_command_queue() {
 
 	// Command queue requires a context and device id. It can also be a device ID list
 	// as long as the devices reside on the same platform
 	if (context && device_id) {
 
-		command_queue = clCreateCommandQueue(context, device_id, 0, &error);
+		cl_command_queue_properties properties = profiler ? CL_QUEUE_PROFILING_ENABLE : 0;
+
+		command_queue = clCreateCommandQueue(context, device_id, properties, &error);
 		if (vr_assert(error, "clCreateCommandQueue"))
 			return false;
 	
@@ -170,21 +394,108 @@ bool OpenCL::create_command_queue() {
 	return true;
 }
 
+const char* const OpenCL::FAST_MATH_OPTIONS = "-cl-finite-math-only -cl-fast-relaxed-math -cl-unsafe-math-optimizations";
+const char* const OpenCL::BINARY_CACHE_DIRECTORY = "kernel_cache";
+
 bool OpenCL::compile_kernel(std::string kernel_path, std::string kernel_name) {
+	return compile_kernel(kernel_path, kernel_name, FAST_MATH_OPTIONS);
+}
+
+bool OpenCL::compile_kernel(std::string kernel_path, std::string kernel_name, std::string build_options) {
+
+	cl_kernel kernel = get_kernel(kernel_name, kernel_path, build_options);
+	if (!kernel)
+		return false;
+
+	kernel_sources[kernel_name] = std::make_pair(kernel_path, build_options);
+
+	return activate_kernel(kernel_name, kernel);
+}
+
+bool OpenCL::select_variant(std::string kernel_name, const defines &values) {
+
+	auto source = kernel_sources.find(kernel_name);
+	if (source == kernel_sources.end()) {
+		std::cout << "Can't specialize " << kernel_name << ", it was never compiled" << std::endl;
+		return false;
+	}
+
+	// The map keeps the defines sorted, so the same values always give the same options
+	std::string build_options = source->second.second;
+	for (auto &&value : values)
+		build_options += " -D " + value.first + "=" + value.second;
+
+	cl_kernel kernel = get_kernel(kernel_name, source->second.first, build_options);
+	if (!kernel)
+		return false;
+
+	if (kernel_map.count(kernel_name) > 0 && kernel_map.at(kernel_name) == kernel)
+		return true;
+
+	return activate_kernel(kernel_name, kernel);
+}
+
+cl_kernel OpenCL::get_kernel(std::string kernel_name, std::string kernel_path, std::string build_options) {
 
-	const char* source;
-	std::string tmp;
+	std::string key = kernel_name + "\n" + kernel_path + "\n" + build_options;
+
+	auto existing = variant_map.find(key);
+	if (existing != variant_map.end())
+		return existing->second;
+
+	cl_program program = get_program(kernel_path, build_options);
+	if (!program)
+		return nullptr;
+
+	cl_kernel kernel = clCreateKernel(program, kernel_name.c_str(), &error);
+
+	if (vr_assert(error, "clCreateKernel"))
+		return nullptr;
+
+	variant_map[key] = kernel;
+	return kernel;
+}
+
+bool OpenCL::activate_kernel(std::string kernel_name, cl_kernel kernel) {
+
+	kernel_map[kernel_name] = kernel;
+
+	for (auto &&arg : kernel_args[kernel_name]) {
+		if (set_kernel_arg(kernel_name, arg.first, arg.second) < 0)
+			return false;
+	}
+
+	return true;
+}
+
+cl_program OpenCL::get_program(std::string kernel_path, std::string build_options) {
+
+	std::string key = kernel_path + "\n" + build_options;
+
+	auto existing = program_map.find(key);
+	if (existing != program_map.end())
+		return existing->second;
 
 	//Load in the kernel, and c stringify it
-	tmp = read_file(kernel_path);
-	source = tmp.c_str();
+	std::string tmp = read_source(kernel_path);
+	if (tmp.empty())
+		return nullptr;
+
+	std::string cache_path = binary_cache_path(tmp, build_options);
+
+	cl_program program = load_program_binary(cache_path, build_options);
 
+	if (program) {
+		program_map[key] = program;
+		return program;
+	}
 
+	const char* source = tmp.c_str();
 	size_t kernel_source_size = strlen(source);
 
 	// Load the source into CL's data structure
 
-	cl_program program = clCreateProgramWithSource(
+	program = clCreateProgramWithSource(
 		context, 1,
 		&source,
 		&kernel_source_size, &error
@@ -192,12 +503,11 @@ bool OpenCL::compile_kernel(std::string kernel_path, std::string kernel_name) {
 
 	// This is not for compilation, it only loads the source
 	if (vr_assert(error, "clCreateProgramWithSource"))
-		return false;
+		return nullptr;
 
 
 	// Try and build the program
-	// "-cl-finite-math-only -cl-fast-relaxed-math -cl-unsafe-math-optimizations"
-	error = clBuildProgram(program, 1, &device_id, "-cl-finite-math-only -cl-fast-relaxed-math -cl-unsafe-math-optimizations", NULL, NULL);
+	error = clBuildProgram(program, 1, &device_id, build_options.c_str(), NULL, NULL);
 
 	// Check to see if it errored out
 	if (vr_assert(error, "clBuildProgram")) {
@@ -205,25 +515,154 @@ bool OpenCL::compile_kernel(std::string kernel_path, std::string kernel_name) {
 		// Get the size of the queued log
 		size_t log_size;
 		clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-		char *log = new char[log_size];
+		std::vector<char> log(log_size + 1, 0);
 
 		// Grab the log
-		clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+		clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, log_size, log.data(), NULL);
 
-		std::cout << log;
-		return false;
+		std::cout << kernel_path << std::endl << log.data();
+
+		clReleaseProgram(program);
+		return nullptr;
 	}
 
-	// Done initializing the kernel
-	cl_kernel kernel = clCreateKernel(program, kernel_name.c_str(), &error);
+	save_program_binary(program, cache_path);
 
-	if (vr_assert(error, "clCreateKernel"))
-		return false;
+	program_map[key] = program;
+	return program;
+}
 
-	// Do I want these to overlap when repeated??
-	kernel_map[kernel_name] = kernel;
+std::string OpenCL::read_source(std::string kernel_path) {
 
-	return true;
+	std::string text = read_file(kernel_path);
+	if (text.empty())
+		return "";
+
+	size_t slash = kernel_path.find_last_of("/\\");
+	std::string directory = slash == std::string::npos ? "" : kernel_path.substr(0, slash + 1);
+
+	const std::string directive = "#include \"";
+
+	std::stringstream lines(text);
+	std::string source;
+	std::string line;
+
+	while (std::getline(lines, line)) {
+
+		size_t end = line.compare(0, directive.size(), directive) == 0 ? line.find('"', directive.size()) : std::string::npos;
+
+		if (end == std::string::npos) {
+			source += line + "\n";
+			continue;
+		}
+
+		std::string header = read_source(directory + line.substr(directive.size(), end - directive.size()));
+		if (header.empty())
+			return "";
+
+		source += header;
+	}
+
+	return source;
+}
+
+std::string OpenCL::binary_cache_path(const std::string &source, const std::string &build_options) {
+
+	char driver_version[256] = { 0 };
+	clGetDeviceInfo(device_id, CL_DRIVER_VERSION, sizeof(driver_version) - 1, driver_version, nullptr);
+
+	device d(device_id, platform_id);
+
+	// FNV-1a over every part, each one followed by its length so they can't run together
+	uint64_t hash = 14695981039346656037ull;
+
+	auto mix = [&hash](const void* data, size_t size) {
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		uint64_t length = size;
+		for (int i = 0; i < 8; i++) {
+			hash ^= (length >> (i * 8)) & 0xff;
+			hash *= 1099511628211ull;
+		}
+	};
+
+	mix(&d.getPackedData(), sizeof(device::packed_data));
+	mix(driver_version, strlen(driver_version));
+	mix(build_options.data(), build_options.size());
+	mix(source.data(), source.size());
+
+	std::stringstream path;
+	path << BINARY_CACHE_DIRECTORY << "/" << std::hex << hash << ".bin";
+	return path.str();
+}
+
+cl_program OpenCL::load_program_binary(std::string cache_path, std::string build_options) {
+
+	std::ifstream input_file(cache_path, std::ios::binary | std::ios::in);
+
+	if (!input_file.is_open())
+		return nullptr;
+
+	std::vector<unsigned char> binary((std::istreambuf_iterator<char>(input_file)), std::istreambuf_iterator<char>());
+
+	if (binary.empty())
+		return nullptr;
+
+	const unsigned char* data = binary.data();
+	size_t size = binary.size();
+	cl_int binary_status = CL_SUCCESS;
+
+	cl_program program = clCreateProgramWithBinary(context, 1, &device_id, &size, &data, &binary_status, &error);
+
+	// A binary the driver won't take is just a miss, the source build overwrites it
+	if (error != CL_SUCCESS || binary_status != CL_SUCCESS) {
+		if (program)
+			clReleaseProgram(program);
+		return nullptr;
+	}
+
+	error = clBuildProgram(program, 1, &device_id, build_options.c_str(), NULL, NULL);
+
+	if (error != CL_SUCCESS) {
+		clReleaseProgram(program);
+		return nullptr;
+	}
+
+	return program;
+}
+
+void OpenCL::save_program_binary(cl_program program, std::string cache_path) {
+
+	// Built for the one device, so there's a single binary
+	size_t size = 0;
+	error = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL);
+	if (vr_assert(error, "clGetProgramInfo") || size == 0)
+		return;
+
+	std::vector<unsigned char> binary(size);
+	unsigned char* data = binary.data();
+
+	error = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(data), &data, NULL);
+	if (vr_assert(error, "clGetProgramInfo"))
+		return;
+
+#ifdef _WIN32
+	_mkdir(BINARY_CACHE_DIRECTORY);
+#else
+	mkdir(BINARY_CACHE_DIRECTORY, 0755);
+#endif
+
+	std::ofstream output_file(cache_path, std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
+
+	if (!output_file.is_open()) {
+		std::cout << "Couldn't write the kernel binary " << cache_path << std::endl;
+		return;
+	}
+
+	output_file.write(reinterpret_cast<const char*>(binary.data()), binary.size());
 }
 
 bool OpenCL::create_image_buffer_from_texture(std::string buffer_name, sf::Texture* texture, cl_int access_type) {
@@ -259,6 +698,30 @@ bool OpenCL::create_image_buffer(std::string buffer_name, sf::Vector2i size, sf:
 			image_map.erase(buffer_name);
 	}
 
+	// Without GL there is no texture to back the image, so CL owns the storage and
+	// the caller reads it back with read_image
+	if (headless) {
+
+		cl_image_format format;
+		format.image_channel_order = CL_RGBA;
+		format.image_channel_data_type = CL_UNORM_INT8;
+
+		cl_image_desc desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+		desc.image_width = size.x;
+		desc.image_height = size.y;
+
+		cl_mem buff = clCreateImage(context, access_type, &format, &desc, nullptr, &error);
+
+		if (vr_assert(error, "clCreateImage"))
+			return false;
+
+		store_buffer(buff, buffer_name);
+
+		return true;
+	}
+
 	std::unique_ptr<sf::Texture> texture(new sf::Texture);
 	texture->create(size.x, size.y);
 
@@ -361,8 +824,101 @@ bool OpenCL::release_buffer(std::string buffer_name) {
 	return true;
 }
 
+bool OpenCL::write_buffer(std::string buffer_name, size_t size, const void* data, size_t offset) {
+
+	cl_event event = nullptr;
+
+	error = clEnqueueWriteBuffer(
+		command_queue, buffer_map.at(buffer_name), CL_TRUE,
+		offset, size, data, 0, NULL, profiling_event(&event));
+
+	if (vr_assert(error, "clEnqueueWriteBuffer"))
+		return false;
+
+	track(event, buffer_name, "write");
+
+	return true;
+}
+
+bool OpenCL::read_buffer(std::string buffer_name, size_t size, void* data, size_t offset) {
+
+	cl_event event = nullptr;
+
+	error = clEnqueueReadBuffer(
+		command_queue, buffer_map.at(buffer_name), CL_TRUE,
+		offset, size, data, 0, NULL, profiling_event(&event));
+
+	if (vr_assert(error, "clEnqueueReadBuffer"))
+		return false;
+
+	track(event, buffer_name, "read");
+
+	return true;
+}
+
+bool OpenCL::read_buffer_async(std::string buffer_name, size_t size, void* data) {
+
+	cl_event event = nullptr;
+
+	error = clEnqueueReadBuffer(
+		command_queue, buffer_map.at(buffer_name), CL_FALSE,
+		0, size, data, 0, NULL, profiling_event(&event));
+
+	if (vr_assert(error, "clEnqueueReadBuffer"))
+		return false;
+
+	track(event, buffer_name, "read");
+
+	return true;
+}
+
+std::string OpenCL::get_device_name() {
+
+	char name[256] = { 0 };
+	error = clGetDeviceInfo(device_id, CL_DEVICE_NAME, sizeof(name) - 1, name, nullptr);
+	vr_assert(error, "clGetDeviceInfo");
+
+	return name;
+}
+
+std::string OpenCL::get_platform_name() {
+
+	char name[256] = { 0 };
+	error = clGetPlatformInfo(platform_id, CL_PLATFORM_NAME, sizeof(name) - 1, name, nullptr);
+	vr_assert(error, "clGetPlatformInfo");
+
+	return name;
+}
+
+int OpenCL::get_device_index() const {
+
+	for (size_t i = 0; i < device_list.size(); i++) {
+		if (device_list[i].getDeviceId() == device_id)
+			return static_cast<int>(i);
+	}
+
+	return -1;
+}
+
+bool OpenCL::has_extension(std::string extension) {
+
+	size_t size = 0;
+	error = clGetDeviceInfo(device_id, CL_DEVICE_EXTENSIONS, 0, nullptr, &size);
+	if (vr_assert(error, "clGetDeviceInfo"))
+		return false;
+
+	std::vector<char> extensions(size + 1, 0);
+	error = clGetDeviceInfo(device_id, CL_DEVICE_EXTENSIONS, size, extensions.data(), nullptr);
+	if (vr_assert(error, "clGetDeviceInfo"))
+		return false;
+
+	return std::string(extensions.data()).find(extension) != std::string::npos;
+}
+
 int OpenCL::set_kernel_arg(std::string kernel_name, int index, std::string buffer_name) {
 
+	kernel_args[kernel_name][index] = buffer_name;
+
 	error = clSetKernelArg(
 		kernel_map.at(kernel_name),
 		index,
@@ -377,7 +933,7 @@ int OpenCL::set_kernel_arg(std::string kernel_name, int index, std::string buffe
 	return 1;
 }
 
-bool OpenCL::load_config() {
+bool OpenCL::read_config() {
 
 	std::ifstream input_file("device_config.bin", std::ios::binary | std::ios::in);
 
@@ -386,43 +942,204 @@ bool OpenCL::load_config() {
 		return false;
 	}
 
-	device::packed_data data;
-	input_file.read(reinterpret_cast<char*>(&data), sizeof(data));
+	input_file.read(reinterpret_cast<char*>(&saved_device), sizeof(saved_device));
+
+	// Configs written before tuning existed end right after the device
+	tunings.clear();
+	tuning_entry entry;
+	while (input_file.read(reinterpret_cast<char*>(&entry), sizeof(entry)))
+		tunings.push_back(entry);
+
+	input_file.close();
+	return true;
+}
+
+bool OpenCL::load_config() {
+
+	if (!config_read)
+		return false;
 
 	std::cout << "config loaded, looking for device..." << std::endl;
 
+	bool found = false;
+
 	for (auto d: device_list) {
 		
-		if (memcmp(&d, &data, sizeof(device::packed_data)) == 0) {
+		if (memcmp(&d.getPackedData(), &saved_device, sizeof(device::packed_data)) == 0) {
 			std::cout << "Found saved device" << std::endl;
 			device_id = d.getDeviceId();
 			platform_id = d.getPlatformId();
+			found = true;
 			break;
 		}
 	}
 
-	input_file.close();
-	return true;
+	// A stale config (driver update, card swapped) falls through to device selection
+	return found;
 }
 
 
 void OpenCL::save_config() {
 
+	device d(device_id, platform_id);
+	saved_device = d.getPackedData();
+
+	write_config();
+}
+
+void OpenCL::write_config() {
+
 	std::ofstream output_file;
 	output_file.open("device_config.bin", std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
 
-	device d(device_id, platform_id);
-	d.print_packed_data(output_file);
+	// Without a saved device the entry stays zeroed, which never matches a real one
+	output_file.write(reinterpret_cast<const char*>(&saved_device), sizeof(saved_device));
+
+	for (const tuning_entry &entry : tunings)
+		output_file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
 
 	output_file.close();
 }
 
-bool OpenCL::init() {
+void OpenCL::set_local_size(std::string kernel_name, sf::Vector2i local_size) {
+
+	if (local_size.x <= 0 || local_size.y <= 0)
+		local_sizes.erase(kernel_name);
+	else
+		local_sizes[kernel_name] = local_size;
+}
+
+sf::Vector2i OpenCL::get_local_size(std::string kernel_name) const {
+
+	auto local = local_sizes.find(kernel_name);
+	return local == local_sizes.end() ? sf::Vector2i(0, 0) : local->second;
+}
+
+std::vector<sf::Vector2i> OpenCL::local_size_candidates(std::string kernel_name) {
+
+	cl_kernel kernel = kernel_map.at(kernel_name);
+
+	size_t group_size = 0;
+	size_t multiple = 1;
+	size_t item_sizes[3] = { 0, 0, 0 };
+
+	error = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(group_size), &group_size, nullptr);
+	if (vr_assert(error, "clGetKernelWorkGroupInfo"))
+		return std::vector<sf::Vector2i>();
+
+	error = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(multiple), &multiple, nullptr);
+	if (vr_assert(error, "clGetKernelWorkGroupInfo"))
+		return std::vector<sf::Vector2i>();
+
+	error = clGetDeviceInfo(device_id, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(item_sizes), item_sizes, nullptr);
+	if (vr_assert(error, "clGetDeviceInfo"))
+		return std::vector<sf::Vector2i>();
+
+	// The driver's own pick is always in the running
+	std::vector<sf::Vector2i> candidates(1, sf::Vector2i(0, 0));
+
+	// Groups of 1 to 8 times the preferred multiple. CPU runtimes tend to report a
+	// multiple of 1, groups that small would just measure launch overhead
+	size_t total = std::max(multiple, static_cast<size_t>(1));
+	while (total < 16)
+		total *= 2;
+
+	for (int doubling = 0; doubling < 4 && total <= group_size; doubling++, total *= 2) {
+
+		// Power of two widths, from a column four times taller than wide to a row 16 times wider than tall
+		for (size_t width = 1; width <= total; width *= 2) {
+
+			size_t height = total / width;
+
+			if (total % width != 0 || width > item_sizes[0] || height > item_sizes[1])
+				continue;
+
+			if (height > width * 4 || width > height * 16)
+				continue;
+
+			candidates.push_back(sf::Vector2i(static_cast<int>(width), static_cast<int>(height)));
+		}
+	}
+
+	return candidates;
+}
+
+bool OpenCL::load_local_size(std::string kernel_name) {
+
+	device d(device_id, platform_id);
+
+	for (const tuning_entry &entry : tunings) {
+
+		if (memcmp(&entry.device_data, &d.getPackedData(), sizeof(device::packed_data)) != 0)
+			continue;
+
+		if (strncmp(entry.kernel_name, kernel_name.c_str(), sizeof(entry.kernel_name)) != 0)
+			continue;
+
+		set_local_size(kernel_name, sf::Vector2i(entry.local_x, entry.local_y));
+		return true;
+	}
+
+	return false;
+}
+
+void OpenCL::save_local_size(std::string kernel_name) {
+
+	device d(device_id, platform_id);
+	sf::Vector2i local_size = get_local_size(kernel_name);
+
+	tuning_entry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.device_data = d.getPackedData();
+	strncpy(entry.kernel_name, kernel_name.c_str(), sizeof(entry.kernel_name) - 1);
+	entry.local_x = local_size.x;
+	entry.local_y = local_size.y;
+
+	// Replace whatever was tuned for this device and kernel before
+	bool replaced = false;
+	for (tuning_entry &existing : tunings) {
+		if (memcmp(&existing.device_data, &entry.device_data, sizeof(device::packed_data)) == 0 &&
+			strncmp(existing.kernel_name, entry.kernel_name, sizeof(entry.kernel_name)) == 0) {
+			existing = entry;
+			replaced = true;
+		}
+	}
+
+	if (!replaced)
+		tunings.push_back(entry);
+
+	write_config();
+}
+
+bool OpenCL::init(bool headless, int device_index) {
 	
+	this->headless = headless;
+
 	if (!aquire_hardware())
 		return false;
 
-	if (!load_config()) {
+	// Tuning results are needed whichever way the device gets picked
+	memset(&saved_device, 0, sizeof(saved_device));
+	config_read = read_config();
+
+	if (device_index >= static_cast<int>(device_list.size())) {
+		std::cout << "There is no device " << device_index << ", only " << device_list.size() << std::endl;
+		return false;
+	}
+
+	if (device_index >= 0) {
+
+		device_id = device_list.at(device_index).getDeviceId();
+		platform_id = device_list.at(device_index).getPlatformId();
+
+	} else if (!load_config() && headless) {
+
+		// Batch jobs have nobody sitting at stdin, take the first device and don't save it
+		std::cout << "No saved device, using device 0 for the headless render" << std::endl;
+		device_id = device_list.at(0).getDeviceId();
+		platform_id = device_list.at(0).getPlatformId();
+
+	} else if (device_id == nullptr) {
 
 		std::cout << "Select a device number which you wish to use" << std::endl;
 		
@@ -437,7 +1154,7 @@ bool OpenCL::init() {
 
 		int selection = -1;
 		
-		while (selection < 0 && selection >= device_list.size()) {
+		while (selection < 0 || selection >= static_cast<int>(device_list.size())) {
 
 			std::cout << "Device which you wish to use : ";
 			std::cin >> selection;
@@ -449,8 +1166,13 @@ bool OpenCL::init() {
 		save_config();
 	}
 
-	if (!create_shared_context())
-		return false;
+	if (headless) {
+		if (!create_context())
+			return false;
+	} else {
+		if (!create_shared_context())
+			return false;
+	}
 	
 	if (!create_command_queue())
 		return false;
@@ -664,6 +1386,9 @@ OpenCL::device::device(cl_device_id device_id, cl_platform_id platform_id) {
 	this->device_id = device_id;
 	this->platform_id = platform_id;
 
+	// Strings don't fill their arrays, zero the rest so the struct compares and hashes the same every run
+	memset(&data, 0, sizeof(data));
+
 	int error = 0;
 	error = clGetPlatformInfo(platform_id, CL_PLATFORM_NAME, 128, (void*)&data.platform_name, nullptr);
 	if (vr_assert(error, "clGetPlatformInfo"))
@@ -0,0 +1,185 @@
+#include "Profiler.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+
+Profiler::Profiler() : origin(clock::now()) {
+}
+
+Profiler::~Profiler() {
+
+	for (pending_event &p : pending)
+		clReleaseEvent(p.event);
+}
+
+long long Profiler::host_now() const {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - origin).count();
+}
+
+void Profiler::add_event(cl_event event, std::string name, std::string category) {
+
+	pending_event p;
+	p.event = event;
+	p.name = name;
+	p.category = category;
+	p.host_enqueued = host_now();
+
+	pending.push_back(p);
+}
+
+void Profiler::add_span(std::string name, clock::time_point start, clock::time_point end) {
+
+	record r;
+	r.name = name;
+	r.category = "host";
+	r.device = false;
+	r.start = std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin).count();
+	r.end = std::chrono::duration_cast<std::chrono::nanoseconds>(end - origin).count();
+	r.queued = r.start;
+	r.submit = r.start;
+
+	add_record(r);
+}
+
+void Profiler::collect() {
+
+	size_t kept = 0;
+
+	for (size_t i = 0; i < pending.size(); i++) {
+
+		pending_event &p = pending[i];
+
+		cl_int status = CL_QUEUED;
+		clGetEventInfo(p.event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+
+		if (status > CL_COMPLETE) {
+			pending[kept++] = p;
+			continue;
+		}
+
+		cl_ulong times[4] = { 0, 0, 0, 0 };
+		const cl_profiling_info info[4] = {
+			CL_PROFILING_COMMAND_QUEUED, CL_PROFILING_COMMAND_SUBMIT,
+			CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END };
+
+		bool valid = status == CL_COMPLETE;
+		for (int t = 0; t < 4 && valid; t++)
+			valid = clGetEventProfilingInfo(p.event, info[t], sizeof(cl_ulong), &times[t], NULL) == CL_SUCCESS;
+
+		clReleaseEvent(p.event);
+
+		// Failed commands and queues without profiling have nothing to show
+		if (!valid)
+			continue;
+
+		if (!calibrated) {
+			device_offset = p.host_enqueued - static_cast<long long>(times[0]);
+			calibrated = true;
+		}
+
+		record r;
+		r.name = p.name;
+		r.category = p.category;
+		r.device = true;
+		r.queued = static_cast<long long>(times[0]) + device_offset;
+		r.submit = static_cast<long long>(times[1]) + device_offset;
+		r.start = static_cast<long long>(times[2]) + device_offset;
+		r.end = static_cast<long long>(times[3]) + device_offset;
+
+		add_record(r);
+	}
+
+	pending.resize(kept);
+}
+
+void Profiler::add_record(const record &r) {
+
+	records.push_back(r);
+	if (records.size() > MAX_RECORDS)
+		records.pop_front();
+
+	rolling &average = averages[r.category + " " + r.name];
+
+	average.busy_ms.push_back((r.end - r.start) / 1e6);
+	average.wait_ms.push_back((r.start - r.queued) / 1e6);
+
+	if (average.busy_ms.size() > ROLLING_SAMPLES) {
+		average.busy_ms.pop_front();
+		average.wait_ms.pop_front();
+	}
+}
+
+bool Profiler::load_font(std::string path) {
+
+	font_loaded = font.loadFromFile(path);
+
+	if (!font_loaded)
+		std::cout << "Couldn't load the profiler font " << path << std::endl;
+
+	return font_loaded;
+}
+
+void Profiler::draw(sf::RenderWindow *window) {
+
+	if (!font_loaded)
+		return;
+
+	// Busy is start to end on the device, wait is how long it sat in the queue before that
+	std::ostringstream text;
+	text << std::fixed << std::setprecision(3);
+	text << "busy ms   wait ms   command\n";
+
+	for (auto &&entry : averages) {
+
+		double busy = 0.0, wait = 0.0;
+		for (size_t i = 0; i < entry.second.busy_ms.size(); i++) {
+			busy += entry.second.busy_ms[i];
+			wait += entry.second.wait_ms[i];
+		}
+
+		size_t samples = std::max(entry.second.busy_ms.size(), static_cast<size_t>(1));
+		text << std::setw(7) << busy / samples << "   " << std::setw(7) << wait / samples << "   " << entry.first << "\n";
+	}
+
+	sf::Text overlay(text.str(), font, 14);
+	overlay.setFillColor(sf::Color::White);
+	overlay.setOutlineColor(sf::Color::Black);
+	overlay.setOutlineThickness(1.0f);
+	overlay.setPosition(8.0f, 8.0f);
+
+	window->draw(overlay);
+}
+
+bool Profiler::write_trace(std::string path) {
+
+	std::ofstream output(path, std::ofstream::out | std::ofstream::trunc);
+
+	if (!output.is_open()) {
+		std::cout << "Couldn't write the trace " << path << std::endl;
+		return false;
+	}
+
+	// Microseconds, the unit trace_event expects. The host and the device get a row each
+	output << std::fixed << std::setprecision(3);
+	output << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	output << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"host\"}},\n";
+	output << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"device\"}}";
+
+	for (const record &r : records) {
+
+		output << ",\n{\"name\": \"" << r.name << "\", \"cat\": \"" << r.category << "\", \"ph\": \"X\""
+			<< ", \"pid\": 1, \"tid\": " << (r.device ? 2 : 1)
+			<< ", \"ts\": " << r.start / 1000.0 << ", \"dur\": " << (r.end - r.start) / 1000.0;
+
+		if (r.device)
+			output << ", \"args\": {\"queued\": " << r.queued / 1000.0 << ", \"submit\": " << r.submit / 1000.0 << "}";
+
+		output << "}";
+	}
+
+	output << "\n]}\n";
+
+	std::cout << "Wrote " << records.size() << " trace events to " << path << std::endl;
+	return true;
+}
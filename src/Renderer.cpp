@@ -0,0 +1,1708 @@
+#include "Renderer.h"
+#include "util.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <complex>
+
+
+const std::string Renderer::KERNEL_DIRECTORY = "../kernels/";
+const char* const Renderer::ITERATION_BUFFERS[2] = { "iterations_0", "iterations_1" };
+const char* const Renderer::VIEWPORT_IMAGES[PIPELINE_IMAGES] = { "viewport_image", "viewport_image_1", "viewport_image_2" };
+const double Renderer::SPLIT_SMOOTHING = 0.25;
+const char* const Renderer::TUNED_KERNELS[2] = { "mandlebrot", "mandlebrot_ds" };
+
+struct TuningView {
+	const char* name;
+	double center_x;
+	double center_y;
+	double width;
+};
+
+// A mix of fast escapes, long orbits near the boundary and divergence between neighbours
+const TuningView TUNING_VIEWS[] = {
+	{ "full set",        -0.75,        0.0,         3.5 },
+	{ "seahorse valley", -0.743644786, 0.131825254, 0.003 },
+	{ "elephant valley", 0.2925,       0.0161,      0.01 },
+};
+
+Renderer::Renderer() {
+}
+
+Renderer::~Renderer() {
+}
+
+bool Renderer::init(sf::Vector2i resolution, bool headless, bool use_cpu, bool pipelined) {
+
+	this->resolution = resolution;
+	this->headless = headless;
+	this->use_cpu = use_cpu;
+
+	// Headless renders read the frame straight back, there is nothing to overlap with
+	this->pipelined = pipelined && !headless && !split;
+
+	if (!this->use_cpu && !(cl.init(headless, device_index) && setup_opencl())) {
+		std::cout << "OpenCL failed to initialize, falling back to the CPU renderer" << std::endl;
+		this->use_cpu = true;
+	}
+
+	if (!this->use_cpu && split)
+		setup_split();
+
+	if (this->use_cpu) {
+
+		this->pipelined = false;
+
+		if (!cpu.init())
+			return false;
+
+		if (headless)
+			cpu.create_pixel_buffer(resolution);
+		else if (!cpu.create_image_buffer(resolution, sf::Vector2f(0, 0)))
+			return false;
+	}
+
+	return true;
+}
+
+std::string Renderer::threshold_option() const {
+	return " -D ITERATION_THRESHOLD=" + std::to_string(max_iterations);
+}
+
+bool Renderer::setup_opencl() {
+
+	// Every kernel that iterates is built around the limit
+	std::string threshold = threshold_option();
+	std::string options = OpenCL::FAST_MATH_OPTIONS + threshold;
+
+	if (!cl.compile_kernel(KERNEL_DIRECTORY + "mandlebrot.cl", "mandlebrot", options))
+		return false;
+
+	// No fast math, it would optimize the error free transforms away
+	if (!cl.compile_kernel(KERNEL_DIRECTORY + "mandlebrot_ds.cl", "mandlebrot_ds", threshold))
+		return false;
+
+	if (!cl.compile_kernel(KERNEL_DIRECTORY + "shift.cl", "shift_iterations"))
+		return false;
+
+	const char* subdivision_kernels[] = { "subdivision_clear", "subdivision_border", "subdivision_decide", "subdivision_fill" };
+	for (const char* kernel : subdivision_kernels) {
+		if (!cl.compile_kernel(KERNEL_DIRECTORY + "mariani_silver.cl", kernel, options))
+			return false;
+	}
+
+	if (!cl.compile_kernel(KERNEL_DIRECTORY + "tiles.cl", "render_tiles", options))
+		return false;
+
+	if (!cl.compile_kernel(KERNEL_DIRECTORY + "colour.cl", "colour_iterations"))
+		return false;
+
+	perturbation_fp64 = cl.has_extension("cl_khr_fp64");
+
+	std::string perturbation_options = options;
+	if (perturbation_fp64)
+		perturbation_options += " -D PERTURBATION_DOUBLE";
+
+	if (!cl.compile_kernel(KERNEL_DIRECTORY + "mandlebrot_perturbation.cl", "mandlebrot_perturbation", perturbation_options))
+		return false;
+
+	if (supersample_samples > 1 && !setup_supersampling())
+		return false;
+
+	// Whatever --tune found for this device on an earlier run
+	for (const char* kernel : TUNED_KERNELS)
+		cl.load_local_size(kernel);
+
+	for (int i = 0; i < (pipelined ? PIPELINE_IMAGES : 1); i++) {
+		if (!cl.create_image_buffer(VIEWPORT_IMAGES[i], resolution, sf::Vector2f(0, 0), CL_MEM_WRITE_ONLY))
+			return false;
+	}
+
+	cl.set_pipelined(pipelined);
+
+	cl.create_buffer("image_res", sizeof(sf::Vector2i), &resolution);
+	cl.create_buffer("range", sizeof(sf::Vector4f), (void*)&range_f, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+	cl.create_buffer("range_ds", sizeof(range_ds), (void*)range_ds, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+
+	cl.set_kernel_arg("mandlebrot", 0, "image_res");
+	cl.set_kernel_arg("mandlebrot", 1, "range");
+
+	cl.set_kernel_arg("mandlebrot_ds", 0, "image_res");
+	cl.set_kernel_arg("mandlebrot_ds", 1, "range_ds");
+
+	// Smooth counts packed into 16 bits, see pack_iterations in the kernels
+	cl_uint iteration_bytes = static_cast<cl_uint>(resolution.x * resolution.y * sizeof(cl_ushort));
+	cl.create_buffer(ITERATION_BUFFERS[0], iteration_bytes, nullptr, CL_MEM_READ_WRITE);
+	cl.create_buffer(ITERATION_BUFFERS[1], iteration_bytes, nullptr, CL_MEM_READ_WRITE);
+	cl.create_buffer("pan_offset", sizeof(sf::Vector2i), (void*)&pan_offset, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+
+	cl.create_buffer("progressive_pass", sizeof(sf::Vector2i), (void*)&progressive_pass, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+
+	cl.create_buffer("interior_stats", sizeof(interior_stats), nullptr, CL_MEM_READ_WRITE);
+
+	cl.set_kernel_arg("mandlebrot", 3, "progressive_pass");
+	cl.set_kernel_arg("mandlebrot", 4, "interior_stats");
+	cl.set_kernel_arg("mandlebrot_ds", 3, "progressive_pass");
+	cl.set_kernel_arg("mandlebrot_ds", 4, "interior_stats");
+
+	// Tiles stop splitting at 8 pixels, so nothing after the first level is under 4 across
+	subdivision_capacity = static_cast<size_t>((resolution.x + 3) / 4) * ((resolution.y + 3) / 4)
+		+ static_cast<size_t>((resolution.x + SUBDIVISION_TILE - 1) / SUBDIVISION_TILE) * ((resolution.y + SUBDIVISION_TILE - 1) / SUBDIVISION_TILE);
+
+	cl_uint tile_bytes = static_cast<cl_uint>(subdivision_capacity * sizeof(sf::Vector4i));
+	cl_uint decision_bytes = static_cast<cl_uint>(subdivision_capacity * sizeof(cl_int));
+
+	cl.create_buffer("subdivision_tiles", tile_bytes, nullptr, CL_MEM_READ_ONLY);
+	cl.create_buffer("subdivision_decisions", decision_bytes, nullptr, CL_MEM_READ_WRITE);
+	cl.create_buffer("subdivision_fill_tiles", tile_bytes, nullptr, CL_MEM_READ_ONLY);
+	cl.create_buffer("subdivision_fill_values", decision_bytes, nullptr, CL_MEM_READ_ONLY);
+
+	cl.set_kernel_arg("subdivision_clear", 0, "image_res");
+
+	cl.set_kernel_arg("subdivision_border", 0, "image_res");
+	cl.set_kernel_arg("subdivision_border", 1, "range");
+	cl.set_kernel_arg("subdivision_border", 3, "subdivision_tiles");
+
+	cl.set_kernel_arg("subdivision_decide", 0, "image_res");
+	cl.set_kernel_arg("subdivision_decide", 2, "subdivision_tiles");
+	cl.set_kernel_arg("subdivision_decide", 3, "subdivision_decisions");
+
+	cl.set_kernel_arg("subdivision_fill", 0, "image_res");
+	cl.set_kernel_arg("subdivision_fill", 1, "range");
+	cl.set_kernel_arg("subdivision_fill", 3, "subdivision_fill_tiles");
+	cl.set_kernel_arg("subdivision_fill", 4, "subdivision_fill_values");
+
+	const cl_uint tile_pixels = TileCache::TILE_SIZE * TileCache::TILE_SIZE;
+
+	cl.create_buffer("tile_origins", MAX_TILE_BATCH * sizeof(sf::Vector4f), nullptr, CL_MEM_READ_ONLY);
+	cl.create_buffer("tile_iterations", MAX_TILE_BATCH * tile_pixels * sizeof(cl_ushort), nullptr, CL_MEM_WRITE_ONLY);
+
+	cl.set_kernel_arg("render_tiles", 0, "tile_origins");
+	cl.set_kernel_arg("render_tiles", 1, "tile_iterations");
+
+	cl.create_buffer("palette", MAX_PALETTE * sizeof(sf::Color), nullptr, CL_MEM_READ_ONLY);
+	cl.create_buffer("colouring", sizeof(sf::Vector4f), (void*)&colouring, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+
+	cl.set_kernel_arg("colour_iterations", 0, "image_res");
+	cl.set_kernel_arg("colour_iterations", 3, "palette");
+	cl.set_kernel_arg("colour_iterations", 4, "colouring");
+
+	cl.set_kernel_arg("shift_iterations", 0, "image_res");
+	cl.set_kernel_arg("shift_iterations", 3, "pan_offset");
+
+	size_t real_size = perturbation_fp64 ? sizeof(double) : sizeof(float);
+
+	glitches.assign(static_cast<size_t>(resolution.x) * resolution.y, 0);
+
+	cl.create_buffer("orbit", static_cast<cl_uint>((max_iterations + 1) * 2 * real_size), nullptr, CL_MEM_READ_ONLY);
+	cl.create_buffer("perturbation_view", static_cast<cl_uint>(4 * real_size), nullptr, CL_MEM_READ_ONLY);
+	cl.create_buffer("perturbation_state", sizeof(cl_int) * 4, nullptr, CL_MEM_READ_ONLY);
+	cl.create_buffer("glitches", static_cast<cl_uint>(glitches.size()), nullptr, CL_MEM_READ_WRITE);
+	cl.create_buffer("series", static_cast<cl_uint>(6 * real_size), nullptr, CL_MEM_READ_ONLY);
+
+	cl.set_kernel_arg("mandlebrot_perturbation", 0, "image_res");
+	cl.set_kernel_arg("mandlebrot_perturbation", 2, "orbit");
+	cl.set_kernel_arg("mandlebrot_perturbation", 3, "perturbation_view");
+	cl.set_kernel_arg("mandlebrot_perturbation", 4, "perturbation_state");
+	cl.set_kernel_arg("mandlebrot_perturbation", 5, "glitches");
+	cl.set_kernel_arg("mandlebrot_perturbation", 6, "series");
+
+	return true;
+}
+
+bool Renderer::setup_supersampling() {
+
+	const char* supersample_kernels[] = { "supersample_mark", "supersample_iterate", "supersample_colour" };
+	for (const char* kernel : supersample_kernels) {
+		if (!cl.compile_kernel(KERNEL_DIRECTORY + "supersample.cl", kernel, OpenCL::FAST_MATH_OPTIONS + threshold_option()))
+			return false;
+	}
+
+	int capacity = resolution.x * resolution.y / SUPERSAMPLE_FRACTION;
+	supersample_settings = sf::Vector4i(supersample_samples, capacity, SUPERSAMPLE_EDGE, 0);
+
+	cl.create_buffer("supersample_settings", sizeof(sf::Vector4i), (void*)&supersample_settings, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+	cl.create_buffer("supersample_marks", static_cast<cl_uint>(capacity * sizeof(cl_uint)), nullptr, CL_MEM_READ_WRITE);
+	cl.create_buffer("supersample_count", sizeof(cl_uint), nullptr, CL_MEM_READ_WRITE);
+	cl.create_buffer("supersample_subsamples", static_cast<cl_uint>(capacity * supersample_samples * sizeof(cl_ushort)), nullptr, CL_MEM_READ_WRITE);
+
+	cl.set_kernel_arg("supersample_mark", 0, "image_res");
+	cl.set_kernel_arg("supersample_mark", 2, "supersample_settings");
+	cl.set_kernel_arg("supersample_mark", 3, "supersample_marks");
+	cl.set_kernel_arg("supersample_mark", 4, "supersample_count");
+
+	cl.set_kernel_arg("supersample_iterate", 0, "image_res");
+	cl.set_kernel_arg("supersample_iterate", 1, "range");
+	cl.set_kernel_arg("supersample_iterate", 2, "supersample_settings");
+	cl.set_kernel_arg("supersample_iterate", 3, "supersample_marks");
+	cl.set_kernel_arg("supersample_iterate", 4, "supersample_count");
+	cl.set_kernel_arg("supersample_iterate", 5, "supersample_subsamples");
+
+	cl.set_kernel_arg("supersample_colour", 0, "image_res");
+	cl.set_kernel_arg("supersample_colour", 2, "supersample_settings");
+	cl.set_kernel_arg("supersample_colour", 3, "supersample_marks");
+	cl.set_kernel_arg("supersample_colour", 4, "supersample_count");
+	cl.set_kernel_arg("supersample_colour", 5, "supersample_subsamples");
+	cl.set_kernel_arg("supersample_colour", 6, "palette");
+	cl.set_kernel_arg("supersample_colour", 7, "colouring");
+
+	return true;
+}
+
+void Renderer::setup_split() {
+
+	split_devices.clear();
+
+	split_device selected;
+	selected.name = get_device_name();
+	split_devices.push_back(std::move(selected));
+
+	int selected_index = cl.get_device_index();
+
+	for (int i = 0; i < cl.get_device_count(); i++) {
+
+		if (i == selected_index)
+			continue;
+
+		split_device helper;
+		helper.cl.reset(new OpenCL());
+
+		if (!helper.cl->init(true, i) || !setup_split_device(*helper.cl)) {
+			std::cout << "Leaving device " << i << " out of the split" << std::endl;
+			continue;
+		}
+
+		helper.name = helper.cl->get_device_name() + " (" + helper.cl->get_platform_name() + ")";
+		split_devices.push_back(std::move(helper));
+	}
+
+	if (split_devices.size() < 2) {
+		std::cout << "No other OpenCL devices to split the frame with" << std::endl;
+		split_devices.clear();
+		return;
+	}
+
+	split_pool.reset(new ThreadPool(static_cast<unsigned int>(split_devices.size())));
+
+	std::cout << "Splitting frames across " << split_devices.size() << " devices" << std::endl;
+	for (const split_device &device : split_devices)
+		std::cout << "  " << device.name << std::endl;
+
+	// The helpers were just built without the escape settings
+	escape_dirty = true;
+
+	balance_split();
+}
+
+bool Renderer::setup_split_device(OpenCL &device) {
+
+	std::string threshold = threshold_option();
+
+	if (!device.compile_kernel(KERNEL_DIRECTORY + "mandlebrot.cl", "mandlebrot", OpenCL::FAST_MATH_OPTIONS + threshold))
+		return false;
+
+	if (!device.compile_kernel(KERNEL_DIRECTORY + "mandlebrot_ds.cl", "mandlebrot_ds", threshold))
+		return false;
+
+	// The range and pass get written before every launch, the host side storage is the renderer's
+	cl_uint iteration_bytes = static_cast<cl_uint>(resolution.x * resolution.y * sizeof(cl_ushort));
+
+	device.create_buffer("image_res", sizeof(sf::Vector2i), &resolution);
+	device.create_buffer("range", sizeof(sf::Vector4f), nullptr, CL_MEM_READ_ONLY);
+	device.create_buffer("range_ds", sizeof(range_ds), nullptr, CL_MEM_READ_ONLY);
+	device.create_buffer("progressive_pass", sizeof(sf::Vector2i), nullptr, CL_MEM_READ_ONLY);
+	device.create_buffer("iterations", iteration_bytes, nullptr, CL_MEM_READ_WRITE);
+	device.create_buffer("interior_stats", sizeof(interior_stats), nullptr, CL_MEM_READ_WRITE);
+
+	device.set_kernel_arg("mandlebrot", 0, "image_res");
+	device.set_kernel_arg("mandlebrot", 1, "range");
+	device.set_kernel_arg("mandlebrot", 2, "iterations");
+	device.set_kernel_arg("mandlebrot", 3, "progressive_pass");
+	device.set_kernel_arg("mandlebrot", 4, "interior_stats");
+
+	device.set_kernel_arg("mandlebrot_ds", 0, "image_res");
+	device.set_kernel_arg("mandlebrot_ds", 1, "range_ds");
+	device.set_kernel_arg("mandlebrot_ds", 2, "iterations");
+	device.set_kernel_arg("mandlebrot_ds", 3, "progressive_pass");
+	device.set_kernel_arg("mandlebrot_ds", 4, "interior_stats");
+
+	for (const char* kernel : TUNED_KERNELS)
+		device.load_local_size(kernel);
+
+	return true;
+}
+
+void Renderer::balance_split() {
+
+	// Bands start on multiples of the coarsest step, so no progressive block straddles two devices
+	const int alignment = 1 << (REFINEMENT_LEVELS - 1);
+	int units = (resolution.y + alignment - 1) / alignment;
+	int device_count = static_cast<int>(split_devices.size());
+
+	double total = 0.0;
+	for (const split_device &device : split_devices)
+		total += device.throughput;
+
+	double cumulative = 0.0;
+	int start = 0;
+
+	for (int i = 0; i < device_count; i++) {
+
+		split_device &device = split_devices[i];
+		cumulative += device.throughput;
+
+		// Everyone keeps at least a unit so a slow device still gets measured, unless
+		// there are more devices than units
+		int end = i == device_count - 1 ? units : static_cast<int>(std::round(units * cumulative / total));
+		end = std::min(std::max(end, start + 1), units - (device_count - 1 - i));
+		end = std::max(end, start);
+
+		device.row_start = std::min(start * alignment, resolution.y);
+		device.rows = std::min(end * alignment, resolution.y) - device.row_start;
+		start = end;
+	}
+}
+
+void Renderer::render_split(std::string kernel_name, int step) {
+
+	typedef std::chrono::steady_clock clock;
+
+	const cl_int zero_stats[3] = { 0, 0, 0 };
+	int samples_x = (resolution.x + step - 1) / step;
+
+	split_pool->parallel_for(static_cast<int>(split_devices.size()), [&](int i) {
+
+		split_device &device = split_devices[i];
+		device.seconds = 0.0;
+
+		if (device.rows == 0)
+			return;
+
+		clock::time_point start = clock::now();
+
+		sf::Vector2i samples(samples_x, (device.rows + step - 1) / step);
+		sf::Vector2i offset(0, device.row_start / step);
+
+		if (!device.cl) {
+			cl.run_kernel(kernel_name, samples, offset);
+		} else {
+			OpenCL &helper = *device.cl;
+
+			helper.write_buffer("range", sizeof(range_f), &range_f);
+			helper.write_buffer("range_ds", sizeof(range_ds), range_ds);
+			helper.write_buffer("progressive_pass", sizeof(progressive_pass), &progressive_pass);
+			helper.write_buffer("interior_stats", sizeof(zero_stats), zero_stats);
+
+			helper.run_kernel(kernel_name, samples, offset);
+
+			device.band.resize(static_cast<size_t>(device.rows) * resolution.x);
+			size_t band_offset = static_cast<size_t>(device.row_start) * resolution.x * sizeof(cl_ushort);
+
+			helper.read_buffer("iterations", device.band.size() * sizeof(cl_ushort), device.band.data(), band_offset);
+			helper.read_buffer("interior_stats", sizeof(device.interior_stats), device.interior_stats);
+		}
+
+		device.seconds = std::chrono::duration<double>(clock::now() - start).count();
+	});
+
+	double slowest = 0.0;
+	double fastest_throughput = 0.0;
+
+	for (split_device &device : split_devices) {
+
+		if (device.rows == 0)
+			continue;
+
+		if (device.cl) {
+			size_t band_offset = static_cast<size_t>(device.row_start) * resolution.x * sizeof(cl_ushort);
+			cl.write_buffer(ITERATION_BUFFERS[current_iterations], device.band.size() * sizeof(cl_ushort), device.band.data(), band_offset);
+
+			for (int s = 0; s < 3; s++)
+				split_interior_stats[s] += device.interior_stats[s];
+		}
+
+		slowest = std::max(slowest, device.seconds);
+
+		// Coarse passes are mostly launch overhead, only the full resolution ones say
+		// anything about how fast a device is
+		if (step != 1 || device.seconds <= 0.0)
+			continue;
+
+		double measured = static_cast<double>(device.rows) * resolution.x / device.seconds;
+		device.throughput = device.measured ? device.throughput + (measured - device.throughput) * SPLIT_SMOOTHING : measured;
+		device.measured = true;
+
+		fastest_throughput = std::max(fastest_throughput, device.throughput);
+	}
+
+	if (step == 1 && slowest > 0.0 && fastest_throughput > 0.0)
+		split_scaling = static_cast<double>(resolution.x) * resolution.y / slowest / fastest_throughput;
+}
+
+std::vector<Renderer::device_share> Renderer::get_device_shares() const {
+
+	std::vector<device_share> shares;
+
+	for (const split_device &device : split_devices) {
+		device_share share;
+		share.name = device.name;
+		share.rows = device.rows;
+		share.mpix_per_second = device.measured ? device.throughput / 1e6 : 0.0;
+		shares.push_back(share);
+	}
+
+	return shares;
+}
+
+void Renderer::set_max_iterations(int iterations) {
+
+	if (iterations > MAX_ITERATIONS)
+		std::cout << "Iteration limits past " << MAX_ITERATIONS << " don't fit the packed counts, clamping" << std::endl;
+
+	max_iterations = std::max(1, std::min(iterations, static_cast<int>(MAX_ITERATIONS)));
+}
+
+void Renderer::set_supersampling(int samples) {
+	supersample_samples = samples > 1 ? std::min(samples, static_cast<int>(MAX_SUBSAMPLES)) : 0;
+}
+
+void Renderer::set_escape(int interval, double radius) {
+
+	escape_check_interval = std::max(1, std::min(interval, 4));
+	escape_radius = std::max(2.0, std::min(radius, 16.0));
+	escape_dirty = true;
+}
+
+void Renderer::specialize() {
+
+	OpenCL::defines values;
+	values["IMAGE_WIDTH"] = std::to_string(resolution.x);
+	values["IMAGE_HEIGHT"] = std::to_string(resolution.y);
+	values["ESCAPE_CHECK_INTERVAL"] = std::to_string(escape_check_interval);
+	values["ESCAPE_RADIUS_SQUARED"] = std::to_string(escape_radius * escape_radius) + "f";
+
+	bool selected = cl.select_variant("mandlebrot", values);
+
+	// The rest only take the radius, so every precision, the tile cache and the subsamples
+	// bail out and smooth the same way as the pixels around them
+	OpenCL::defines radius;
+	radius["ESCAPE_RADIUS_SQUARED"] = values["ESCAPE_RADIUS_SQUARED"];
+
+	std::vector<std::string> kernels = {
+		"mandlebrot_ds", "subdivision_clear", "subdivision_border", "subdivision_decide", "subdivision_fill",
+		"render_tiles", "mandlebrot_perturbation"
+	};
+
+	if (supersample_samples > 1)
+		kernels.push_back("supersample_iterate");
+
+	// Only compiled once an exponential map is begun
+	if (strip_columns > 0)
+		kernels.push_back("exponential_map_strip");
+
+	for (const std::string &kernel : kernels)
+		selected = cl.select_variant(kernel, radius) && selected;
+
+	for (split_device &device : split_devices) {
+		if (device.cl) {
+			selected = device.cl->select_variant("mandlebrot", values) && selected;
+			selected = device.cl->select_variant("mandlebrot_ds", radius) && selected;
+		}
+	}
+
+	if (selected)
+		escape_dirty = false;
+}
+
+bool Renderer::tune_local_sizes() {
+
+	if (use_cpu) {
+		std::cout << "Only OpenCL devices have local sizes to tune" << std::endl;
+		return false;
+	}
+
+	typedef std::chrono::steady_clock clock;
+
+	if (escape_dirty)
+		specialize();
+
+	View original_view = view;
+	progressive_pass = sf::Vector2i(1, 0);
+
+	for (const char* kernel : TUNED_KERNELS) {
+
+		std::vector<sf::Vector2i> candidates = cl.local_size_candidates(kernel);
+		if (candidates.empty())
+			return false;
+
+		cl.set_kernel_arg(kernel, 2, ITERATION_BUFFERS[current_iterations]);
+
+		sf::Vector2i best;
+		double best_ms = DBL_MAX;
+
+		for (sf::Vector2i candidate : candidates) {
+
+			cl.set_local_size(kernel, candidate);
+			double total_ms = 0.0;
+
+			for (const TuningView &tuning_view : TUNING_VIEWS) {
+
+				double height = tuning_view.width * resolution.y / resolution.x;
+				view = View::from_range(sf::Vector4d(
+					tuning_view.center_x - tuning_view.width / 2, tuning_view.center_x + tuning_view.width / 2,
+					tuning_view.center_y - height / 2, tuning_view.center_y + height / 2));
+				upload_range();
+
+				// The first launch warms up, the fastest of the rest counts
+				double fastest_ms = DBL_MAX;
+
+				for (int i = 0; i <= TUNING_REPEATS; i++) {
+
+					clock::time_point start = clock::now();
+					cl.run_kernel(kernel, resolution);
+					cl.finish();
+					double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+					if (i > 0)
+						fastest_ms = std::min(fastest_ms, ms);
+				}
+
+				total_ms += fastest_ms;
+			}
+
+			std::cout << kernel << " " << candidate.x << "x" << candidate.y << " : " << total_ms << " ms" << std::endl;
+
+			if (total_ms < best_ms) {
+				best_ms = total_ms;
+				best = candidate;
+			}
+		}
+
+		cl.set_local_size(kernel, best);
+		cl.save_local_size(kernel);
+
+		std::cout << "Tuned " << kernel << " to " << best.x << "x" << best.y
+			<< (best.x == 0 ? " (driver default)" : "") << ", " << best_ms << " ms over the tuning views" << std::endl;
+	}
+
+	view = original_view;
+	invalidate();
+
+	return true;
+}
+
+std::string Renderer::get_device_name() {
+
+	if (use_cpu)
+		return std::string("native ") + CPURenderer::simd_name(cpu.get_simd_level());
+
+	return cl.get_device_name() + " (" + cl.get_platform_name() + ")";
+}
+
+void Renderer::set_view(const View &view) {
+	this->view = view;
+}
+
+void Renderer::set_range(sf::Vector4d range) {
+	view = View::from_range(range);
+}
+
+void Renderer::set_progressive(bool enabled, double frame_budget_seconds) {
+	progressive = enabled;
+	frame_budget = frame_budget_seconds;
+}
+
+void Renderer::set_tile_cache(bool enabled, size_t budget_bytes) {
+	use_tile_cache = enabled;
+	tile_cache.set_budget(budget_bytes);
+}
+
+bool Renderer::open_tile_store(std::string path) {
+	return tile_store.open(path);
+}
+
+void Renderer::set_palette(const std::vector<sf::Color> &palette) {
+
+	this->palette.assign(palette.begin(), palette.begin() + std::min(palette.size(), static_cast<size_t>(MAX_PALETTE)));
+	palette_dirty = true;
+	colouring_dirty = true;
+}
+
+void Renderer::set_colouring(float offset, float density, bool smooth) {
+
+	colouring_settings.x = offset;
+	colouring_settings.y = density;
+	colouring_settings.z = smooth ? 1.0f : 0.0f;
+	colouring_dirty = true;
+}
+
+std::vector<sf::Color> Renderer::classic_palette() {
+
+	// The colours the escape kernels used to write directly, one entry per iteration
+	// and repeating every 1000
+	std::vector<sf::Color> palette(1000);
+
+	for (int i = 0; i < 1000; i++) {
+		int val = static_cast<int>(16777216.0f * i / 1000.0f);
+		palette[i] = sf::Color(val & 0xff, (val >> 8) & 0xff, (val >> 16) & 0xff);
+	}
+
+	return palette;
+}
+
+std::vector<sf::Color> Renderer::gradient_palette() {
+
+	// Cosine gradient, meant to be run with smoothing on
+	std::vector<sf::Color> palette(256);
+
+	for (int i = 0; i < 256; i++) {
+		double t = i / 256.0 * 2.0 * 3.14159265358979;
+		palette[i] = sf::Color(
+			static_cast<sf::Uint8>(127.5 + 127.5 * std::cos(t)),
+			static_cast<sf::Uint8>(127.5 + 127.5 * std::cos(t + 2.0)),
+			static_cast<sf::Uint8>(127.5 + 127.5 * std::cos(t + 4.0)));
+	}
+
+	return palette;
+}
+
+void Renderer::colour() {
+
+	if (palette_dirty) {
+		cl.write_buffer("palette", palette.size() * sizeof(sf::Color), palette.data());
+		palette_dirty = false;
+	}
+
+	colouring = colouring_settings;
+	colouring.w = static_cast<float>(palette.size());
+
+	// Write the image after the one on screen, the last frame has completed by now
+	if (pipelined) {
+		image_slot = (image_slot + 1) % PIPELINE_IMAGES;
+		if (!cl.begin_frame(VIEWPORT_IMAGES[image_slot]))
+			return;
+	}
+
+	cl.set_kernel_arg("colour_iterations", 1, VIEWPORT_IMAGES[image_slot]);
+	cl.set_kernel_arg("colour_iterations", 2, ITERATION_BUFFERS[current_iterations]);
+	cl.run_kernel("colour_iterations", resolution);
+
+	if (supersampled && supersample_launch > 0) {
+		cl.set_kernel_arg("supersample_colour", 1, VIEWPORT_IMAGES[image_slot]);
+		cl.run_kernel("supersample_colour", sf::Vector2i(supersample_launch, 1));
+	}
+
+	if (pipelined)
+		cl.end_frame();
+
+	colouring_dirty = false;
+}
+
+void Renderer::render() {
+
+	// The last frame is still running. Host side buffers are only touched once it's done,
+	// so come back next time instead of waiting on it
+	if (pipelined && !cl.frame_idle()) {
+		computed_pixels = 0;
+		return;
+	}
+
+	computed_pixels = static_cast<long long>(resolution.x) * resolution.y;
+
+	// A pipelined frame reads its stats back asynchronously, these are still the last frame's
+	if (!pipelined)
+		std::fill(interior_stats, interior_stats + 3, 0);
+
+	std::fill(split_interior_stats, split_interior_stats + 3, 0);
+
+	if (use_cpu) {
+		// The native path is still fp32 only, and always renders the full frame. It colours on
+		// the host with the same lookup the colour pass uses
+		cpu.run_kernel(sf::Vector4f(view.to_range()), resolution, max_iterations, static_cast<float>(escape_radius * escape_radius));
+
+		std::vector<sf::Uint8> pixels;
+		colour_on_host(cpu.get_iterations(), palette, colouring_settings.x, colouring_settings.y, colouring_settings.z > 0.0f, pixels);
+		cpu.set_pixels(std::move(pixels));
+
+		refinement_level = REFINEMENT_LEVELS;
+		return;
+	}
+
+	precision p = select_precision();
+
+	if (p != active_precision) {
+		std::cout << "Switching to " << precision_name(p) << " precision" << std::endl;
+		active_precision = p;
+	}
+
+	if (escape_dirty)
+		specialize();
+
+	if (active_precision == PERTURBATION) {
+		// Glitch passes span the whole frame, so perturbation always renders it all
+		previous_frame_valid = false;
+		render_perturbation();
+		refinement_level = REFINEMENT_LEVELS;
+		supersampled = false;
+		colour();
+		return;
+	}
+
+	upload_range();
+
+	std::string kernel_name = active_precision == DOUBLE_SINGLE ? "mandlebrot_ds" : "mandlebrot";
+
+	const cl_int zero_stats[3] = { 0, 0, 0 };
+	cl.write_buffer("interior_stats", sizeof(zero_stats), zero_stats);
+
+	sf::Vector2i shift;
+	bool same_frame = previous_frame_valid && previous_precision == active_precision && pixel_shift(shift);
+
+	// Nothing to compute, at most the colouring changed
+	bool idle = same_frame && shift.x == 0 && shift.y == 0 && is_converged();
+
+	if (use_tile_cache && active_precision == SINGLE) {
+		// Assembling from the cache is cheap enough that shifting the last frame isn't worth it
+		if (!(same_frame && shift.x == 0 && shift.y == 0))
+			render_tiled();
+		else
+			computed_pixels = 0;
+		refinement_level = REFINEMENT_LEVELS;
+	} else if (same_frame && is_converged()) {
+		// Shifting needs the full iteration field, coarse passes only fill in their samples
+		render_shifted(kernel_name, shift);
+	} else if (same_frame && shift.x == 0 && shift.y == 0) {
+		refine(kernel_name);
+	} else if (subdivision && active_precision == SINGLE) {
+		render_subdivided();
+		refinement_level = REFINEMENT_LEVELS;
+	} else {
+		first_level = progressive ? 0 : REFINEMENT_LEVELS - 1;
+		refinement_level = first_level;
+
+		// Bands only move between views, the later passes over a view rely on each device
+		// still holding its own coarse samples
+		if (!split_devices.empty())
+			balance_split();
+
+		refine(kernel_name);
+	}
+
+	if (pipelined)
+		cl.read_buffer_async("interior_stats", sizeof(interior_stats), interior_stats);
+	else
+		cl.read_buffer("interior_stats", sizeof(interior_stats), interior_stats);
+
+	for (int s = 0; s < 3; s++)
+		interior_stats[s] += split_interior_stats[s];
+
+	// Only worth it once the view is done refining, every coarser pass would throw it away
+	if (!idle) {
+		supersampled = supersample_samples > 1 && active_precision == SINGLE && is_converged();
+		if (supersampled)
+			supersample();
+	}
+
+	if (!idle || colouring_dirty)
+		colour();
+
+	previous_frame_valid = true;
+	previous_view = view;
+	previous_precision = active_precision;
+}
+
+void Renderer::supersample() {
+
+	const cl_uint zero = 0;
+	cl.write_buffer("supersample_count", sizeof(zero), &zero);
+
+	cl.set_kernel_arg("supersample_mark", 1, ITERATION_BUFFERS[current_iterations]);
+	cl.run_kernel("supersample_mark", resolution);
+
+	int capacity = supersample_settings.y;
+
+	// Unpipelined launches have already finished, so the count is free to read and the
+	// subsample launches can be sized to it
+	if (pipelined) {
+		cl.read_buffer_async("supersample_count", sizeof(supersample_marked), &supersample_marked);
+		supersample_launch = capacity;
+	} else {
+		cl.read_buffer("supersample_count", sizeof(supersample_marked), &supersample_marked);
+		supersample_launch = std::min(static_cast<int>(supersample_marked), capacity);
+	}
+
+	if (supersample_launch > 0)
+		cl.run_kernel("supersample_iterate", sf::Vector2i(supersample_launch, supersample_samples));
+}
+
+int Renderer::get_supersampled_pixels() const {
+	return supersampled ? std::min(static_cast<int>(supersample_marked), supersample_settings.y) : 0;
+}
+
+int Renderer::get_supersample_overflow() const {
+	return supersampled ? std::max(static_cast<int>(supersample_marked) - supersample_settings.y, 0) : 0;
+}
+
+bool Renderer::pixel_shift(sf::Vector2i &shift) const {
+
+	if (view.width != previous_view.width || view.height != previous_view.height)
+		return false;
+
+	double x_step = view.width / resolution.x;
+	double y_step = view.height / resolution.y;
+
+	// The difference is tiny even when the centers themselves need more than a double
+	double dx = (view.center_x - previous_view.center_x).to_double() / x_step;
+	double dy = (view.center_y - previous_view.center_y).to_double() / y_step;
+
+	double rounded_x = std::round(dx);
+	double rounded_y = std::round(dy);
+
+	if (std::abs(dx - rounded_x) > 1e-3 || std::abs(dy - rounded_y) > 1e-3)
+		return false;
+
+	// Nothing left to reuse
+	if (std::abs(rounded_x) >= resolution.x || std::abs(rounded_y) >= resolution.y)
+		return false;
+
+	shift = sf::Vector2i(static_cast<int>(rounded_x), static_cast<int>(rounded_y));
+	return true;
+}
+
+void Renderer::render_shifted(std::string kernel_name, sf::Vector2i shift) {
+
+	// Same view as last frame, the image already holds it
+	if (shift.x == 0 && shift.y == 0) {
+		computed_pixels = 0;
+		return;
+	}
+
+	const char* source = ITERATION_BUFFERS[current_iterations];
+	const char* destination = ITERATION_BUFFERS[1 - current_iterations];
+
+	pan_offset = shift;
+	progressive_pass = sf::Vector2i(1, 0);
+
+	cl.set_kernel_arg("shift_iterations", 1, source);
+	cl.set_kernel_arg("shift_iterations", 2, destination);
+	cl.run_kernel("shift_iterations", resolution);
+
+	cl.set_kernel_arg(kernel_name, 2, destination);
+	computed_pixels = 0;
+
+	// Rows that came into view span the full width
+	int rows = std::abs(shift.y);
+	int row_start = shift.y > 0 ? resolution.y - rows : 0;
+
+	if (rows > 0) {
+		cl.run_kernel(kernel_name, sf::Vector2i(resolution.x, rows), sf::Vector2i(0, row_start));
+		computed_pixels += static_cast<long long>(resolution.x) * rows;
+	}
+
+	// Columns only need the rows the strip above didn't already cover
+	int columns = std::abs(shift.x);
+	int column_start = shift.x > 0 ? resolution.x - columns : 0;
+	int remaining_start = shift.y > 0 ? 0 : rows;
+	int remaining_rows = resolution.y - rows;
+
+	if (columns > 0 && remaining_rows > 0) {
+		cl.run_kernel(kernel_name, sf::Vector2i(columns, remaining_rows), sf::Vector2i(column_start, remaining_start));
+		computed_pixels += static_cast<long long>(columns) * remaining_rows;
+	}
+
+	current_iterations = 1 - current_iterations;
+}
+
+void Renderer::refine(std::string kernel_name) {
+
+	typedef std::chrono::steady_clock clock;
+	clock::time_point start = clock::now();
+
+	cl.set_kernel_arg(kernel_name, 2, ITERATION_BUFFERS[current_iterations]);
+	computed_pixels = 0;
+
+	double elapsed = 0.0;
+
+	while (refinement_level < REFINEMENT_LEVELS) {
+
+		int step = 1 << (REFINEMENT_LEVELS - 1 - refinement_level);
+		progressive_pass = sf::Vector2i(step, refinement_level > first_level ? 1 : 0);
+
+		sf::Vector2i samples((resolution.x + step - 1) / step, (resolution.y + step - 1) / step);
+
+		if (!split_devices.empty())
+			render_split(kernel_name, step);
+		else
+			cl.run_kernel(kernel_name, samples);
+
+		computed_pixels += static_cast<long long>(samples.x) * samples.y;
+		refinement_level++;
+
+		double pass_time = std::chrono::duration<double>(clock::now() - start).count() - elapsed;
+		elapsed += pass_time;
+
+		// Every pass has about four times the samples of the one before it
+		if (progressive && elapsed + pass_time * 4 > frame_budget)
+			break;
+
+		// Pipelined passes can't be timed without waiting on them, and would all see the
+		// last progressive_pass. One per frame, the following frames pick up the rest
+		if (pipelined)
+			break;
+	}
+}
+
+void Renderer::render_subdivided() {
+
+	const char* iterations = ITERATION_BUFFERS[current_iterations];
+
+	cl.set_kernel_arg("subdivision_clear", 1, iterations);
+	cl.set_kernel_arg("subdivision_border", 2, iterations);
+	cl.set_kernel_arg("subdivision_decide", 1, iterations);
+	cl.set_kernel_arg("subdivision_fill", 2, iterations);
+
+	cl.run_kernel("subdivision_clear", resolution);
+
+	std::vector<sf::Vector4i> tiles;
+	for (int y = 0; y < resolution.y; y += SUBDIVISION_TILE) {
+		for (int x = 0; x < resolution.x; x += SUBDIVISION_TILE) {
+			tiles.push_back(sf::Vector4i(x, y,
+				std::min(SUBDIVISION_TILE, resolution.x - x),
+				std::min(SUBDIVISION_TILE, resolution.y - y)));
+		}
+	}
+
+	computed_pixels = 0;
+
+	std::vector<cl_int> decisions;
+	std::vector<sf::Vector4i> fill_tiles;
+	std::vector<cl_int> fill_values;
+	std::vector<sf::Vector4i> split_tiles;
+
+	while (!tiles.empty()) {
+
+		int tile_count = static_cast<int>(tiles.size());
+		int longest_perimeter = 1;
+
+		for (const sf::Vector4i &tile : tiles) {
+			int perimeter = std::max(2 * tile.z + 2 * tile.w - 4, 1);
+			longest_perimeter = std::max(longest_perimeter, perimeter);
+			computed_pixels += perimeter;
+		}
+
+		cl.write_buffer("subdivision_tiles", tiles.size() * sizeof(sf::Vector4i), tiles.data());
+		cl.run_kernel("subdivision_border", sf::Vector2i(longest_perimeter, tile_count));
+		cl.run_kernel("subdivision_decide", sf::Vector2i(tile_count, 1));
+
+		decisions.resize(tiles.size());
+		if (!cl.read_buffer("subdivision_decisions", decisions.size() * sizeof(cl_int), decisions.data()))
+			return;
+
+		fill_tiles.clear();
+		fill_values.clear();
+		split_tiles.clear();
+
+		int largest_inside = 0;
+
+		for (size_t i = 0; i < tiles.size(); i++) {
+
+			const sf::Vector4i &tile = tiles[i];
+
+			if (decisions[i] == SUBDIVISION_SPLIT) {
+				int half_width = tile.z / 2;
+				int half_height = tile.w / 2;
+				split_tiles.push_back(sf::Vector4i(tile.x, tile.y, half_width, half_height));
+				split_tiles.push_back(sf::Vector4i(tile.x + half_width, tile.y, tile.z - half_width, half_height));
+				split_tiles.push_back(sf::Vector4i(tile.x, tile.y + half_height, half_width, tile.w - half_height));
+				split_tiles.push_back(sf::Vector4i(tile.x + half_width, tile.y + half_height, tile.z - half_width, tile.w - half_height));
+				continue;
+			}
+
+			int inside = std::max(tile.z - 2, 0) * std::max(tile.w - 2, 0);
+			if (inside == 0)
+				continue;
+
+			if (decisions[i] == SUBDIVISION_COMPUTE)
+				computed_pixels += inside;
+
+			fill_tiles.push_back(tile);
+			fill_values.push_back(decisions[i]);
+			largest_inside = std::max(largest_inside, inside);
+		}
+
+		if (!fill_tiles.empty()) {
+			cl.write_buffer("subdivision_fill_tiles", fill_tiles.size() * sizeof(sf::Vector4i), fill_tiles.data());
+			cl.write_buffer("subdivision_fill_values", fill_values.size() * sizeof(cl_int), fill_values.data());
+			cl.run_kernel("subdivision_fill", sf::Vector2i(largest_inside, static_cast<int>(fill_tiles.size())));
+		}
+
+		if (split_tiles.size() > subdivision_capacity) {
+			std::cout << "Subdivision ran out of tile storage" << std::endl;
+			return;
+		}
+
+		tiles.swap(split_tiles);
+	}
+}
+
+void Renderer::render_tiled() {
+
+	const int size = TileCache::TILE_SIZE;
+
+	sf::Vector4d range = view.to_range();
+	double x_step = view.width / resolution.x;
+	double y_step = view.height / resolution.y;
+
+	int level = TileCache::level_for_spacing(view.pixel_spacing(resolution));
+	double spacing = TileCache::level_spacing(level);
+
+	// Which tile and which pixel inside it every screen column and row samples
+	auto grid_pixel = [spacing](double coordinate) {
+		return static_cast<long long>(std::floor(coordinate / spacing));
+	};
+	auto tile_of = [size](long long pixel) {
+		return static_cast<int>(pixel >= 0 ? pixel / size : (pixel - size + 1) / size);
+	};
+
+	std::vector<int> column_tile(resolution.x), column_offset(resolution.x);
+	std::vector<int> row_tile(resolution.y), row_offset(resolution.y);
+
+	for (int i = 0; i < resolution.x; i++) {
+		long long pixel = grid_pixel(range.x + i * x_step);
+		column_tile[i] = tile_of(pixel);
+		column_offset[i] = static_cast<int>(pixel - static_cast<long long>(column_tile[i]) * size);
+	}
+
+	for (int j = 0; j < resolution.y; j++) {
+		long long pixel = grid_pixel(range.z + j * y_step);
+		row_tile[j] = tile_of(pixel);
+		row_offset[j] = static_cast<int>(pixel - static_cast<long long>(row_tile[j]) * size);
+	}
+
+	auto column_bounds = std::minmax_element(column_tile.begin(), column_tile.end());
+	auto row_bounds = std::minmax_element(row_tile.begin(), row_tile.end());
+
+	int first_x = *column_bounds.first;
+	int first_y = *row_bounds.first;
+	int tiles_x = *column_bounds.second - first_x + 1;
+	int tiles_y = *row_bounds.second - first_y + 1;
+
+	int32_t radius = TileKey::escape_key(escape_radius);
+
+	std::vector<TileKey> keys;
+	for (int index = 0; index < tiles_x * tiles_y; index++)
+		keys.push_back(TileKey{ TileKey::MANDELBROT, max_iterations, radius, level, first_x + index % tiles_x, first_y + index / tiles_x });
+
+	std::vector<std::shared_ptr<const TileCache::Tile>> tiles;
+	if (!render_tiles(keys, tiles))
+		return;
+
+	tile_frame.resize(static_cast<size_t>(resolution.x) * resolution.y);
+
+	for (int j = 0; j < resolution.y; j++) {
+
+		const std::shared_ptr<const TileCache::Tile> *tile_row = &tiles[(row_tile[j] - first_y) * tiles_x];
+		int row_start = row_offset[j] * size;
+
+		for (int i = 0; i < resolution.x; i++) {
+			const TileCache::Tile &tile = *tile_row[column_tile[i] - first_x];
+			tile_frame[j * resolution.x + i] = tile[row_start + column_offset[i]];
+		}
+	}
+
+	cl.write_buffer(ITERATION_BUFFERS[current_iterations], tile_frame.size() * sizeof(cl_ushort), tile_frame.data());
+}
+
+bool Renderer::render_tiles(const std::vector<TileKey> &keys, std::vector<std::shared_ptr<const TileCache::Tile>> &tiles) {
+
+	if (use_cpu)
+		return false;
+
+	if (escape_dirty)
+		specialize();
+
+	const int size = TileCache::TILE_SIZE;
+
+	tiles.assign(keys.size(), nullptr);
+	std::vector<int> missing;
+
+	for (size_t index = 0; index < keys.size(); index++) {
+
+		tiles[index] = tile_cache.find(keys[index]);
+
+		if (!tiles[index] && tile_store.is_open()) {
+			tiles[index] = tile_store.find(keys[index]);
+			if (tiles[index])
+				tile_cache.insert(keys[index], tiles[index]);
+		}
+
+		if (!tiles[index])
+			missing.push_back(static_cast<int>(index));
+	}
+
+	computed_pixels = static_cast<long long>(missing.size()) * size * size;
+
+	std::vector<sf::Vector4f> origins;
+	std::vector<cl_ushort> batch;
+
+	for (size_t start = 0; start < missing.size(); start += MAX_TILE_BATCH) {
+
+		int count = static_cast<int>(std::min(missing.size() - start, static_cast<size_t>(MAX_TILE_BATCH)));
+
+		origins.clear();
+		for (int i = 0; i < count; i++) {
+			const TileKey &key = keys[missing[start + i]];
+			double spacing = TileCache::level_spacing(key.level);
+			origins.push_back(sf::Vector4f(
+				static_cast<float>(key.x * static_cast<double>(size) * spacing),
+				static_cast<float>(key.y * static_cast<double>(size) * spacing),
+				static_cast<float>(spacing), 0.0f));
+		}
+
+		cl.write_buffer("tile_origins", origins.size() * sizeof(sf::Vector4f), origins.data());
+		cl.run_kernel("render_tiles", sf::Vector2i(size, size * count));
+
+		batch.resize(static_cast<size_t>(count) * size * size);
+		if (!cl.read_buffer("tile_iterations", batch.size() * sizeof(cl_ushort), batch.data()))
+			return false;
+
+		for (int i = 0; i < count; i++) {
+			int index = missing[start + i];
+			std::shared_ptr<const TileCache::Tile> tile = std::make_shared<TileCache::Tile>(
+				batch.begin() + i * size * size, batch.begin() + (i + 1) * size * size);
+
+			tiles[index] = tile;
+			tile_cache.insert(keys[index], tile);
+			tile_store.insert(keys[index], *tile);
+		}
+	}
+
+	tile_store.flush();
+	return true;
+}
+
+void Renderer::render_perturbation() {
+
+	cl.set_kernel_arg("mandlebrot_perturbation", 1, ITERATION_BUFFERS[current_iterations]);
+
+	double x_step = view.width / resolution.x;
+	double y_step = view.height / resolution.y;
+
+	int limbs = FixedPoint::limbs_for_spacing(std::min(std::abs(x_step), std::abs(y_step)));
+
+	// Offset of the current reference from the view center, the first one is the center itself
+	double reference_x = 0.0;
+	double reference_y = 0.0;
+
+	reference_count = 0;
+	unresolved_glitches = 0;
+	skipped_iterations = 0;
+
+	// Pixels the current pass touches, everything on the first one
+	long long pass_pixels = static_cast<long long>(resolution.x) * resolution.y;
+
+	for (int pass = 0; pass < MAX_REFERENCES; pass++) {
+
+		int orbit_length = compute_reference_orbit(
+			view.center_x + FixedPoint(reference_x, limbs),
+			view.center_y + FixedPoint(reference_y, limbs));
+
+		reference_count++;
+
+		int skip = compute_series(orbit_length, x_step, y_step, reference_x, reference_y);
+		skipped_iterations += skip * pass_pixels;
+
+		double perturbation_view[4] = { x_step, y_step, reference_x, reference_y };
+		cl_int state[4] = { orbit_length, pass, skip, 0 };
+
+		if (perturbation_fp64) {
+			cl.write_buffer("orbit", orbit_length * 2 * sizeof(double), orbit.data());
+			cl.write_buffer("perturbation_view", sizeof(perturbation_view), perturbation_view);
+			cl.write_buffer("series", sizeof(series), series);
+		} else {
+			std::vector<float> orbit_f(orbit.begin(), orbit.begin() + orbit_length * 2);
+			float perturbation_view_f[4] = {
+				static_cast<float>(x_step), static_cast<float>(y_step),
+				static_cast<float>(reference_x), static_cast<float>(reference_y) };
+			std::vector<float> series_f(series, series + 6);
+
+			cl.write_buffer("orbit", orbit_f.size() * sizeof(float), orbit_f.data());
+			cl.write_buffer("perturbation_view", sizeof(perturbation_view_f), perturbation_view_f);
+			cl.write_buffer("series", series_f.size() * sizeof(float), series_f.data());
+		}
+
+		cl.write_buffer("perturbation_state", sizeof(state), state);
+
+		cl.run_kernel("mandlebrot_perturbation", resolution);
+
+		if (!cl.read_buffer("glitches", glitches.size(), glitches.data()))
+			return;
+
+		std::vector<int> glitched;
+		for (size_t i = 0; i < glitches.size(); i++) {
+			if (glitches[i])
+				glitched.push_back(static_cast<int>(i));
+		}
+
+		unresolved_glitches = static_cast<int>(glitched.size());
+		pass_pixels = unresolved_glitches;
+
+		if (glitched.empty())
+			return;
+
+		// Any glitched pixel works as the next reference since it can't glitch against
+		// itself, the middle of the list tends to land inside the largest glitched blob
+		int next = glitched[glitched.size() / 2];
+		reference_x = ((next % resolution.x) - resolution.x * 0.5) * x_step;
+		reference_y = ((next / resolution.x) - resolution.y * 0.5) * y_step;
+	}
+}
+
+int Renderer::compute_reference_orbit(const FixedPoint &cx, const FixedPoint &cy) {
+
+	orbit.assign((max_iterations + 1) * 2, 0.0);
+
+	FixedPoint x(0.0, cx.get_precision());
+	FixedPoint y(0.0, cy.get_precision());
+
+	// Pixels follow the reference until they pass the same bailout
+	double bailout = escape_radius * escape_radius;
+
+	int length = 1;
+
+	for (int i = 0; i < max_iterations; i++) {
+
+		FixedPoint xx = x * x;
+		FixedPoint yy = y * y;
+
+		if ((xx + yy).to_double() >= bailout)
+			break;
+
+		FixedPoint xy = x * y;
+		y = xy + xy + cy;
+		x = xx - yy + cx;
+
+		orbit[length * 2 + 0] = x.to_double();
+		orbit[length * 2 + 1] = y.to_double();
+		length++;
+	}
+
+	return length;
+}
+
+bool Renderer::begin_exponential_map(const FixedPoint &x, const FixedPoint &y, double outer_radius, double inner_radius) {
+
+	if (use_cpu) {
+		std::cout << "Exponential maps need an OpenCL device" << std::endl;
+		return false;
+	}
+
+	if (!(inner_radius > 0.0 && outer_radius > inner_radius)) {
+		std::cout << "The strip's inner radius has to be positive and inside the outer one" << std::endl;
+		return false;
+	}
+
+	std::string options = OpenCL::FAST_MATH_OPTIONS + threshold_option();
+	if (perturbation_fp64)
+		options += " -D PERTURBATION_DOUBLE";
+
+	if (!cl.compile_kernel(KERNEL_DIRECTORY + "exponential_map.cl", "exponential_map_strip", options))
+		return false;
+	if (!cl.compile_kernel(KERNEL_DIRECTORY + "exponential_map.cl", "exponential_map_resample", options))
+		return false;
+
+	const double two_pi = 2.0 * 3.14159265358979;
+
+	// As many columns as the frame's corners are pixels around, so the strip is at least as
+	// fine as the frame everywhere. Square strip pixels then fix the row spacing
+	double corner = 0.5 * std::hypot(static_cast<double>(resolution.x), static_cast<double>(resolution.y));
+
+	strip_columns = (static_cast<int>(std::ceil(two_pi * corner)) + 63) / 64 * 64;
+	strip_log_step = two_pi / strip_columns;
+	strip_log_outer = std::log(outer_radius);
+	strip_rows = static_cast<int>(std::ceil(std::log(outer_radius / inner_radius) / strip_log_step)) + 1;
+
+	// A frame spans the rows from its corners to a pixel from its center, the extra ones are
+	// for rounding and the row interpolation reaches into
+	strip_capacity = std::min(strip_rows, static_cast<int>(std::ceil(std::log(corner) / strip_log_step)) + 4);
+
+	size_t real_size = perturbation_fp64 ? sizeof(double) : sizeof(float);
+	size_t ring_bytes = static_cast<size_t>(strip_capacity) * strip_columns * sizeof(cl_ushort);
+
+	strip_glitches.assign(static_cast<size_t>(STRIP_BAND) * strip_columns, 0);
+
+	if (cl.create_buffer("strip", static_cast<cl_uint>(ring_bytes), nullptr, CL_MEM_READ_WRITE) < 0)
+		return false;
+
+	cl.create_buffer("strip_layout", sizeof(sf::Vector4i), nullptr, CL_MEM_READ_ONLY);
+	cl.create_buffer("strip_view", static_cast<cl_uint>(4 * real_size), nullptr, CL_MEM_READ_ONLY);
+	cl.create_buffer("strip_frame", sizeof(sf::Vector4f), nullptr, CL_MEM_READ_ONLY);
+	cl.create_buffer("strip_glitches", static_cast<cl_uint>(strip_glitches.size()), nullptr, CL_MEM_READ_WRITE);
+
+	cl.set_kernel_arg("exponential_map_strip", 0, "strip_layout");
+	cl.set_kernel_arg("exponential_map_strip", 1, "strip");
+	cl.set_kernel_arg("exponential_map_strip", 2, "orbit");
+	cl.set_kernel_arg("exponential_map_strip", 3, "strip_view");
+	cl.set_kernel_arg("exponential_map_strip", 4, "perturbation_state");
+	cl.set_kernel_arg("exponential_map_strip", 5, "strip_glitches");
+
+	cl.set_kernel_arg("exponential_map_resample", 0, "image_res");
+	cl.set_kernel_arg("exponential_map_resample", 2, "strip");
+	cl.set_kernel_arg("exponential_map_resample", 3, "strip_layout");
+	cl.set_kernel_arg("exponential_map_resample", 4, "strip_frame");
+
+	// The strip was just built without the radius
+	escape_dirty = true;
+
+	// References have to resolve the strip's innermost pixels
+	strip_limbs = FixedPoint::limbs_for_spacing(inner_radius * strip_log_step);
+
+	strip_x = x;
+	strip_y = y;
+	strip_x.set_precision(strip_limbs);
+	strip_y.set_precision(strip_limbs);
+
+	strip_orbit_length = compute_reference_orbit(strip_x, strip_y);
+	strip_orbit = orbit;
+
+	strip_first = 0;
+	strip_end = 0;
+	strip_pixels = 0;
+
+	std::cout << "Exponential map strip of " << strip_columns << " x " << strip_rows << " pixels, "
+		<< strip_capacity << " rows resident" << std::endl;
+
+	return true;
+}
+
+bool Renderer::render_exponential_map(double width, double height) {
+
+	if (strip_columns == 0)
+		return false;
+
+	if (escape_dirty)
+		specialize();
+
+	double x_step = width / resolution.x;
+	double y_step = height / resolution.y;
+	double aspect = y_step / x_step;
+
+	// Row a pixel out from the center lands on, everything else is an offset from it
+	double base = (strip_log_outer - std::log(std::abs(x_step))) / strip_log_step - 0.5;
+	double corner = std::hypot(resolution.x * 0.5, resolution.y * 0.5 * aspect);
+
+	int last = std::min(strip_rows - 1, static_cast<int>(std::ceil(base - std::log(std::min(1.0, aspect)) / strip_log_step)) + 1);
+	int first = std::min(last, std::max(0, static_cast<int>(std::floor(base - std::log(corner) / strip_log_step)) - 1));
+
+	if (last - first + 1 > strip_capacity) {
+		std::cout << "The frame spans " << last - first + 1 << " strip rows, the ring only holds " << strip_capacity << std::endl;
+		return false;
+	}
+
+	computed_pixels = 0;
+
+	// Zooming in only ever needs rows further in, anything else starts the ring over
+	if (first < strip_first || first > strip_end) {
+		strip_first = first;
+		strip_end = first;
+	}
+
+	if (last + 1 > strip_end) {
+		render_strip(strip_end, last + 1);
+
+		computed_pixels = static_cast<long long>(last + 1 - strip_end) * strip_columns;
+		strip_pixels += computed_pixels;
+
+		strip_end = last + 1;
+		strip_first = std::max(strip_first, strip_end - strip_capacity);
+	}
+
+	sf::Vector4i layout(strip_columns, strip_capacity, first, last);
+	sf::Vector4f frame(static_cast<float>(base), static_cast<float>(aspect), static_cast<float>(strip_log_step), 0.0f);
+
+	cl.write_buffer("strip_layout", sizeof(layout), &layout);
+	cl.write_buffer("strip_frame", sizeof(frame), &frame);
+
+	cl.set_kernel_arg("exponential_map_resample", 1, ITERATION_BUFFERS[current_iterations]);
+	cl.run_kernel("exponential_map_resample", resolution);
+
+	// Nothing the interactive paths keep between frames holds for a resampled one
+	previous_frame_valid = false;
+	refinement_level = REFINEMENT_LEVELS;
+	supersampled = false;
+
+	colour();
+	return true;
+}
+
+void Renderer::render_strip(int first, int end) {
+
+	const double two_pi = 2.0 * 3.14159265358979;
+
+	for (int band = first; band < end; band += STRIP_BAND) {
+
+		int rows = std::min(static_cast<int>(STRIP_BAND), end - band);
+
+		sf::Vector4i layout(strip_columns, strip_capacity, band, 0);
+		cl.write_buffer("strip_layout", sizeof(layout), &layout);
+
+		// Offset of the current reference from the target, the first one is the target itself
+		double reference_x = 0.0;
+		double reference_y = 0.0;
+
+		for (int pass = 0; pass < MAX_REFERENCES; pass++) {
+
+			int orbit_length = strip_orbit_length;
+
+			if (pass == 0) {
+				orbit = strip_orbit;
+			} else {
+				orbit_length = compute_reference_orbit(
+					strip_x + FixedPoint(reference_x, strip_limbs),
+					strip_y + FixedPoint(reference_y, strip_limbs));
+			}
+
+			double strip_view[4] = { strip_log_outer, strip_log_step, reference_x, reference_y };
+			cl_int state[4] = { orbit_length, pass, 0, 0 };
+
+			if (perturbation_fp64) {
+				cl.write_buffer("orbit", orbit_length * 2 * sizeof(double), orbit.data());
+				cl.write_buffer("strip_view", sizeof(strip_view), strip_view);
+			} else {
+				std::vector<float> orbit_f(orbit.begin(), orbit.begin() + orbit_length * 2);
+				float strip_view_f[4] = {
+					static_cast<float>(strip_log_outer), static_cast<float>(strip_log_step),
+					static_cast<float>(reference_x), static_cast<float>(reference_y) };
+
+				cl.write_buffer("orbit", orbit_f.size() * sizeof(float), orbit_f.data());
+				cl.write_buffer("strip_view", sizeof(strip_view_f), strip_view_f);
+			}
+
+			cl.write_buffer("perturbation_state", sizeof(state), state);
+
+			cl.run_kernel("exponential_map_strip", sf::Vector2i(strip_columns, rows), sf::Vector2i(0, band));
+
+			size_t band_pixels = static_cast<size_t>(rows) * strip_columns;
+			if (!cl.read_buffer("strip_glitches", band_pixels, strip_glitches.data()))
+				return;
+
+			std::vector<int> glitched;
+			for (size_t i = 0; i < band_pixels; i++) {
+				if (strip_glitches[i])
+					glitched.push_back(static_cast<int>(i));
+			}
+
+			if (glitched.empty())
+				break;
+
+			// Same pick as render_perturbation, in polar coordinates this time
+			int next = glitched[glitched.size() / 2];
+			double theta = two_pi * ((next % strip_columns) + 0.5) / strip_columns;
+			double radius = std::exp(strip_log_outer - (band + next / strip_columns + 0.5) * strip_log_step);
+
+			reference_x = radius * std::cos(theta);
+			reference_y = radius * std::sin(theta);
+		}
+	}
+}
+
+bool Renderer::is_busy() {
+
+	if (use_cpu)
+		return false;
+
+	return !is_converged() || (pipelined && !cl.frame_idle());
+}
+
+void Renderer::finish() {
+
+	if (!use_cpu)
+		cl.finish();
+}
+
+void Renderer::draw(sf::RenderWindow *window) {
+
+	if (use_cpu)
+		cpu.draw(window);
+	else
+		cl.draw(window);
+}
+
+bool Renderer::read_pixels(std::vector<sf::Uint8> &pixels) {
+
+	if (use_cpu) {
+		pixels = cpu.get_pixels();
+		return true;
+	}
+
+	if (pipelined)
+		cl.finish();
+
+	return cl.read_image(VIEWPORT_IMAGES[image_slot], resolution, pixels);
+}
+
+bool Renderer::read_iterations(std::vector<cl_ushort> &iterations) {
+
+	if (use_cpu) {
+		iterations = cpu.get_iterations();
+		return true;
+	}
+
+	if (pipelined)
+		cl.finish();
+
+	iterations.resize(static_cast<size_t>(resolution.x) * resolution.y);
+	return cl.read_buffer(ITERATION_BUFFERS[current_iterations], iterations.size() * sizeof(cl_ushort), iterations.data());
+}
+
+void Renderer::colour_on_host(const std::vector<cl_ushort> &iterations, const std::vector<sf::Color> &palette,
+	float offset, float density, bool smooth, std::vector<sf::Uint8> &pixels) {
+
+	pixels.resize(iterations.size() * 4);
+
+	// Same lookup as colour_iterations
+	int palette_size = static_cast<int>(palette.size());
+
+	for (size_t i = 0; i < iterations.size(); i++) {
+
+		float count = smooth ?
+			static_cast<float>(iterations[i]) / (1 << ITERATION_FRACTION_BITS) :
+			static_cast<float>(iterations[i] >> ITERATION_FRACTION_BITS);
+
+		float position = count * density + offset;
+		position -= std::floor(position / palette_size) * palette_size;
+
+		int first = std::min(static_cast<int>(position), palette_size - 1);
+		int second = (first + 1) % palette_size;
+		float t = position - first;
+
+		const sf::Color &a = palette[first];
+		const sf::Color &b = palette[second];
+
+		pixels[i * 4 + 0] = static_cast<sf::Uint8>(a.r + (b.r - a.r) * t + 0.5f);
+		pixels[i * 4 + 1] = static_cast<sf::Uint8>(a.g + (b.g - a.g) * t + 0.5f);
+		pixels[i * 4 + 2] = static_cast<sf::Uint8>(a.b + (b.b - a.b) * t + 0.5f);
+		pixels[i * 4 + 3] = 255;
+	}
+}
+
+Renderer::precision Renderer::select_precision() const {
+	return precision_for(view, resolution);
+}
+
+Renderer::precision Renderer::precision_for(const View &view, sf::Vector2i resolution) {
+
+	sf::Vector4d range = view.to_range();
+
+	double magnitude = std::max(
+		std::max(std::abs(range.x), std::abs(range.y)),
+		std::max(std::abs(range.z), std::abs(range.w)));
+
+	double spacing = view.pixel_spacing(resolution);
+
+	// Double-single carries about 48 bits, hand over to perturbation with some margin to spare
+	if (spacing < magnitude * std::ldexp(1.0, -40))
+		return PERTURBATION;
+
+	// Errors grow over the orbit, so switch over well before the spacing reaches a single ulp
+	if (spacing < magnitude * FLT_EPSILON * 16)
+		return DOUBLE_SINGLE;
+
+	return SINGLE;
+}
+
+void Renderer::upload_range() {
+
+	sf::Vector4d range = view.to_range();
+	range_f = sf::Vector4f(range);
+
+	double x_step = view.width / resolution.x;
+	double y_step = view.height / resolution.y;
+
+	SplitDouble(range.x, range_ds[0].x, range_ds[0].y);
+	SplitDouble(range.z, range_ds[0].z, range_ds[0].w);
+	SplitDouble(x_step, range_ds[1].x, range_ds[1].y);
+	SplitDouble(y_step, range_ds[1].z, range_ds[1].w);
+}
+
+int Renderer::compute_series(int orbit_length, double x_step, double y_step, double reference_x, double reference_y) {
+
+	typedef std::complex<double> complex;
+
+	// Probe the corners and edge midpoints of the frame, relative to the reference.
+	// The probes are iterated exactly and the series has to agree with all of them
+	std::vector<complex> probe_dc;
+	std::vector<complex> probe_dz;
+
+	for (int y = -1; y <= 1; y++) {
+		for (int x = -1; x <= 1; x++) {
+			if (x == 0 && y == 0)
+				continue;
+			probe_dc.push_back(complex(
+				x * resolution.x * 0.5 * x_step - reference_x,
+				y * resolution.y * 0.5 * y_step - reference_y));
+		}
+	}
+	probe_dz.assign(probe_dc.size(), complex(0, 0));
+
+	// Scaled by powers of x_step, so the series is fed dc in pixels
+	complex a(0, 0), b(0, 0), c(0, 0);
+	int skip = 0;
+
+	for (int n = 0; n + 1 < orbit_length; n++) {
+
+		complex Z(orbit[n * 2], orbit[n * 2 + 1]);
+		complex Z_next(orbit[(n + 1) * 2], orbit[(n + 1) * 2 + 1]);
+
+		complex a_next = 2.0 * Z * a + x_step;
+		complex b_next = 2.0 * Z * b + a * a;
+		complex c_next = 2.0 * Z * c + 2.0 * a * b;
+
+		// An error of e in dz is about the same as being e / |A| off in dc. Chaotic
+		// pixels amplify whatever is left, so keep it to a millionth of a pixel
+		double tolerance = std::abs(a_next) * 1e-6;
+		bool accurate = std::isfinite(tolerance);
+
+		for (size_t p = 0; p < probe_dc.size() && accurate; p++) {
+
+			complex &dz = probe_dz[p];
+			dz = 2.0 * Z * dz + dz * dz + probe_dc[p];
+
+			complex dc = probe_dc[p] / x_step;
+			complex approximation = a_next * dc + b_next * dc * dc + c_next * dc * dc * dc;
+
+			if (!(std::abs(approximation - dz) <= tolerance) || std::norm(Z_next + dz) >= escape_radius * escape_radius)
+				accurate = false;
+		}
+
+		if (!accurate)
+			break;
+
+		a = a_next;
+		b = b_next;
+		c = c_next;
+		skip = n + 1;
+	}
+
+	series[0] = a.real();
+	series[1] = a.imag();
+	series[2] = b.real();
+	series[3] = b.imag();
+	series[4] = c.real();
+	series[5] = c.imag();
+
+	return skip;
+}
+
+const char* Renderer::precision_name(precision p) {
+
+	switch (p) {
+	case DOUBLE_SINGLE:
+		return "double-single";
+	case PERTURBATION:
+		return "perturbation";
+	default:
+		return "single";
+	}
+}
@@ -0,0 +1,125 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+
+ThreadPool::ThreadPool(unsigned int thread_count) : remaining_jobs(0) {
+
+	if (thread_count == 0)
+		thread_count = std::thread::hardware_concurrency();
+
+	// hardware_concurrency is allowed to return 0 when it can't tell
+	if (thread_count == 0)
+		thread_count = 1;
+
+	for (unsigned int i = 0; i < thread_count; i++)
+		queues.emplace_back(new job_queue);
+
+	for (unsigned int i = 0; i < thread_count; i++)
+		threads.emplace_back(&ThreadPool::worker_loop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+
+	{
+		std::lock_guard<std::mutex> lock(batch_mutex);
+		stopping = true;
+	}
+	batch_start.notify_all();
+
+	for (auto &&t : threads)
+		t.join();
+}
+
+void ThreadPool::parallel_for(int job_count, const std::function<void(int)>& job) {
+
+	if (job_count <= 0)
+		return;
+
+	std::lock_guard<std::mutex> dispatch_lock(dispatch_mutex);
+
+	// The job and the counter must be visible before any index lands in a queue,
+	// a worker still draining the last batch may pick one up straight away
+	current_job = &job;
+	remaining_jobs = job_count;
+
+	unsigned int worker_count = size();
+	int per_worker = (job_count + worker_count - 1) / worker_count;
+
+	for (unsigned int w = 0; w < worker_count; w++) {
+
+		std::lock_guard<std::mutex> lock(queues[w]->mutex);
+
+		int begin = w * per_worker;
+		int end = std::min(job_count, begin + per_worker);
+
+		for (int i = begin; i < end; i++)
+			queues[w]->jobs.push_back(i);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(batch_mutex);
+		generation++;
+	}
+	batch_start.notify_all();
+
+	std::unique_lock<std::mutex> lock(batch_mutex);
+	batch_done.wait(lock, [this] { return remaining_jobs == 0; });
+}
+
+void ThreadPool::worker_loop(unsigned int index) {
+
+	unsigned int seen_generation = 0;
+
+	while (true) {
+
+		{
+			std::unique_lock<std::mutex> lock(batch_mutex);
+			batch_start.wait(lock, [&] { return stopping || generation != seen_generation; });
+
+			if (stopping)
+				return;
+
+			seen_generation = generation;
+		}
+
+		int job;
+		while (pop_job(index, job)) {
+
+			(*current_job)(job);
+
+			if (remaining_jobs.fetch_sub(1) == 1) {
+				std::lock_guard<std::mutex> lock(batch_mutex);
+				batch_done.notify_all();
+			}
+		}
+	}
+}
+
+bool ThreadPool::pop_job(unsigned int index, int &job) {
+
+	{
+		job_queue &own = *queues[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+
+		if (!own.jobs.empty()) {
+			job = own.jobs.front();
+			own.jobs.pop_front();
+			return true;
+		}
+	}
+
+	// Our own queue is dry, go steal from the back of the others
+	for (unsigned int i = 1; i < queues.size(); i++) {
+
+		job_queue &victim = *queues[(index + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+
+		if (!victim.jobs.empty()) {
+			job = victim.jobs.back();
+			victim.jobs.pop_back();
+			return true;
+		}
+	}
+
+	return false;
+}
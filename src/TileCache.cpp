@@ -0,0 +1,70 @@
+#include "TileCache.h"
+#include <algorithm>
+#include <cmath>
+
+
+// Level 0 fits the whole set, [-2, 2], in a single tile
+const double TileCache::BASE_SPACING = 4.0 / TILE_SIZE;
+
+TileCache::TileCache(size_t budget_bytes) : budget(budget_bytes) {
+}
+
+std::shared_ptr<const TileCache::Tile> TileCache::find(const TileKey &key) {
+
+	auto entry = entries.find(key);
+
+	if (entry == entries.end()) {
+		misses++;
+		return nullptr;
+	}
+
+	hits++;
+	lru.splice(lru.begin(), lru, entry->second);
+	return entry->second->second;
+}
+
+void TileCache::insert(const TileKey &key, std::shared_ptr<const Tile> tile) {
+
+	auto entry = entries.find(key);
+
+	if (entry != entries.end()) {
+		bytes -= entry->second->second->size() * sizeof(uint16_t);
+		lru.erase(entry->second);
+		entries.erase(entry);
+	}
+
+	bytes += tile->size() * sizeof(uint16_t);
+	lru.emplace_front(key, std::move(tile));
+	entries[key] = lru.begin();
+
+	evict();
+}
+
+void TileCache::set_budget(size_t budget_bytes) {
+	budget = budget_bytes;
+	evict();
+}
+
+void TileCache::clear() {
+	lru.clear();
+	entries.clear();
+	bytes = 0;
+}
+
+void TileCache::evict() {
+
+	while (bytes > budget && !lru.empty()) {
+		bytes -= lru.back().second->size() * sizeof(uint16_t);
+		entries.erase(lru.back().first);
+		lru.pop_back();
+		evictions++;
+	}
+}
+
+int TileCache::level_for_spacing(double spacing) {
+	return std::max(0, static_cast<int>(std::ceil(std::log2(BASE_SPACING / spacing))));
+}
+
+double TileCache::level_spacing(int level) {
+	return std::ldexp(BASE_SPACING, -level);
+}
@@ -0,0 +1,132 @@
+#include "TileProtocol.h"
+
+
+namespace {
+
+void write_varint(std::string &out, uint32_t value) {
+
+	while (value >= 0x80) {
+		out += static_cast<char>((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	out += static_cast<char>(value);
+}
+
+bool read_varint(const std::string &data, size_t &position, uint32_t &value) {
+
+	value = 0;
+
+	for (int shift = 0; shift < 35; shift += 7) {
+
+		if (position >= data.size())
+			return false;
+
+		uint8_t byte = static_cast<uint8_t>(data[position++]);
+		value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+
+		if (!(byte & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+}
+
+std::string TileProtocol::compress(const std::vector<uint16_t> &counts) {
+
+	std::string out(1, static_cast<char>(DELTA_RUNS));
+	out.reserve(counts.size());
+
+	int32_t previous = 0;
+	size_t i = 0;
+
+	while (i < counts.size()) {
+
+		int32_t delta = static_cast<int32_t>(counts[i]) - previous;
+		write_varint(out, (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31));
+
+		previous = counts[i++];
+
+		if (delta == 0) {
+			uint32_t run = 0;
+			while (i < counts.size() && counts[i] == previous) {
+				run++;
+				i++;
+			}
+			write_varint(out, run);
+		}
+	}
+
+	if (out.size() <= counts.size() * 2)
+		return out;
+
+	// Noise doesn't delta encode, send it as it is
+	out.assign(1, static_cast<char>(RAW));
+	for (uint16_t count : counts) {
+		out += static_cast<char>(count & 0xff);
+		out += static_cast<char>(count >> 8);
+	}
+
+	return out;
+}
+
+bool TileProtocol::decompress(const std::string &data, size_t count, std::vector<uint16_t> &counts) {
+
+	counts.clear();
+	counts.reserve(count);
+
+	if (data.empty())
+		return false;
+
+	if (data[0] == RAW) {
+
+		if (data.size() != 1 + count * 2)
+			return false;
+
+		for (size_t i = 0; i < count; i++)
+			counts.push_back(static_cast<uint16_t>(static_cast<uint8_t>(data[1 + i * 2]) | static_cast<uint8_t>(data[2 + i * 2]) << 8));
+
+		return true;
+	}
+
+	if (data[0] != DELTA_RUNS)
+		return false;
+
+	int32_t previous = 0;
+	size_t position = 1;
+
+	while (position < data.size()) {
+
+		uint32_t zigzag;
+		if (!read_varint(data, position, zigzag))
+			return false;
+
+		int32_t delta = static_cast<int32_t>(zigzag >> 1) ^ -static_cast<int32_t>(zigzag & 1);
+		previous += delta;
+
+		if (previous < 0 || previous > 0xffff || counts.size() >= count)
+			return false;
+
+		counts.push_back(static_cast<uint16_t>(previous));
+
+		if (delta == 0) {
+			uint32_t run;
+			if (!read_varint(data, position, run) || run > count - counts.size())
+				return false;
+			counts.insert(counts.end(), run, static_cast<uint16_t>(previous));
+		}
+	}
+
+	return counts.size() == count;
+}
+
+bool TileProtocol::read_type(sf::Packet &packet, message &type) {
+
+	sf::Uint8 value;
+	if (!(packet >> value) || value > DONE)
+		return false;
+
+	type = static_cast<message>(value);
+	return true;
+}
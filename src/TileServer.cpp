@@ -0,0 +1,488 @@
+#include "TileServer.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+
+const double TileServer::POLL_SECONDS = 0.05;
+const double TileServer::GATHER_SECONDS = 0.002;
+
+// Zoom 0 covers [-3, 1] x [-2, 2], the corner has to land on a level 2 cache tile edge
+const double WORLD_X = -3.0;
+const double WORLD_Y = -2.0;
+const double WORLD_SIZE = 4.0;
+
+const char* const VIEWER_PAGE =
+	"<!DOCTYPE html>\n"
+	"<html><head><meta charset=\"utf-8\"><title>Mandlebrot</title>\n"
+	"<link rel=\"stylesheet\" href=\"https://unpkg.com/leaflet@1.9.4/dist/leaflet.css\">\n"
+	"<script src=\"https://unpkg.com/leaflet@1.9.4/dist/leaflet.js\"></script>\n"
+	"<style>html, body, #map { height: 100%; margin: 0; background: #000; }</style>\n"
+	"</head><body><div id=\"map\"></div><script>\n"
+	"var map = L.map('map', { crs: L.CRS.Simple, minZoom: 0, maxZoom: 30 }).setView([-128, 128], 1);\n"
+	"L.tileLayer('/{z}/{x}/{y}.png', { tileSize: 256, maxZoom: 30, noWrap: true, bounds: [[-256, 0], [0, 256]] }).addTo(map);\n"
+	"</script></body></html>\n";
+
+TileServer::TileServer(Renderer &renderer) : renderer(renderer), stopping(false) {
+}
+
+bool TileServer::listen(unsigned short port) {
+
+	if (renderer.get_resolution() != sf::Vector2i(TILE_SIZE, TILE_SIZE)) {
+		std::cout << "The tile server's renderer has to be " << TILE_SIZE << "x" << TILE_SIZE << std::endl;
+		return false;
+	}
+
+	if (listener.listen(port) != sf::Socket::Done) {
+		std::cout << "Tile server couldn't listen on port " << port << std::endl;
+		return false;
+	}
+
+	selector.add(listener);
+	return true;
+}
+
+void TileServer::set_colouring(const std::vector<sf::Color> &palette, float density, bool smooth) {
+
+	this->palette = palette;
+	this->density = density;
+	this->smooth = smooth;
+
+	// Everything encoded so far is in the old colours
+	lru.clear();
+	entries.clear();
+	bytes = 0;
+}
+
+void TileServer::set_budget(size_t budget_bytes) {
+	budget = budget_bytes;
+}
+
+void TileServer::run(double seconds) {
+
+	clock::time_point end = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds));
+
+	while (!stopping && (seconds <= 0.0 || clock::now() < end)) {
+
+		// While anyone is waiting on a tile, only hold out for more requests until the oldest
+		// one has gathered long enough
+		double timeout = POLL_SECONDS;
+		for (const std::unique_ptr<connection> &c : connections) {
+			if (c->waiting)
+				timeout = std::min(timeout, GATHER_SECONDS - std::chrono::duration<double>(clock::now() - c->received).count());
+		}
+
+		if (timeout > 0.0 && selector.wait(sf::seconds(static_cast<float>(timeout)))) {
+
+			if (selector.isReady(listener))
+				accept();
+
+			for (size_t i = 0; i < connections.size(); i++) {
+				if (connections[i]->open && selector.isReady(*connections[i]->socket))
+					receive(*connections[i]);
+			}
+		}
+
+		bool gathered = false;
+		for (const std::unique_ptr<connection> &c : connections) {
+			if (c->waiting && std::chrono::duration<double>(clock::now() - c->received).count() >= GATHER_SECONDS)
+				gathered = true;
+		}
+
+		if (gathered)
+			render_waiting();
+
+		for (size_t i = 0; i < connections.size();) {
+			if (connections[i]->open) {
+				i++;
+				continue;
+			}
+			selector.remove(*connections[i]->socket);
+			connections[i]->socket->disconnect();
+			connections.erase(connections.begin() + i);
+		}
+	}
+}
+
+void TileServer::accept() {
+
+	std::unique_ptr<connection> c(new connection);
+	c->socket.reset(new sf::TcpSocket);
+
+	if (listener.accept(*c->socket) != sf::Socket::Done)
+		return;
+
+	selector.add(*c->socket);
+	connections.push_back(std::move(c));
+}
+
+void TileServer::receive(connection &c) {
+
+	char data[4096];
+	std::size_t received = 0;
+
+	if (c.socket->receive(data, sizeof(data), received) != sf::Socket::Done) {
+		c.open = false;
+		return;
+	}
+
+	c.buffer.append(data, received);
+	handle_requests(c);
+}
+
+void TileServer::handle_requests(connection &c) {
+
+	while (c.open && !c.waiting) {
+
+		size_t header_end = c.buffer.find("\r\n\r\n");
+
+		if (header_end == std::string::npos) {
+			if (c.buffer.size() > MAX_REQUEST_BYTES) {
+				stats.errors++;
+				c.close_after = true;
+				respond(c, "431 Request Header Fields Too Large", "text/plain", nullptr, 0);
+			}
+			return;
+		}
+
+		// Only GETs are served, so there's never a body to skip
+		std::string request = c.buffer.substr(0, header_end);
+		c.buffer.erase(0, header_end + 4);
+
+		stats.requests++;
+
+		std::string method, target, version;
+		std::istringstream request_line(request.substr(0, request.find("\r\n")));
+		request_line >> method >> target >> version;
+
+		std::string headers = request;
+		std::transform(headers.begin(), headers.end(), headers.begin(), [](char ch) { return static_cast<char>(std::tolower(static_cast<unsigned char>(ch))); });
+
+		// HTTP/1.1 keeps the connection open unless told otherwise, 1.0 closes it unless told otherwise
+		if (version == "HTTP/1.0")
+			c.close_after = headers.find("connection: keep-alive") == std::string::npos;
+		else
+			c.close_after = headers.find("connection: close") != std::string::npos;
+
+		target = target.substr(0, target.find('?'));
+
+		if (method != "GET") {
+			stats.errors++;
+			respond(c, "405 Method Not Allowed", "text/plain", nullptr, 0);
+			continue;
+		}
+
+		if (target == "/") {
+			respond(c, "200 OK", "text/html", reinterpret_cast<const sf::Uint8*>(VIEWER_PAGE), std::string(VIEWER_PAGE).size());
+			continue;
+		}
+
+		if (target == "/stats") {
+			std::string json = statistics_json();
+			respond(c, "200 OK", "application/json", reinterpret_cast<const sf::Uint8*>(json.data()), json.size());
+			continue;
+		}
+
+		tile_id id;
+		int length = 0;
+
+		if (std::sscanf(target.c_str(), "/%d/%d/%d.png%n", &id.z, &id.x, &id.y, &length) != 3 ||
+			length != static_cast<int>(target.size()) ||
+			id.z < 0 || id.z > MAX_ZOOM || id.x < 0 || id.y < 0 || id.x >= (1 << id.z) || id.y >= (1 << id.z)) {
+			stats.errors++;
+			respond(c, "404 Not Found", "text/plain", nullptr, 0);
+			continue;
+		}
+
+		c.received = clock::now();
+
+		png tile = find(id);
+		if (tile) {
+			stats.hits++;
+			respond_tile(c, tile);
+			record_latency(c);
+			continue;
+		}
+
+		stats.misses++;
+		c.waiting = true;
+		c.tile = id;
+	}
+}
+
+void TileServer::render_waiting() {
+
+	std::vector<connection*> waiting;
+	std::vector<tile_id> missing;
+	std::unordered_map<tile_id, size_t, tile_id_hash> indices;
+
+	// Viewers sharing a screen ask for the same tiles, each gets rendered once
+	for (const std::unique_ptr<connection> &c : connections) {
+		if (!c->waiting)
+			continue;
+
+		waiting.push_back(c.get());
+		if (indices.emplace(c->tile, missing.size()).second)
+			missing.push_back(c->tile);
+	}
+
+	std::vector<std::vector<cl_ushort>> counts;
+	render_tiles(missing, counts);
+
+	stats.batches++;
+
+	std::vector<png> tiles(missing.size());
+	for (size_t i = 0; i < missing.size(); i++) {
+		if (counts[i].empty())
+			continue;
+
+		tiles[i] = encode(counts[i]);
+		if (tiles[i])
+			insert(missing[i], tiles[i]);
+	}
+
+	for (connection *c : waiting) {
+		respond_tile(*c, tiles[indices[c->tile]]);
+		record_latency(*c);
+		c->waiting = false;
+	}
+
+	// Requests pipelined behind the ones just answered
+	for (connection *c : waiting)
+		handle_requests(*c);
+}
+
+void TileServer::render_tiles(const std::vector<tile_id> &missing, std::vector<std::vector<cl_ushort>> &counts) {
+
+	const int cache_size = TileCache::TILE_SIZE;
+	const int across = TILE_SIZE / cache_size;
+	const sf::Vector2i resolution(TILE_SIZE, TILE_SIZE);
+
+	counts.assign(missing.size(), std::vector<cl_ushort>());
+
+	std::vector<size_t> batched;
+	std::vector<TileKey> keys;
+
+	int32_t max_iterations = renderer.get_max_iterations();
+	int32_t escape_radius = TileKey::escape_key(renderer.get_escape_radius());
+
+	for (size_t i = 0; i < missing.size(); i++) {
+
+		const tile_id &id = missing[i];
+
+		if (renderer.is_cpu() || Renderer::precision_for(tile_view(id), resolution) != Renderer::SINGLE)
+			continue;
+
+		// Single precision only lasts a dozen levels in, the cache tile indices fit easily
+		int level = id.z + 2;
+		int first_x = static_cast<int>(std::lround(WORLD_X * (1 << id.z))) + id.x * across;
+		int first_y = static_cast<int>(std::lround(WORLD_Y * (1 << id.z))) + id.y * across;
+
+		for (int j = 0; j < across; j++) {
+			for (int k = 0; k < across; k++)
+				keys.push_back(TileKey{ TileKey::MANDELBROT, max_iterations, escape_radius, level, first_x + k, first_y + j });
+		}
+
+		batched.push_back(i);
+	}
+
+	std::vector<std::shared_ptr<const TileCache::Tile>> cache_tiles;
+
+	if (!keys.empty() && renderer.render_tiles(keys, cache_tiles)) {
+
+		for (size_t b = 0; b < batched.size(); b++) {
+
+			std::vector<cl_ushort> &tile = counts[batched[b]];
+			tile.resize(static_cast<size_t>(TILE_SIZE) * TILE_SIZE);
+
+			for (int part = 0; part < across * across; part++) {
+
+				const TileCache::Tile &source = *cache_tiles[b * across * across + part];
+				int x = (part % across) * cache_size;
+				int y = (part / across) * cache_size;
+
+				for (int row = 0; row < cache_size; row++)
+					std::copy(source.begin() + row * cache_size, source.begin() + (row + 1) * cache_size, tile.begin() + (y + row) * TILE_SIZE + x);
+			}
+		}
+
+		stats.batched += batched.size();
+	}
+
+	// The rest, and anything the batch failed on, a frame at a time
+	for (size_t i = 0; i < missing.size(); i++) {
+
+		if (!counts[i].empty())
+			continue;
+
+		renderer.invalidate();
+		renderer.set_view(tile_view(missing[i]));
+		renderer.render();
+
+		if (!renderer.read_iterations(counts[i]))
+			counts[i].clear();
+	}
+
+	stats.rendered += missing.size();
+}
+
+TileServer::png TileServer::encode(const std::vector<cl_ushort> &counts) {
+
+	std::vector<sf::Uint8> pixels;
+	Renderer::colour_on_host(counts, palette, 0.0f, density, smooth, pixels);
+
+	sf::Image image;
+	image.create(TILE_SIZE, TILE_SIZE, pixels.data());
+
+	std::shared_ptr<std::vector<sf::Uint8>> encoded = std::make_shared<std::vector<sf::Uint8>>();
+	if (!image.saveToMemory(*encoded, "png")) {
+		std::cout << "Failed encoding a tile" << std::endl;
+		return nullptr;
+	}
+
+	return encoded;
+}
+
+TileServer::png TileServer::find(const tile_id &id) {
+
+	auto entry = entries.find(id);
+	if (entry == entries.end())
+		return nullptr;
+
+	lru.splice(lru.begin(), lru, entry->second);
+	return entry->second->second;
+}
+
+void TileServer::insert(const tile_id &id, png tile) {
+
+	auto entry = entries.find(id);
+
+	if (entry != entries.end()) {
+		bytes -= entry->second->second->size();
+		lru.erase(entry->second);
+		entries.erase(entry);
+	}
+
+	bytes += tile->size();
+	lru.emplace_front(id, std::move(tile));
+	entries[id] = lru.begin();
+
+	// Always keep the newest, even over budget
+	while (bytes > budget && lru.size() > 1) {
+		bytes -= lru.back().second->size();
+		entries.erase(lru.back().first);
+		lru.pop_back();
+	}
+}
+
+void TileServer::respond(connection &c, const std::string &status, const std::string &type, const sf::Uint8 *body, size_t size) {
+
+	std::ostringstream header;
+	header << "HTTP/1.1 " << status << "\r\n"
+		<< "Content-Type: " << type << "\r\n"
+		<< "Content-Length: " << size << "\r\n"
+		<< "Access-Control-Allow-Origin: *\r\n"
+		<< (c.close_after ? "Connection: close\r\n" : "")
+		<< "\r\n";
+
+	// One send, a header going out on its own would sit waiting on a delayed ack
+	std::string response = header.str();
+	response.append(reinterpret_cast<const char*>(body), size);
+
+	// Blocking, tiles are small enough to fit in the socket's buffer
+	if (c.socket->send(response.data(), response.size()) != sf::Socket::Done || c.close_after)
+		c.open = false;
+}
+
+void TileServer::respond_tile(connection &c, const png &tile) {
+
+	if (!tile) {
+		stats.errors++;
+		respond(c, "500 Internal Server Error", "text/plain", nullptr, 0);
+		return;
+	}
+
+	respond(c, "200 OK", "image/png", tile->data(), tile->size());
+}
+
+void TileServer::record_latency(const connection &c) {
+
+	double milliseconds = std::chrono::duration<double, std::milli>(clock::now() - c.received).count();
+
+	if (latencies.size() < static_cast<size_t>(LATENCY_WINDOW))
+		latencies.push_back(milliseconds);
+	else
+		latencies[next_latency] = milliseconds;
+
+	next_latency = (next_latency + 1) % LATENCY_WINDOW;
+}
+
+TileServer::statistics TileServer::get_statistics() const {
+
+	statistics result = stats;
+	result.tiles = lru.size();
+	result.bytes = bytes;
+
+	if (latencies.empty())
+		return result;
+
+	std::vector<double> sorted = latencies;
+	std::sort(sorted.begin(), sorted.end());
+
+	double total = 0.0;
+	for (double latency : sorted)
+		total += latency;
+
+	auto percentile = [&sorted](double p) {
+		return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+	};
+
+	result.latency_mean = total / sorted.size();
+	result.latency_p50 = percentile(0.50);
+	result.latency_p95 = percentile(0.95);
+	result.latency_p99 = percentile(0.99);
+
+	return result;
+}
+
+std::string TileServer::statistics_json() const {
+
+	statistics s = get_statistics();
+
+	std::ostringstream json;
+	json << "{\"requests\": " << s.requests << ", \"hits\": " << s.hits << ", \"misses\": " << s.misses
+		<< ", \"errors\": " << s.errors << ", \"hit_rate\": " << s.hit_rate()
+		<< ", \"batches\": " << s.batches << ", \"rendered\": " << s.rendered << ", \"batched\": " << s.batched
+		<< ", \"tiles\": " << s.tiles << ", \"bytes\": " << s.bytes
+		<< ", \"latency_ms\": {\"mean\": " << s.latency_mean << ", \"p50\": " << s.latency_p50
+		<< ", \"p95\": " << s.latency_p95 << ", \"p99\": " << s.latency_p99 << "}}\n";
+
+	return json.str();
+}
+
+sf::Vector4d TileServer::tile_range(int z, int x, int y) {
+
+	double size = std::ldexp(WORLD_SIZE, -z);
+	return sf::Vector4d(WORLD_X + x * size, WORLD_X + (x + 1) * size, WORLD_Y + y * size, WORLD_Y + (y + 1) * size);
+}
+
+View TileServer::tile_view(const tile_id &id) {
+
+	// Tile corners are exact in a double down to MAX_ZOOM, only the spacing needs the extra limbs
+	sf::Vector4d range = tile_range(id.z, id.x, id.y);
+	double size = range.y - range.x;
+
+	View view;
+	view.width = size;
+	view.height = size;
+
+	int limbs = FixedPoint::limbs_for_spacing(size / TILE_SIZE);
+	view.center_x = FixedPoint(range.x + size / 2.0, limbs);
+	view.center_y = FixedPoint(range.z + size / 2.0, limbs);
+
+	return view;
+}
@@ -0,0 +1,250 @@
+#include "TileStore.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+TileStore::TileStore() {
+}
+
+TileStore::~TileStore() {
+	close();
+}
+
+bool TileStore::open(std::string path, size_t max_bytes) {
+
+	close();
+
+	this->max_bytes = max_bytes;
+	data_path = path + ".tiles";
+	std::string index_path = path + ".index";
+
+	size_t file_size = 0;
+
+#ifdef _WIN32
+	file = CreateFileA(data_path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		std::cout << "Couldn't open tile store " << data_path << std::endl;
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	file_size = static_cast<size_t>(size.QuadPart);
+#else
+	file = ::open(data_path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (file < 0) {
+		std::cout << "Couldn't open tile store " << data_path << std::endl;
+		return false;
+	}
+
+	struct stat status;
+	fstat(file, &status);
+	file_size = static_cast<size_t>(status.st_size);
+#endif
+
+	bool fresh = file_size < sizeof(header);
+	size_t stored_slots = fresh ? 0 : (file_size - sizeof(header)) / TILE_BYTES;
+
+	if (!map(stored_slots)) {
+		close();
+		return false;
+	}
+
+	header* head = reinterpret_cast<header*>(data);
+
+	if (fresh) {
+		memcpy(head->magic, "MTIL", 4);
+		head->version = STORE_VERSION;
+		head->tile_size = TileCache::TILE_SIZE;
+		head->written_slots = 0;
+	}
+	else if (memcmp(head->magic, "MTIL", 4) != 0 || head->version != STORE_VERSION || head->tile_size != TileCache::TILE_SIZE) {
+		std::cout << "Tile store " << data_path << " was written by an incompatible build" << std::endl;
+		close();
+		return false;
+	}
+
+	// Records pointing past the written slots are from a flush that never finished
+	next_slot = static_cast<uint32_t>(std::min<size_t>(head->written_slots, stored_slots));
+
+	if (FILE* existing = fopen(index_path.c_str(), "rb")) {
+
+		index_record record;
+		while (fread(&record, sizeof(record), 1, existing) == 1) {
+			if (record.slot < next_slot)
+				index[record.key] = record.slot;
+		}
+		fclose(existing);
+	}
+
+	index_file = fopen(index_path.c_str(), "ab");
+	if (!index_file) {
+		std::cout << "Couldn't open tile index " << index_path << std::endl;
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void TileStore::close() {
+
+	flush();
+
+	if (index_file) {
+		fclose(index_file);
+		index_file = nullptr;
+	}
+
+	unmap();
+
+#ifdef _WIN32
+	if (file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (file >= 0) {
+		::close(file);
+		file = -1;
+	}
+#endif
+
+	index.clear();
+	pending.clear();
+	next_slot = 0;
+}
+
+std::shared_ptr<const TileCache::Tile> TileStore::find(const TileKey &key) {
+
+	auto entry = is_open() ? index.find(key) : index.end();
+
+	if (entry == index.end()) {
+		misses++;
+		return nullptr;
+	}
+
+	hits++;
+
+	const uint16_t* counts = reinterpret_cast<const uint16_t*>(data + sizeof(header) + entry->second * TILE_BYTES);
+	return std::make_shared<TileCache::Tile>(counts, counts + TileCache::TILE_SIZE * TileCache::TILE_SIZE);
+}
+
+void TileStore::insert(const TileKey &key, const TileCache::Tile &tile) {
+
+	if (!is_open() || index.count(key) || tile.size() * sizeof(uint16_t) != TILE_BYTES)
+		return;
+
+	if ((next_slot + 1) * TILE_BYTES > max_bytes)
+		return;
+
+	if (next_slot >= slot_capacity && !map(slot_capacity + GROWTH_SLOTS))
+		return;
+
+	memcpy(data + sizeof(header) + next_slot * TILE_BYTES, tile.data(), TILE_BYTES);
+
+	index_record record;
+	record.key = key;
+	record.slot = next_slot;
+	pending.push_back(record);
+
+	index[key] = next_slot;
+	next_slot++;
+}
+
+void TileStore::flush() {
+
+	if (!index_file || pending.empty())
+		return;
+
+	// Slots before the header counts them, and the header before any record points at them.
+	// Otherwise a crash can leave a record for a slot that was only ever preallocated
+	if (!sync(sizeof(header) + next_slot * TILE_BYTES))
+		return;
+
+	reinterpret_cast<header*>(data)->written_slots = next_slot;
+	if (!sync(sizeof(header)))
+		return;
+
+	fwrite(pending.data(), sizeof(index_record), pending.size(), index_file);
+	fflush(index_file);
+	pending.clear();
+}
+
+bool TileStore::sync(size_t bytes) {
+
+#ifdef _WIN32
+	bool synced = FlushViewOfFile(data, bytes) && FlushFileBuffers(file);
+#else
+	bool synced = msync(data, bytes, MS_SYNC) == 0;
+#endif
+
+	if (!synced)
+		std::cout << "Couldn't sync tile store " << data_path << std::endl;
+
+	return synced;
+}
+
+bool TileStore::map(size_t slots) {
+
+	unmap();
+
+	size_t size = sizeof(header) + slots * TILE_BYTES;
+
+#ifdef _WIN32
+	// Mapping past the end of the file grows it
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+		static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), nullptr);
+
+	if (mapping)
+		data = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+#else
+	struct stat status;
+	fstat(file, &status);
+
+	if (static_cast<size_t>(status.st_size) < size && ftruncate(file, static_cast<off_t>(size)) != 0) {
+		std::cout << "Couldn't grow tile store " << data_path << std::endl;
+		return false;
+	}
+
+	void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+	data = mapped == MAP_FAILED ? nullptr : static_cast<char*>(mapped);
+#endif
+
+	if (!data) {
+		std::cout << "Couldn't map tile store " << data_path << std::endl;
+		return false;
+	}
+
+	slot_capacity = slots;
+	return true;
+}
+
+void TileStore::unmap() {
+
+	if (data) {
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap(data, sizeof(header) + slot_capacity * TILE_BYTES);
+#endif
+		data = nullptr;
+	}
+
+#ifdef _WIN32
+	if (mapping) {
+		CloseHandle(mapping);
+		mapping = nullptr;
+	}
+#endif
+
+	slot_capacity = 0;
+}
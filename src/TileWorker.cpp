@@ -0,0 +1,148 @@
+#include "TileWorker.h"
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+
+TileWorker::TileWorker(bool use_cpu, int device_index) : use_cpu(use_cpu), device_index(device_index) {
+}
+
+TileWorker::~TileWorker() {
+	socket.disconnect();
+}
+
+bool TileWorker::run(const std::string &host, unsigned short port) {
+
+	typedef std::chrono::steady_clock clock;
+	clock::time_point give_up = clock::now() + std::chrono::seconds(CONNECT_SECONDS);
+
+	while (socket.connect(sf::IpAddress(host), port, sf::seconds(1.0f)) != sf::Socket::Done) {
+
+		if (clock::now() > give_up) {
+			std::cout << "Worker couldn't reach a coordinator at " << host << ":" << port << std::endl;
+			return false;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(250));
+	}
+
+	// Nothing is known about the device until the first config brings up a renderer
+	sf::Packet hello;
+	hello << static_cast<sf::Uint8>(TileProtocol::HELLO) << (use_cpu ? std::string("CPU") : std::string("OpenCL device ") + std::to_string(device_index));
+
+	if (socket.send(hello) != sf::Socket::Done)
+		return false;
+
+	while (true) {
+
+		sf::Packet request;
+		if (socket.receive(request) != sf::Socket::Done) {
+			std::cout << "Worker lost the coordinator" << std::endl;
+			return false;
+		}
+
+		TileProtocol::message type;
+		if (!TileProtocol::read_type(request, type))
+			continue;
+
+		sf::Packet reply;
+
+		if (type == TileProtocol::DONE) {
+			return true;
+		}
+		else if (type == TileProtocol::CONFIG) {
+
+			sf::Int32 size, iterations, interval;
+			double radius;
+			if (!(request >> size >> iterations >> interval >> radius) || !configure(size, iterations, interval, radius))
+				return false;
+
+			reply << static_cast<sf::Uint8>(TileProtocol::READY) << renderer->get_device_name();
+		}
+		else if (type == TileProtocol::TILE) {
+
+			if (!renderer || !render_tile(request, reply))
+				continue;
+		}
+		else {
+			continue;
+		}
+
+		if (socket.send(reply) != sf::Socket::Done)
+			return false;
+	}
+}
+
+bool TileWorker::configure(int tile_size, int max_iterations, int escape_interval, double escape_radius) {
+
+	if (renderer && tile_size == this->tile_size && max_iterations == this->max_iterations) {
+		renderer->set_escape(escape_interval, escape_radius);
+		return true;
+	}
+
+	if (tile_size <= 0 || max_iterations <= 0) {
+		std::cout << "Worker got a config without a tile size or limit" << std::endl;
+		return false;
+	}
+
+	renderer.reset(new Renderer);
+	renderer->set_device(device_index);
+	renderer->set_max_iterations(max_iterations);
+	renderer->set_escape(escape_interval, escape_radius);
+
+	if (!renderer->init(sf::Vector2i(tile_size, tile_size), true, use_cpu)) {
+		renderer.reset();
+		return false;
+	}
+
+	this->tile_size = tile_size;
+	this->max_iterations = max_iterations;
+
+	return true;
+}
+
+bool TileWorker::render_tile(sf::Packet &request, sf::Packet &reply) {
+
+	sf::Uint32 job, tile;
+	std::string center_x, center_y;
+	double width, height;
+
+	if (!(request >> job >> tile >> center_x >> center_y >> width >> height))
+		return false;
+
+	reply << static_cast<sf::Uint8>(TileProtocol::RESULT) << job << tile;
+
+	if (!(width > 0.0 && height > 0.0)) {
+		reply << false << 0.0 << std::string();
+		return true;
+	}
+
+	typedef std::chrono::steady_clock clock;
+	clock::time_point start = clock::now();
+
+	View view;
+	view.width = width;
+	view.height = height;
+
+	int limbs = FixedPoint::limbs_for_spacing(view.pixel_spacing(sf::Vector2i(tile_size, tile_size)));
+	bool parsed = FixedPoint::from_string(center_x, limbs, view.center_x) && FixedPoint::from_string(center_y, limbs, view.center_y);
+
+	// The native renderer is single precision only, deeper tiles are left to a worker that can do them
+	if (!parsed || (renderer->is_cpu() && Renderer::precision_for(view, sf::Vector2i(tile_size, tile_size)) != Renderer::SINGLE)) {
+		reply << false << 0.0 << std::string();
+		return true;
+	}
+
+	// Neighbouring tiles are a whole tile apart, there's nothing of the last one to reuse
+	renderer->invalidate();
+	renderer->set_view(view);
+	renderer->render();
+
+	std::vector<cl_ushort> iterations;
+	bool ok = renderer->read_iterations(iterations);
+
+	double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+	reply << ok << seconds << (ok ? TileProtocol::compress(iterations) : std::string());
+	return true;
+}
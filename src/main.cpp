@@ -3,9 +3,17 @@
 #include <SFML/Graphics.hpp>
 #include <random>
 #include <chrono>
+#include <algorithm>
 #include "util.hpp"
 #include <thread>
-#include "OpenCL.h"
+// SFML's network headers come before anything pulling in X11, whose Status and None macros break them
+#include "Coordinator.h"
+#include "TileWorker.h"
+#include "TileServer.h"
+#include "Renderer.h"
+#include "CameraPath.h"
+#include "FrameWriter.h"
+#include <string.h>
 
 float elap_time() {
 	static std::chrono::time_point<std::chrono::system_clock> start;
@@ -24,96 +32,1251 @@ float elap_time() {
 const int WINDOW_X = 1920;
 const int WINDOW_Y = 1080;
 
+// Arrow keys move by whole pixels so the renderer can reuse the rest of the last frame
+const int PAN_PIXELS = 8;
+
 enum Mouse_State {PRESSED, DEPRESSED};
 
-int main() {
+struct Options {
 
-	sf::RenderWindow window(sf::VideoMode(WINDOW_X, WINDOW_Y), "quick-sfml-template");
-	window.setFramerateLimit(60);
+	// Skip OpenCL entirely, otherwise we only fall back when CL fails to come up
+	bool use_cpu = false;
 
-	float physic_step = 0.166f;
-	float physic_time = 0.0f;
-	double frame_time = 0.0, elapsed_time = 0.0, delta_time = 0.0, accumulator_time = 0.0, current_time = 0.0;
-	
-	OpenCL cl;
+	// Render a single image to output_path without ever opening a window
+	bool headless = false;
 
-	sf::Vector4f range(-1.0f, 1.0f, -1.0f, 1.0f);
-	sf::Vector2i image_resolution(WINDOW_X, WINDOW_Y);
+	View view;
+	sf::Vector2i resolution = sf::Vector2i(WINDOW_X, WINDOW_Y);
+
+	// --center and --width are kept as text until the resolution is known, so they can
+	// be parsed at whatever precision the zoom needs
+	std::string center_x;
+	std::string center_y;
+	double width = 0.0;
+	std::string output_path = "mandlebrot.png";
+
+	// How long the interactive loop lets a frame spend refining before it gets shown
+	double frame_budget_ms = 12.0;
+
+	// Mariani-Silver subdivision for single precision views
+	bool subdivide = false;
+
+	// Time subdivision against the brute force kernel instead of rendering
+	bool benchmark_subdivision = false;
+
+	// Memory budget for the tile cache, 0 leaves it off
+	double tile_cache_mb = 0.0;
+
+	// Tiles kept on disk across sessions, turns the tile cache on if it wasn't already
+	std::string tile_store_path;
+
+	// Index into PALETTES
+	int palette = 0;
+
+	// Let the window enqueue a frame while the last one is on screen, instead of waiting
+	// for every frame to finish on the device
+	bool pipelined = true;
+
+	// Profile every OpenCL command, show the averages over the image and write a
+	// Chrome trace here on exit
+	std::string profile_path;
+
+	// What the single precision kernel is specialized on, see Renderer::set_escape
+	int escape_interval = 4;
+	double escape_radius = 2.0;
+
+	// Split every frame across all the OpenCL devices on the machine
+	bool split = false;
+
+	// Tune the escape kernels' local sizes before rendering, later runs reuse the result
+	bool tune = false;
+
+	// Subsamples for pixels on the boundary, 0 leaves supersampling off
+	int supersample = 0;
+
+	// Zoom animation instead of a single image. Frames go from the start view into the
+	// target, `zoom` times narrower by the last one, and stream out to stream_path
+	int animation_frames = 0;
+	double animation_zoom = 1000.0;
+	std::string target_x;
+	std::string target_y;
+	std::string stream_path = "-";
+	FrameWriter::format stream_format = FrameWriter::Y4M;
+	int fps = 30;
+
+	// Resample the frames out of one log-polar strip around the target instead of rendering
+	// each of them, the zoom stays centred on the target the whole way
+	bool exponential_map = false;
+
+	// One of the devices OpenCL enumerates, -1 uses the saved one
+	int device = -1;
+
+	int max_iterations = 2000;
+
+	// Render tiles for the coordinator at this host:port instead of anything else
+	std::string worker_address;
+
+	// Render the view as tiles across this many worker processes. `spawn` of them get
+	// started on this machine (all of them by default), the rest connect to listen_port
+	int distribute = 0;
+	int spawn = -1;
+	unsigned short listen_port = TileProtocol::DEFAULT_PORT;
+
+	// Render again with 1, 2 .. distribute workers and report how the time scales
+	bool scaling = false;
+
+	// argv[0], what local workers get started as
+	std::string executable;
+
+	// Serve z/x/y PNG tiles over HTTP on serve_port, keeping serve_cache_mb of them encoded
+	bool serve = false;
+	unsigned short serve_port = 8080;
+	double serve_cache_mb = 64.0;
+
+	// Load test the tile server from this many simulated viewers on localhost instead of
+	// serving for good, each asks for load_requests tiles
+	int load_clients = 0;
+	int load_requests = 600;
+};
+
+// How long a distributed render waits for its workers to connect
+const double WORKER_WAIT_SECONDS = 30.0;
+
+// How often a tile server that's been busy prints its counters
+const double SERVER_REPORT_SECONDS = 10.0;
+
+// How deep the simulated viewers of a load test wander
+const int LOAD_MAX_ZOOM = 16;
+
+const std::string FONT_PATH = "../assets/fonts/Arial.ttf";
+
+struct Palette {
+	const char* name;
+	std::vector<sf::Color> (*build)();
+	float density;
+	bool smooth;
+};
+
+// P steps through these in the interactive loop
+const Palette PALETTES[] = {
+	{ "classic",  Renderer::classic_palette,  1.0f, false },
+	{ "gradient", Renderer::gradient_palette, 4.0f, true },
+};
+const int PALETTE_COUNT = sizeof(PALETTES) / sizeof(PALETTES[0]);
+
+void print_tile_cache(const TileCache &cache) {
+	std::cout << "Tile cache : " << cache.get_hits() << " hits, " << cache.get_misses() << " misses, "
+		<< cache.get_tile_count() << " tiles in " << cache.get_bytes() / (1024.0 * 1024.0) << " of "
+		<< cache.get_budget() / (1024.0 * 1024.0) << " MB" << std::endl;
+}
+
+void print_tile_store(const TileStore &store) {
+	std::cout << "Tile store : " << store.get_hits() << " hits, " << store.get_misses() << " misses, "
+		<< store.get_tile_count() << " tiles in " << store.get_bytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+}
+
+// How the frame was divided up, and how the devices together compare to the fastest one alone
+void print_device_shares(const Renderer &renderer) {
+
+	std::vector<Renderer::device_share> shares = renderer.get_device_shares();
+	if (shares.empty())
+		return;
+
+	int rows = renderer.get_resolution().y;
+
+	for (const Renderer::device_share &share : shares) {
+		std::cout << "  " << share.name << " : " << share.rows << " rows (" << 100.0 * share.rows / rows << "%), "
+			<< share.mpix_per_second << " Mpix/s" << std::endl;
+	}
+
+	std::cout << "  " << renderer.get_split_scaling() << "x the fastest device on its own" << std::endl;
+}
+
+// What share of the frame got refined, to weigh against what the pass costs
+void print_supersampling(const Renderer &renderer) {
+
+	if (renderer.get_supersampling() == 0 || renderer.is_cpu())
+		return;
+
+	sf::Vector2i resolution = renderer.get_resolution();
+	double pixels = static_cast<double>(resolution.x) * resolution.y;
+
+	std::cout << "Supersampled " << renderer.get_supersampled_pixels() << " pixels ("
+		<< 100.0 * renderer.get_supersampled_pixels() / pixels << "%) at "
+		<< renderer.get_supersampling() << " samples each";
+
+	if (renderer.get_supersample_overflow() > 0)
+		std::cout << ", " << renderer.get_supersample_overflow() << " more edge pixels didn't fit";
+
+	std::cout << std::endl;
+}
+
+// The cache and store are only used by the single precision OpenCL path
+bool setup_tiles(Renderer &renderer, const Options &options) {
+
+	renderer.set_tile_cache(options.tile_cache_mb > 0.0, static_cast<size_t>(options.tile_cache_mb * 1024 * 1024));
+
+	if (!options.tile_store_path.empty() && !renderer.open_tile_store(options.tile_store_path))
+		return false;
+
+	return true;
+}
+
+void print_usage(const char* program) {
+
+	std::cout << "Usage : " << program << " [--cpu] [--headless] [--range x_min x_max y_min y_max]"
+		<< " [--center x y --width w] [--size width height] [--output path] [--budget ms]"
+		<< " [--subdivide] [--benchmark-subdivision] [--tile-cache mb] [--tile-store path]"
+		<< " [--palette classic|gradient] [--no-pipeline] [--profile trace.json]"
+		<< " [--escape-interval 1-4] [--escape-radius r] [--split] [--tune] [--supersample 2-16]"
+		<< " [--animate frames --zoom factor --target x y [--stream path|-] [--format y4m|rgb] [--fps n] [--exponential-map]]"
+		<< " [--device n] [--iterations n] [--worker host:port]"
+		<< " [--distribute workers [--spawn n] [--listen port] [--scaling]]"
+		<< " [--serve port [--serve-cache mb] [--load-test clients [--requests n]]]" << std::endl;
+}
+
+bool parse_arguments(int argc, char* argv[], Options &options) {
+
+	for (int i = 1; i < argc; i++) {
+
+		std::string arg = argv[i];
+
+		if (arg == "--cpu") {
+			options.use_cpu = true;
+		}
+		else if (arg == "--headless") {
+			options.headless = true;
+		}
+		else if (arg == "--range" && i + 4 < argc) {
+			sf::Vector4d range;
+			range.x = atof(argv[++i]);
+			range.y = atof(argv[++i]);
+			range.z = atof(argv[++i]);
+			range.w = atof(argv[++i]);
+			options.view = View::from_range(range);
+		}
+		else if (arg == "--center" && i + 2 < argc) {
+			options.center_x = argv[++i];
+			options.center_y = argv[++i];
+		}
+		else if (arg == "--width" && i + 1 < argc) {
+			options.width = atof(argv[++i]);
+		}
+		else if (arg == "--size" && i + 2 < argc) {
+			options.resolution.x = atoi(argv[++i]);
+			options.resolution.y = atoi(argv[++i]);
+		}
+		else if (arg == "--output" && i + 1 < argc) {
+			options.output_path = argv[++i];
+		}
+		else if (arg == "--budget" && i + 1 < argc) {
+			options.frame_budget_ms = atof(argv[++i]);
+		}
+		else if (arg == "--subdivide") {
+			options.subdivide = true;
+		}
+		else if (arg == "--benchmark-subdivision") {
+			options.benchmark_subdivision = true;
+		}
+		else if (arg == "--tile-cache" && i + 1 < argc) {
+			options.tile_cache_mb = atof(argv[++i]);
+		}
+		else if (arg == "--tile-store" && i + 1 < argc) {
+			options.tile_store_path = argv[++i];
+		}
+		else if (arg == "--split") {
+			options.split = true;
+		}
+		else if (arg == "--tune") {
+			options.tune = true;
+		}
+		else if (arg == "--supersample" && i + 1 < argc) {
+			options.supersample = atoi(argv[++i]);
+		}
+		else if (arg == "--animate" && i + 1 < argc) {
+			options.animation_frames = atoi(argv[++i]);
+		}
+		else if (arg == "--zoom" && i + 1 < argc) {
+			options.animation_zoom = atof(argv[++i]);
+		}
+		else if (arg == "--target" && i + 2 < argc) {
+			options.target_x = argv[++i];
+			options.target_y = argv[++i];
+		}
+		else if (arg == "--stream" && i + 1 < argc) {
+			options.stream_path = argv[++i];
+		}
+		else if (arg == "--format" && i + 1 < argc) {
+			std::string name = argv[++i];
+			if (name == FrameWriter::format_name(FrameWriter::Y4M))
+				options.stream_format = FrameWriter::Y4M;
+			else if (name == FrameWriter::format_name(FrameWriter::RAW_RGB))
+				options.stream_format = FrameWriter::RAW_RGB;
+			else {
+				std::cout << "Unknown frame format : " << name << std::endl;
+				return false;
+			}
+		}
+		else if (arg == "--fps" && i + 1 < argc) {
+			options.fps = atoi(argv[++i]);
+		}
+		else if (arg == "--exponential-map") {
+			options.exponential_map = true;
+		}
+		else if (arg == "--device" && i + 1 < argc) {
+			options.device = atoi(argv[++i]);
+		}
+		else if (arg == "--iterations" && i + 1 < argc) {
+			options.max_iterations = atoi(argv[++i]);
+		}
+		else if (arg == "--worker" && i + 1 < argc) {
+			options.worker_address = argv[++i];
+		}
+		else if (arg == "--distribute" && i + 1 < argc) {
+			options.distribute = atoi(argv[++i]);
+		}
+		else if (arg == "--spawn" && i + 1 < argc) {
+			options.spawn = atoi(argv[++i]);
+		}
+		else if (arg == "--listen" && i + 1 < argc) {
+			options.listen_port = static_cast<unsigned short>(atoi(argv[++i]));
+		}
+		else if (arg == "--scaling") {
+			options.scaling = true;
+		}
+		else if (arg == "--serve" && i + 1 < argc) {
+			options.serve = true;
+			options.serve_port = static_cast<unsigned short>(atoi(argv[++i]));
+		}
+		else if (arg == "--serve-cache" && i + 1 < argc) {
+			options.serve_cache_mb = atof(argv[++i]);
+		}
+		else if (arg == "--load-test" && i + 1 < argc) {
+			options.load_clients = atoi(argv[++i]);
+		}
+		else if (arg == "--requests" && i + 1 < argc) {
+			options.load_requests = atoi(argv[++i]);
+		}
+		else if (arg == "--no-pipeline") {
+			options.pipelined = false;
+		}
+		else if (arg == "--profile" && i + 1 < argc) {
+			options.profile_path = argv[++i];
+		}
+		else if (arg == "--escape-interval" && i + 1 < argc) {
+			options.escape_interval = atoi(argv[++i]);
+		}
+		else if (arg == "--escape-radius" && i + 1 < argc) {
+			options.escape_radius = atof(argv[++i]);
+		}
+		else if (arg == "--palette" && i + 1 < argc) {
+			std::string name = argv[++i];
+			options.palette = -1;
+			for (int p = 0; p < PALETTE_COUNT; p++) {
+				if (name == PALETTES[p].name)
+					options.palette = p;
+			}
+			if (options.palette < 0) {
+				std::cout << "Unknown palette : " << name << std::endl;
+				return false;
+			}
+		}
+		else {
+			std::cout << "Unknown or incomplete argument : " << arg << std::endl;
+			return false;
+		}
+	}
+
+	if (!options.tile_store_path.empty() && options.tile_cache_mb <= 0.0)
+		options.tile_cache_mb = 256.0;
+
+	if (options.resolution.x <= 0 || options.resolution.y <= 0) {
+		std::cout << "Resolution must be positive" << std::endl;
+		return false;
+	}
+
+	if (options.animation_frames < 0 || options.animation_zoom <= 0.0 || options.fps <= 0) {
+		std::cout << "Animations need a positive frame count, zoom and frame rate" << std::endl;
+		return false;
+	}
+
+	if (options.max_iterations <= 0 || options.distribute < 0) {
+		std::cout << "Iteration limits and worker counts can't be negative" << std::endl;
+		return false;
+	}
+
+	if (options.load_clients < 0 || options.load_requests <= 0 || options.serve_cache_mb < 0.0) {
+		std::cout << "Load tests need a positive request count, and the server a cache budget" << std::endl;
+		return false;
+	}
+
+	// A load test on its own serves on any free port
+	if (options.load_clients > 0 && !options.serve) {
+		options.serve = true;
+		options.serve_port = 0;
+	}
+
+	options.spawn = options.spawn < 0 ? options.distribute : std::min(options.spawn, options.distribute);
+	options.executable = argv[0];
+
+	if (options.width > 0.0) {
+		options.view.width = options.width;
+		options.view.height = options.width * options.resolution.y / options.resolution.x;
+		options.view.fit_precision();
+	}
+
+	if (!options.center_x.empty()) {
+		int limbs = FixedPoint::limbs_for_spacing(options.view.pixel_spacing(options.resolution));
+		if (!FixedPoint::from_string(options.center_x, limbs, options.view.center_x) ||
+			!FixedPoint::from_string(options.center_y, limbs, options.view.center_y)) {
+			std::cout << "--center takes two decimal numbers" << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Everything a headless render sets up before its first frame
+bool setup_headless(Renderer &renderer, Profiler &profiler, const Options &options) {
+
+	if (!options.profile_path.empty())
+		renderer.set_profiler(&profiler);
+
+	renderer.set_device(options.device);
+	renderer.set_max_iterations(options.max_iterations);
+	renderer.set_split(options.split);
+	renderer.set_supersampling(options.supersample);
 
-	if (!cl.init())
+	if (!renderer.init(options.resolution, true, options.use_cpu))
+		return false;
+
+	renderer.set_subdivision(options.subdivide);
+	renderer.set_escape(options.escape_interval, options.escape_radius);
+	if (!setup_tiles(renderer, options))
+		return false;
+
+	if (options.tune && !renderer.tune_local_sizes())
+		return false;
+
+	const Palette &palette = PALETTES[options.palette];
+	renderer.set_palette(palette.build());
+	renderer.set_colouring(0.0f, palette.density, palette.smooth);
+
+	return true;
+}
+
+// Render one frame straight to disk. No RenderWindow and no GL context, so this works
+// on nodes without a display and doesn't pay for any window setup
+int render_headless(Options options) {
+
+	double start_time = elap_time();
+
+	Renderer renderer;
+	Profiler profiler;
+
+	if (!setup_headless(renderer, profiler, options))
+		return -1;
+
+	renderer.set_view(options.view);
+	renderer.render();
+
+	std::vector<sf::Uint8> pixels;
+	if (!renderer.read_pixels(pixels))
 		return -1;
-	
-	while (!cl.compile_kernel("../kernels/mandlebrot.cl", "mandlebrot")) {
-		std::cin.get();
+
+	if (!options.profile_path.empty()) {
+		profiler.collect();
+		profiler.write_trace(options.profile_path);
 	}
 
-	cl.create_image_buffer("viewport_image", image_resolution, sf::Vector2f(0, 0), CL_MEM_WRITE_ONLY);
-	cl.create_buffer("image_res", sizeof(sf::Vector2i), &image_resolution);
-	cl.create_buffer("range", sizeof(sf::Vector4f), (void*)&range, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
-	
-	cl.set_kernel_arg("mandlebrot", 0, "image_res");
-	cl.set_kernel_arg("mandlebrot", 1, "viewport_image");
-	cl.set_kernel_arg("mandlebrot", 2, "range");
+	sf::Image image;
+	image.create(options.resolution.x, options.resolution.y, pixels.data());
 
-	while (window.isOpen())
-	{
-		sf::Event event; // Handle input
-		while (window.pollEvent(event)) {
-			if (event.type == sf::Event::Closed) {
-				window.close();
+	if (!image.saveToFile(options.output_path)) {
+		std::cout << "Failed writing " << options.output_path << std::endl;
+		return -1;
+	}
+
+	std::cout << "Wrote " << options.output_path << " in " << (elap_time() - start_time) * 1000.0 << " ms"
+		<< " using " << Renderer::precision_name(renderer.get_precision()) << " precision" << std::endl;
+
+	if (renderer.get_precision() != Renderer::PERTURBATION && !renderer.is_cpu()) {
+		std::cout << "Interior pixels skipped : " << renderer.get_cardioid_pixels() << " cardioid, "
+			<< renderer.get_bulb_pixels() << " period-2 bulb, "
+			<< renderer.get_periodic_pixels() << " periodic orbit" << std::endl;
+	}
+
+	if (options.tile_cache_mb > 0.0)
+		print_tile_cache(renderer.get_tile_cache());
+
+	if (!options.tile_store_path.empty())
+		print_tile_store(renderer.get_tile_store());
+
+	print_device_shares(renderer);
+	print_supersampling(renderer);
+
+	if (renderer.get_precision() == Renderer::PERTURBATION) {
+		std::cout << renderer.get_reference_count() << " reference orbits, "
+			<< renderer.get_unresolved_glitches() << " pixels left glitched, "
+			<< renderer.get_skipped_iterations() << " iterations skipped by series approximation" << std::endl;
+	}
+	return 0;
+}
+
+// Render the camera path frame by frame and stream the frames out. The writer converts and
+// writes one frame while the next renders, and blocks the loop once two are waiting on it
+int render_animation(Options options) {
+
+	// Frames own stdout when they stream there, everything else gets printed to stderr
+	std::streambuf* console = std::cout.rdbuf();
+	if (options.stream_path == "-")
+		std::cout.rdbuf(std::cerr.rdbuf());
+
+	double start_time = elap_time();
+
+	Renderer renderer;
+	Profiler profiler;
+
+	if (!setup_headless(renderer, profiler, options)) {
+		std::cout.rdbuf(console);
+		return -1;
+	}
+
+	// Parsed at the precision of the last frame, the start view's is far too coarse
+	View last = options.view;
+	last.zoom(1.0 / options.animation_zoom);
+	int limbs = FixedPoint::limbs_for_spacing(last.pixel_spacing(options.resolution));
+
+	FixedPoint target_x = options.view.center_x;
+	FixedPoint target_y = options.view.center_y;
+
+	if (!options.target_x.empty() && (!FixedPoint::from_string(options.target_x, limbs, target_x) ||
+		!FixedPoint::from_string(options.target_y, limbs, target_y))) {
+		std::cout << "--target takes two decimal numbers" << std::endl;
+		std::cout.rdbuf(console);
+		return -1;
+	}
+
+	CameraPath path(options.view, target_x, target_y, options.animation_zoom, options.animation_frames);
+
+	// The strip reaches from the first frame's corners in to half a pixel of the last frame
+	if (options.exponential_map) {
+
+		double outer_radius = 0.5 * std::hypot(options.view.width, options.view.height);
+		double inner_radius = 0.5 * last.pixel_spacing(options.resolution);
+
+		if (!renderer.begin_exponential_map(target_x, target_y, outer_radius, inner_radius)) {
+			std::cout.rdbuf(console);
+			return -1;
+		}
+	}
+
+	FrameWriter writer;
+	if (!writer.open(options.stream_path, options.stream_format, options.resolution, options.fps)) {
+		std::cout.rdbuf(console);
+		return -1;
+	}
+
+	int written = 0;
+	std::vector<sf::Uint8> pixels;
+
+	for (int frame = 0; frame < path.get_frame_count(); frame++) {
+
+		View view = path.at(frame);
+
+		if (options.exponential_map) {
+			if (!renderer.render_exponential_map(view.width, view.height))
+				break;
+		} else {
+			renderer.set_view(view);
+			renderer.render();
+		}
+
+		if (!renderer.read_pixels(pixels) || !writer.write(std::move(pixels)))
+			break;
+
+		written++;
+
+		if (written % options.fps == 0) {
+			std::cout << "Frame " << written << " of " << path.get_frame_count() << ", ";
+			if (options.exponential_map)
+				std::cout << renderer.get_strip_pixels() << " strip pixels so far, ";
+			else
+				std::cout << Renderer::precision_name(renderer.get_precision()) << " precision, ";
+			std::cout << written / (elap_time() - start_time) << " frames/s" << std::endl;
+		}
+	}
+
+	bool complete = writer.close() && written == path.get_frame_count();
+
+	if (!options.profile_path.empty()) {
+		profiler.collect();
+		profiler.write_trace(options.profile_path);
+	}
+
+	std::cout << "Streamed " << written << " " << FrameWriter::format_name(options.stream_format) << " frames in "
+		<< elap_time() - start_time << " s" << std::endl;
+
+	if (options.exponential_map && renderer.get_strip_pixels() > 0) {
+		double frame_pixels = static_cast<double>(written) * options.resolution.x * options.resolution.y;
+		std::cout << "Escape loop ran over " << renderer.get_strip_pixels() << " strip pixels, "
+			<< frame_pixels / renderer.get_strip_pixels() << "x fewer than rendering every frame" << std::endl;
+	}
+
+	std::cout.rdbuf(console);
+	return complete ? 0 : -1;
+}
+
+// Serve tiles to a coordinator until it's done with us
+int run_worker(Options options) {
+
+	std::string host = options.worker_address;
+	unsigned short port = TileProtocol::DEFAULT_PORT;
+
+	size_t colon = host.rfind(':');
+	if (colon != std::string::npos) {
+		port = static_cast<unsigned short>(atoi(host.c_str() + colon + 1));
+		host = host.substr(0, colon);
+	}
+
+	TileWorker worker(options.use_cpu, options.device);
+	return worker.run(host, port) ? 0 : -1;
+}
+
+// Cut the view into tiles, render them across worker processes and colour the result
+// here. With --scaling the view is rendered again for every worker count up to the full one
+int render_distributed(Options options) {
+
+	double start_time = elap_time();
+
+	Coordinator coordinator;
+	if (!coordinator.listen(options.listen_port))
+		return -1;
+
+	std::cout << "Coordinator on port " << coordinator.get_port() << ", waiting for "
+		<< options.distribute << " workers, " << options.spawn << " of them local" << std::endl;
+
+	std::vector<std::string> worker_arguments;
+	if (options.use_cpu)
+		worker_arguments.push_back("--cpu");
+	if (options.device >= 0) {
+		worker_arguments.push_back("--device");
+		worker_arguments.push_back(std::to_string(options.device));
+	}
+
+	if (!coordinator.spawn_workers(options.executable, options.spawn, worker_arguments))
+		return -1;
+
+	if (!coordinator.wait_for_workers(options.distribute, WORKER_WAIT_SECONDS))
+		return -1;
+
+	coordinator.set_escape(options.escape_interval, options.escape_radius);
+
+	std::vector<uint16_t> iterations;
+	double single_seconds = 0.0;
+
+	for (int workers = options.scaling ? 1 : options.distribute; workers <= options.distribute; workers++) {
+
+		if (!coordinator.render(options.view, options.resolution, options.max_iterations, iterations, workers))
+			return -1;
+
+		double seconds = coordinator.get_render_seconds();
+		if (workers == 1)
+			single_seconds = seconds;
+
+		std::cout << workers << " workers : " << seconds * 1000.0 << " ms";
+		if (single_seconds > 0.0)
+			std::cout << ", " << single_seconds / seconds << "x one worker, "
+				<< single_seconds / (seconds * workers) * 100.0 << "% scaling efficiency";
+		std::cout << std::endl;
+	}
+
+	for (const Coordinator::worker_report &report : coordinator.get_reports()) {
+		std::cout << "  " << report.name << " : " << report.tiles << " tiles, " << report.stolen << " stolen, "
+			<< report.failed << " failed, " << report.busy_seconds * 1000.0 << " ms busy" << std::endl;
+	}
+
+	std::cout << coordinator.get_steals() << " tiles stolen, " << coordinator.get_backups() << " backed up, "
+		<< coordinator.get_retries() << " retried, counts compressed " << coordinator.get_compression() << "x, "
+		<< coordinator.get_efficiency() * 100.0 << "% of the workers' time spent rendering" << std::endl;
+
+	coordinator.shutdown();
+
+	const Palette &palette = PALETTES[options.palette];
+
+	std::vector<sf::Uint8> pixels;
+	Renderer::colour_on_host(iterations, palette.build(), 0.0f, palette.density, palette.smooth, pixels);
+
+	sf::Image image;
+	image.create(options.resolution.x, options.resolution.y, pixels.data());
+
+	if (!image.saveToFile(options.output_path)) {
+		std::cout << "Failed writing " << options.output_path << std::endl;
+		return -1;
+	}
+
+	std::cout << "Wrote " << options.output_path << " in " << (elap_time() - start_time) * 1000.0 << " ms" << std::endl;
+	return 0;
+}
+
+void print_tile_server(const TileServer::statistics &stats) {
+	std::cout << "Tile server : " << stats.requests << " requests, " << stats.hit_rate() * 100.0 << "% hits, "
+		<< stats.errors << " errors, " << stats.rendered << " tiles rendered in " << stats.batches << " batches ("
+		<< stats.batched << " by the batched kernel), " << stats.tiles << " tiles in "
+		<< stats.bytes / (1024.0 * 1024.0) << " MB, latency mean " << stats.latency_mean << " ms, p50 "
+		<< stats.latency_p50 << " ms, p95 " << stats.latency_p95 << " ms, p99 " << stats.latency_p99 << " ms" << std::endl;
+}
+
+// Read one response off `socket`. Whatever arrived after it stays in `buffer` for the next one
+bool read_response(sf::TcpSocket &socket, std::string &buffer, int &status, size_t &body_size) {
+
+	char data[16384];
+	std::size_t received = 0;
+
+	size_t header_end;
+	while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+		if (socket.receive(data, sizeof(data), received) != sf::Socket::Done)
+			return false;
+		buffer.append(data, received);
+	}
+
+	status = 0;
+	sscanf(buffer.c_str(), "HTTP/1.1 %d", &status);
+
+	size_t length = buffer.find("Content-Length: ");
+	body_size = length < header_end ? static_cast<size_t>(atol(buffer.c_str() + length + 16)) : 0;
+
+	while (buffer.size() < header_end + 4 + body_size) {
+		if (socket.receive(data, sizeof(data), received) != sf::Socket::Done)
+			return false;
+		buffer.append(data, received);
+	}
+
+	buffer.erase(0, header_end + 4 + body_size);
+	return true;
+}
+
+struct LoadResult {
+	std::vector<double> latencies;
+	int failures = 0;
+	size_t bytes = 0;
+};
+
+// One viewer wandering the map on a keep-alive connection. Each step it asks for the 3x3
+// screen of tiles around where it is, all at once like a browser would, then pans, zooms
+// in or backs out. Viewers start out on the same few tiles, so the shallow ones get shared
+void load_client(unsigned short port, int requests, unsigned int seed, LoadResult &result) {
+
+	sf::TcpSocket socket;
+	if (socket.connect(sf::IpAddress("127.0.0.1"), port, sf::seconds(5.0f)) != sf::Socket::Done) {
+		result.failures = requests;
+		return;
+	}
+
+	std::mt19937 random(seed);
+	std::uniform_int_distribution<int> choice(0, 9);
+	std::uniform_int_distribution<int> step(-1, 1);
+
+	int z = 1;
+	int x = random() % 2;
+	int y = random() % 2;
+
+	std::string buffer;
+	int sent = 0;
+
+	while (sent < requests) {
+
+		int tiles = 1 << z;
+		std::string batch;
+		int count = 0;
+
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -1; dx <= 1; dx++) {
+				if (x + dx < 0 || y + dy < 0 || x + dx >= tiles || y + dy >= tiles || sent + count >= requests)
+					continue;
+				batch += "GET /" + std::to_string(z) + "/" + std::to_string(x + dx) + "/" + std::to_string(y + dy)
+					+ ".png HTTP/1.1\r\nHost: localhost\r\n\r\n";
+				count++;
 			}
-			if (event.type == sf::Event::KeyPressed) {
-				if (event.key.code == sf::Keyboard::Down) {
-					range.z += 0.001f;
-					range.w += 0.001f;
-				}
-				if (event.key.code == sf::Keyboard::Up) {
-					range.z -= 0.001f;
-					range.w -= 0.001f;
-				}
-				if (event.key.code == sf::Keyboard::Right) {
-					range.x += 0.001f;
-					range.y += 0.001f;
-				}
-				if (event.key.code == sf::Keyboard::Left) {
-					range.x -= 0.001f;
-					range.y -= 0.001f;
-				}
-				if (event.key.code == sf::Keyboard::Equal) {
-					range.x *= 1.02f;
-					range.y *= 1.02f;
-					range.z *= 1.02f;
-					range.w *= 1.02f;
-				}
-				if (event.key.code == sf::Keyboard::Dash) {
-					range.x *= 0.98f;
-					range.y *= 0.98f;
-					range.z *= 0.98f;
-					range.w *= 0.98f;
-				}
+		}
+
+		double start = elap_time();
+
+		if (socket.send(batch.data(), batch.size()) != sf::Socket::Done) {
+			result.failures += requests - sent;
+			return;
+		}
+
+		for (int i = 0; i < count; i++) {
+
+			int status;
+			size_t body_size;
+
+			if (!read_response(socket, buffer, status, body_size)) {
+				result.failures += requests - sent;
+				return;
+			}
+
+			if (status != 200)
+				result.failures++;
+
+			result.latencies.push_back((elap_time() - start) * 1000.0);
+			result.bytes += body_size;
+			sent++;
+		}
+
+		int move = choice(random);
+
+		if (move < 4 && z < LOAD_MAX_ZOOM) {
+			z++;
+			x = x * 2 + random() % 2;
+			y = y * 2 + random() % 2;
+		}
+		else if (move < 6 && z > 1) {
+			z--;
+			x /= 2;
+			y /= 2;
+		}
+		else {
+			x = std::max(0, std::min(tiles - 1, x + step(random)));
+			y = std::max(0, std::min(tiles - 1, y + step(random)));
+		}
+	}
+}
+
+// Serve tiles on this thread and hit them with viewers on others, then report what the
+// viewers saw end to end next to what the server counted
+int load_test(TileServer &server, const Options &options) {
+
+	std::thread serving([&server]() { server.run(); });
+
+	std::vector<LoadResult> results(options.load_clients);
+	std::vector<std::thread> clients;
+
+	double start_time = elap_time();
+
+	for (int c = 0; c < options.load_clients; c++) {
+		LoadResult &result = results[c];
+		clients.emplace_back([&server, &options, &result, c]() {
+			load_client(server.get_port(), options.load_requests, c + 1, result);
+		});
+	}
+
+	for (std::thread &client : clients)
+		client.join();
+
+	double seconds = elap_time() - start_time;
+
+	server.stop();
+	serving.join();
+
+	std::vector<double> latencies;
+	int failures = 0;
+	size_t bytes = 0;
+
+	for (const LoadResult &result : results) {
+		latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+		failures += result.failures;
+		bytes += result.bytes;
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&latencies](double p) {
+		return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+	};
+
+	std::cout << options.load_clients << " viewers, " << latencies.size() << " tiles in " << seconds << " s, "
+		<< latencies.size() / seconds << " tiles/s, " << bytes / (1024.0 * 1024.0) << " MB, " << failures << " failed" << std::endl;
+	std::cout << "Viewer latency p50 " << percentile(0.50) << " ms, p95 " << percentile(0.95) << " ms, p99 "
+		<< percentile(0.99) << " ms" << std::endl;
+
+	print_tile_server(server.get_statistics());
+
+	return failures > 0 ? -1 : 0;
+}
+
+// Serve tiles until killed, or load test the server and exit
+int serve_tiles(Options options) {
+
+	options.resolution = sf::Vector2i(TileServer::TILE_SIZE, TileServer::TILE_SIZE);
+
+	Renderer renderer;
+	Profiler profiler;
+
+	if (!setup_headless(renderer, profiler, options))
+		return -1;
+
+	const Palette &palette = PALETTES[options.palette];
+
+	TileServer server(renderer);
+	server.set_colouring(palette.build(), palette.density, palette.smooth);
+	server.set_budget(static_cast<size_t>(options.serve_cache_mb * 1024 * 1024));
+
+	if (!server.listen(options.serve_port))
+		return -1;
+
+	std::cout << "Serving tiles on http://localhost:" << server.get_port() << "/" << std::endl;
+
+	if (options.load_clients > 0)
+		return load_test(server, options);
+
+	long long reported = 0;
+
+	while (true) {
+
+		server.run(SERVER_REPORT_SECONDS);
+
+		TileServer::statistics stats = server.get_statistics();
+		if (stats.requests != reported)
+			print_tile_server(stats);
+		reported = stats.requests;
+	}
+}
+
+// Mariani-Silver against the brute force kernel on views that are mostly inside the set,
+// which is where filling tiles pays off the most
+int benchmark_subdivision(Options options) {
+
+	Renderer renderer;
+
+	if (!renderer.init(options.resolution, true, options.use_cpu))
+		return -1;
+
+	if (renderer.is_cpu()) {
+		std::cout << "Subdivision is only implemented for OpenCL" << std::endl;
+		return -1;
+	}
+
+	struct Benchmark {
+		const char* name;
+		double center_x;
+		double center_y;
+		double width;
+	};
+
+	const Benchmark views[] = {
+		{ "full set",        -0.75,  0.0,   3.0 },
+		{ "main cardioid",   -0.4,   0.0,   0.6 },
+		{ "period-2 bulb",   -1.0,   0.0,   0.5 },
+		{ "period-3 bulb",   -0.16,  1.035, 0.1 },
+		{ "seahorse valley", -0.745, 0.113, 0.01 },
+	};
+
+	const int repeats = 5;
+
+	for (const Benchmark &benchmark : views) {
+
+		double height = benchmark.width * options.resolution.y / options.resolution.x;
+		renderer.set_range(sf::Vector4d(
+			benchmark.center_x - benchmark.width / 2, benchmark.center_x + benchmark.width / 2,
+			benchmark.center_y - height / 2, benchmark.center_y + height / 2));
+
+		double times[2];
+		long long computed[2];
+		std::vector<sf::Uint8> pixels[2];
+
+		for (int mode = 0; mode < 2; mode++) {
+
+			renderer.set_subdivision(mode == 1);
+
+			double start = elap_time();
+			for (int i = 0; i < repeats; i++) {
+				renderer.invalidate();
+				renderer.render();
 			}
+			times[mode] = (elap_time() - start) * 1000.0 / repeats;
+			computed[mode] = renderer.get_computed_pixels();
+
+			renderer.read_pixels(pixels[mode]);
+		}
+
+		long long differing = 0;
+		for (size_t i = 0; i < pixels[0].size(); i += 4) {
+			if (memcmp(&pixels[0][i], &pixels[1][i], 4) != 0)
+				differing++;
 		}
 
-		elapsed_time = elap_time(); // Handle time
-		delta_time = elapsed_time - current_time;
-		current_time = elapsed_time;
-		if (delta_time > 0.02f)
-			delta_time = 0.02f;
-		accumulator_time += delta_time;
+		std::cout << benchmark.name << " : brute force " << times[0] << " ms, subdivision " << times[1] << " ms ("
+			<< times[0] / times[1] << "x), " << 100.0 * computed[1] / computed[0] << "% of pixels computed, "
+			<< differing << " pixels differ" << std::endl;
+	}
+
+	return 0;
+}
+
+// What the keys control in the interactive loop
+struct Interaction {
+
+	View view;
+
+	// Colouring runs as its own pass, so none of these ever recompute the fractal.
+	// P swaps palettes, C toggles palette cycling, comma and period change the density
+	int palette_index = 0;
+	float palette_offset = 0.0f;
+	float density_scale = 1.0f;
+	bool cycling = false;
+	bool colouring_changed = true;
+};
+
+// Palette entries per second while cycling
+const float CYCLE_SPEED = 20.0f;
+
+// 60 fps while anything is changing
+const double FRAME_INTERVAL = 1.0 / 60.0;
+
+// Longest step palette cycling takes between frames, after a stall it just picks up again
+const double MAX_FRAME_DELTA = 0.1;
+
+// Apply one event, returns whether the image needs redrawing because of it
+bool handle_event(const sf::Event &event, sf::RenderWindow &window, Renderer &renderer, Interaction &state) {
+
+	sf::Vector2i image_resolution = renderer.get_resolution();
+
+	if (event.type == sf::Event::Closed) {
+		window.close();
+		return false;
+	}
+
+	// The window contents may be gone
+	if (event.type == sf::Event::Resized || event.type == sf::Event::GainedFocus)
+		return true;
+
+	if (event.type != sf::Event::KeyPressed)
+		return false;
+
+	switch (event.key.code) {
+	case sf::Keyboard::Down:
+		state.view.pan_pixels(0, PAN_PIXELS, image_resolution);
+		return true;
+	case sf::Keyboard::Up:
+		state.view.pan_pixels(0, -PAN_PIXELS, image_resolution);
+		return true;
+	case sf::Keyboard::Right:
+		state.view.pan_pixels(PAN_PIXELS, 0, image_resolution);
+		return true;
+	case sf::Keyboard::Left:
+		state.view.pan_pixels(-PAN_PIXELS, 0, image_resolution);
+		return true;
+	// Zoom about the view center, scaling about the origin drifts off
+	// anything interesting long before the deep zoom kernels kick in
+	case sf::Keyboard::Equal:
+		state.view.zoom(1.02);
+		return true;
+	case sf::Keyboard::Dash:
+		state.view.zoom(0.98);
+		return true;
+	case sf::Keyboard::P:
+		state.palette_index = (state.palette_index + 1) % PALETTE_COUNT;
+		renderer.set_palette(PALETTES[state.palette_index].build());
+		state.colouring_changed = true;
+		return true;
+	case sf::Keyboard::C:
+		state.cycling = !state.cycling;
+		return true;
+	case sf::Keyboard::Comma:
+		state.density_scale /= 1.25f;
+		state.colouring_changed = true;
+		return true;
+	case sf::Keyboard::Period:
+		state.density_scale *= 1.25f;
+		state.colouring_changed = true;
+		return true;
+	default:
+		return false;
+	}
+}
+
+int main(int argc, char* argv[]) {
+
+	Options options;
+	if (!parse_arguments(argc, argv, options)) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	if (!options.worker_address.empty())
+		return run_worker(options);
+
+	if (options.distribute > 0)
+		return render_distributed(options);
+
+	if (options.serve)
+		return serve_tiles(options);
+
+	if (options.benchmark_subdivision)
+		return benchmark_subdivision(options);
+
+	if (options.animation_frames > 0)
+		return render_animation(options);
+
+	if (options.headless)
+		return render_headless(options);
+
+	sf::RenderWindow window(sf::VideoMode(WINDOW_X, WINDOW_Y), "quick-sfml-template");
 
-		while (accumulator_time >= physic_step) { // While the frame has sim time, update 
-			accumulator_time -= physic_step;
-			physic_time += physic_step;
+	sf::Vector2i image_resolution(WINDOW_X, WINDOW_Y);
+
+	Renderer renderer;
+	Profiler profiler;
+
+	bool profiling = !options.profile_path.empty();
+	if (profiling) {
+		renderer.set_profiler(&profiler);
+		profiler.load_font(FONT_PATH);
+	}
+
+	renderer.set_device(options.device);
+	renderer.set_max_iterations(options.max_iterations);
+	renderer.set_split(options.split);
+	renderer.set_supersampling(options.supersample);
+
+	if (!renderer.init(image_resolution, false, options.use_cpu, options.pipelined))
+		return -1;
+
+	// Show something coarse right away and sharpen it over the next frames
+	renderer.set_progressive(true, options.frame_budget_ms / 1000.0);
+	renderer.set_subdivision(options.subdivide);
+	renderer.set_escape(options.escape_interval, options.escape_radius);
+	if (!setup_tiles(renderer, options))
+		return -1;
+
+	if (options.tune && !renderer.tune_local_sizes())
+		return -1;
+
+	Interaction state;
+	state.view = options.view;
+	state.palette_index = options.palette;
+	renderer.set_palette(PALETTES[state.palette_index].build());
+
+	// Rolling render throughput so the two backends can be compared
+	double render_time = 0.0;
+	long long rendered_pixels = 0;
+	double last_report_time = 0.0;
+
+	typedef std::chrono::steady_clock clock;
+	clock::time_point next_frame = clock::now();
+	clock::time_point last_frame = next_frame;
+
+	// Set by anything that changes the image, cleared once it has settled on screen
+	bool dirty = true;
+
+	while (window.isOpen())
+	{
+		sf::Event event;
+
+		// Nothing changed and nothing left to refine, sleep until something happens instead
+		// of drawing the same image again. The pacing starts over afterwards
+		if (!dirty) {
+			if (window.waitEvent(event))
+				dirty = handle_event(event, window, renderer, state) || dirty;
+
+			next_frame = clock::now();
+			last_frame = next_frame;
 		}
 
+		// Everything that queued up since the last frame lands in this one, so a burst of
+		// key repeats costs one render instead of one each
+		while (window.pollEvent(event))
+			dirty = handle_event(event, window, renderer, state) || dirty;
+
+		if (!window.isOpen() || !dirty)
+			continue;
+
+		clock::time_point frame_start = clock::now();
+		double delta_time = std::min(std::chrono::duration<double>(frame_start - last_frame).count(), MAX_FRAME_DELTA);
+		last_frame = frame_start;
+
+		double elapsed_time = elap_time();
+
 		window.clear(sf::Color::White);
-	
-		cl.run_kernel("mandlebrot", image_resolution);
-		cl.draw(&window);
+
+		double render_start = elap_time();
+
+		if (state.cycling) {
+			state.palette_offset += static_cast<float>(delta_time) * CYCLE_SPEED;
+			state.colouring_changed = true;
+		}
+
+		if (state.colouring_changed) {
+			const Palette &palette = PALETTES[state.palette_index];
+			renderer.set_colouring(state.palette_offset, palette.density * state.density_scale, palette.smooth);
+			state.colouring_changed = false;
+		}
+
+		renderer.set_view(state.view);
+
+		Profiler::clock::time_point render_begin = Profiler::clock::now();
+		renderer.render();
+
+		// Checked before drawing, a pipelined frame that completes in between still gets shown
+		bool busy = renderer.is_busy();
+
+		Profiler::clock::time_point draw_begin = Profiler::clock::now();
+		renderer.draw(&window);
+
+		if (profiling) {
+			profiler.add_span("render", render_begin, draw_begin);
+			profiler.add_span("draw", draw_begin, Profiler::clock::now());
+			profiler.collect();
+			profiler.draw(&window);
+		}
+
+		// Pipelined renders return before the device is done, so only the wall clock means anything
+		if (renderer.is_pipelined())
+			render_time += delta_time;
+		else
+			render_time += elap_time() - render_start;
+
+		rendered_pixels += renderer.get_computed_pixels();
+
+		if (elapsed_time - last_report_time > 1.0 && render_time > 0.0) {
+			double mpix = rendered_pixels / 1000000.0;
+			std::cout << (renderer.is_cpu() ? "CPU" : "OpenCL") << " : " << mpix / render_time << " Mpix/s";
+
+			if (renderer.get_precision() == Renderer::PERTURBATION)
+				std::cout << ", " << renderer.get_skipped_iterations() << " iterations skipped per frame";
+
+			std::cout << std::endl;
+
+			if (options.tile_cache_mb > 0.0)
+				print_tile_cache(renderer.get_tile_cache());
+
+			if (!options.tile_store_path.empty())
+				print_tile_store(renderer.get_tile_store());
+
+			print_device_shares(renderer);
+			print_supersampling(renderer);
+
+			render_time = 0.0;
+			rendered_pixels = 0;
+			last_report_time = elapsed_time;
+		}
 
 		window.display();
 
+		// Cycling changes the colours every frame, anything else is done once the image settles
+		dirty = busy || state.cycling;
+
+		// Paced against a deadline, so a slow frame doesn't push every later one back. One
+		// that overran just starts the schedule over instead of rushing to catch up
+		next_frame += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(FRAME_INTERVAL));
+		clock::time_point now = clock::now();
+
+		if (next_frame > now)
+			std::this_thread::sleep_until(next_frame);
+		else
+			next_frame = now;
 	}
+
+	// Idle frames never collect and a pipelined one may still be running, so the last
+	// frames' events would otherwise miss the trace
+	if (profiling) {
+		renderer.finish();
+		profiler.collect();
+		profiler.write_trace(options.profile_path);
+	}
+
 	return 0;
 
 }